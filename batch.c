@@ -0,0 +1,317 @@
+// getline and nanosleep are POSIX
+#define _XOPEN_SOURCE 700
+
+#include "cursor.h"
+#include "loader.h"
+#include "memento.h"
+#include "memory_stats.h"
+#include "profiler.h"
+#include "rope.h"
+#include "save.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Headless batch editor, applies a script of edits to a file and saves it
+// usage: batch.out <file> [script|-] [output]
+//
+// The script is read from stdin unless given, the result overwrites the
+// file unless an output is given. One command per line, lines and columns
+// count from 1, columns and lengths are in bytes. TEXT runs to the end of
+// the line, \n, \t and \\ stand for a line break, a tab and a backslash
+//   insert LINE:COL TEXT
+//   delete LINE:COL LENGTH
+//   replace LINE:COL LENGTH TEXT
+//   s/SEARCH/REPLACEMENT/  replaces every match, any delimiter works
+//   mark                   remembers the document
+//   undo                   goes back to the last mark
+// Blank lines and lines starting with # are skipped
+
+// Undo steps kept, marks past this drop the oldest
+#define BATCH_MARKS 64
+
+typedef struct {
+    RopeTree *tree;
+    LineIndex index;
+    Caretaker *marks;
+    size_t edits;
+} Document;
+
+static bool load_document(const char *path, Document *doc,
+                          TextFormat *format) {
+    FileLoader *loader = start_file_loader(path);
+    if (!loader) {
+        return false;
+    }
+    *format = loader->format;
+    doc->tree->file = loader->paged;
+    retain_paged_file(doc->tree->file);
+    // the worker reads ahead while blocks are added here
+    struct timespec wait = {.tv_nsec = 1000000};
+    while (!drain_file_loader(loader, doc->tree, &doc->index)) {
+        nanosleep(&wait, nullptr);
+    }
+    free_file_loader(loader);
+    return true;
+}
+
+// Turns escapes in text into the bytes they stand for, returns the length
+static size_t unescape(char *text) {
+    size_t length = 0;
+    for (char *at = text; *at; ++at) {
+        if (*at == '\\' && at[1]) {
+            at++;
+            text[length++] = *at == 'n' ? '\n' : *at == 't' ? '\t' : *at;
+        } else {
+            text[length++] = *at;
+        }
+    }
+    text[length] = '\0';
+    return length;
+}
+
+// Ends the field at the first unescaped delim, returns what follows it or
+// nullptr if there is no delim
+static char *end_field(char *text, char delim) {
+    for (char *at = text; *at; ++at) {
+        if (*at == '\\' && at[1]) {
+            at++;
+        } else if (*at == delim) {
+            *at = '\0';
+            return at + 1;
+        }
+    }
+    return nullptr;
+}
+
+// Parses LINE:COL into an offset in the document, args is moved past it
+static bool parse_position(Document *doc, char **args, size_t *offset) {
+    char *end;
+    size_t line = strtoul(*args, &end, 10);
+    if (end == *args || *end != ':') {
+        return false;
+    }
+    char *column_start = end + 1;
+    size_t column = strtoul(column_start, &end, 10);
+    if (end == column_start || !line || !column ||
+        line > doc->index.line_num) {
+        return false;
+    }
+    line--;
+    column--;
+    // the line break is not a column of its own
+    size_t length = get_line_length(&doc->index, line) -
+                    (line + 1 < doc->index.line_num);
+    if (column > length) {
+        return false;
+    }
+    *offset = line_column_to_offset(doc->index, line, column);
+    *args = end;
+    return true;
+}
+
+static bool parse_length(char **args, size_t *length) {
+    char *end;
+    *length = strtoul(*args, &end, 10);
+    if (end == *args) {
+        return false;
+    }
+    *args = end;
+    return true;
+}
+
+// Replaces length bytes at offset with text as a batch of one, so only the
+// path down to the edited leaf is visited instead of the whole tree
+static bool edit_text(Document *doc, size_t offset, size_t length,
+                      const char *text, size_t text_length) {
+    if (offset + length > doc->tree->length) {
+        return false;
+    }
+    if (!length && !text_length) {
+        return true;
+    }
+    RopeEdit edit = {offset, length, text, text_length, nullptr};
+    doc->tree = apply_edits(doc->tree, &edit, 1);
+    apply_edits_to_index(&doc->index, &edit, 1);
+    return true;
+}
+
+static void reindex(Document *doc) {
+    List *leaves = get_leaves(doc->tree);
+    travelse_list_and_index_lines(leaves, &doc->index);
+    free_list(leaves);
+}
+
+// Replaces every match of search in one pass over the rope and the line
+// index, returns the matches or -1 on failure
+static long search_replace(Document *doc, const char *search,
+                           size_t search_length, char *replacement,
+                           size_t replacement_length) {
+    RopeEdit *edits;
+    size_t count;
+    if (!find_replace_edits(doc->tree, search, search_length, replacement,
+                            replacement_length, &edits, &count)) {
+        return -1;
+    }
+    if (count) {
+        doc->tree = apply_edits(doc->tree, edits, count);
+        apply_edits_to_index(&doc->index, edits, count);
+    }
+    free(edits);
+    return count;
+}
+
+static void mark_document(Document *doc) {
+    save_memento(doc->marks, create_memento(doc->tree, nullptr));
+}
+
+static bool undo_document(Document *doc) {
+    Memento *m = pop_memento(doc->marks);
+    if (!m) {
+        return false;
+    }
+    free_rope(doc->tree);
+    doc->tree = restore_from_memento(m, nullptr);
+    reindex(doc);
+    free_memento(m);
+    return true;
+}
+
+// s/SEARCH/REPLACEMENT/ with line[1] as the delimiter
+static bool substitute(Document *doc, char *line) {
+    char delim = line[1];
+    char *search = line + 2;
+    char *replacement = end_field(search, delim);
+    char *rest = replacement ? end_field(replacement, delim) : nullptr;
+    if (!rest || *rest) {
+        return false;
+    }
+    size_t search_length = unescape(search);
+    return search_length &&
+           search_replace(doc, search, search_length, replacement,
+                          unescape(replacement)) >= 0;
+}
+
+// Runs one line of the script, false if it is malformed or out of range
+static bool run_command(Document *doc, char *line) {
+    line[strcspn(line, "\n")] = '\0';
+    if (!*line || *line == '#') {
+        return true;
+    }
+    if (line[0] == 's' && line[1] && line[1] != ' ') {
+        if (!substitute(doc, line)) {
+            return false;
+        }
+        doc->edits++;
+        return true;
+    }
+    char *args = line + strcspn(line, " ");
+    if (*args) {
+        *args++ = '\0';
+    }
+
+    size_t offset, length;
+    if (!strcmp(line, "insert")) {
+        if (!parse_position(doc, &args, &offset) || *args != ' ') {
+            return false;
+        }
+        char *text = args + 1;
+        edit_text(doc, offset, 0, text, unescape(text));
+    } else if (!strcmp(line, "delete")) {
+        if (!parse_position(doc, &args, &offset) || *args++ != ' ' ||
+            !parse_length(&args, &length) || *args ||
+            !edit_text(doc, offset, length, "", 0)) {
+            return false;
+        }
+    } else if (!strcmp(line, "replace")) {
+        if (!parse_position(doc, &args, &offset) || *args++ != ' ' ||
+            !parse_length(&args, &length) || *args != ' ') {
+            return false;
+        }
+        char *text = args + 1;
+        if (!edit_text(doc, offset, length, text, unescape(text))) {
+            return false;
+        }
+    } else if (!strcmp(line, "mark") && !*args) {
+        mark_document(doc);
+        return true;
+    } else if (!strcmp(line, "undo") && !*args) {
+        return undo_document(doc);
+    } else {
+        return false;
+    }
+    doc->edits++;
+    return true;
+}
+
+static double mb_per_s(size_t bytes, int64_t ns) {
+    return ns ? bytes / 1e6 / (ns / 1e9) : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file> [script|-] [output]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *script_path = argc > 2 ? argv[2] : "-";
+    const char *output_path = argc > 3 ? argv[3] : argv[1];
+    FILE *script = strcmp(script_path, "-") ? fopen(script_path, "r") : stdin;
+    if (!script) {
+        perror("Failed to open script");
+        return EXIT_FAILURE;
+    }
+
+    Document doc = {.tree = create_tree(),
+                    .marks = create_caretaker(BATCH_MARKS)};
+    clear_line_index(&doc.index);
+    TextFormat format;
+    int64_t load_start = profile_now();
+    if (!load_document(argv[1], &doc, &format)) {
+        return EXIT_FAILURE;
+    }
+    size_t loaded = doc.tree->length;
+    int64_t load_ns = profile_now() - load_start;
+
+    // A bad command stops the run before anything is written
+    char *line = nullptr;
+    size_t capacity = 0;
+    size_t line_number = 0;
+    int64_t edit_start = profile_now();
+    while (getline(&line, &capacity, script) >= 0) {
+        line_number++;
+        if (!run_command(&doc, line)) {
+            fprintf(stderr, "%s:%zu: cannot apply command\n", script_path,
+                    line_number);
+            return EXIT_FAILURE;
+        }
+    }
+    int64_t edit_ns = profile_now() - edit_start;
+    free(line);
+    if (script != stdin) {
+        fclose(script);
+    }
+
+    int64_t save_start = profile_now();
+    size_t file_size;
+    if (!save_rope(doc.tree, output_path, format, &file_size, nullptr)) {
+        return EXIT_FAILURE;
+    }
+    int64_t save_ns = profile_now() - save_start;
+
+    fprintf(stderr, "load  %10zu bytes %9.2f ms %9.1f MB/s\n", loaded,
+            load_ns / 1e6, mb_per_s(loaded, load_ns));
+    fprintf(stderr, "edit  %10zu cmds  %9.2f ms %9.0f cmds/s\n", doc.edits,
+            edit_ns / 1e6, edit_ns ? doc.edits / (edit_ns / 1e9) : 0);
+    fprintf(stderr, "save  %10zu bytes %9.2f ms %9.1f MB/s\n", file_size,
+            save_ns / 1e6, mb_per_s(file_size, save_ns));
+    MemoryStats stats = {.rope = rope_stats(),
+                         .line_index = line_index_bytes(&doc.index),
+                         .history = caretaker_bytes(doc.marks)};
+    print_memory_stats(&stats, stderr);
+
+    free_caretaker(doc.marks);
+    free_rope(doc.tree);
+    free_line_index(&doc.index);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+#include "cursor.h"
+#include "profiler.h"
+#include "render.h"
+#include "renderer.h"
+#include "rope.h"
+#include "shape_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Headless frame time benchmark, renders a file with the CPU backend
+// usage: bench.out <file> [frames] [font size] [frame.ppm]
+
+#define BENCH_WIDTH 1280
+#define BENCH_HEIGHT 720
+
+int compare_ns(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file> [frames] [font size] [frame.ppm]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t frames = argc > 2 ? strtoul(argv[2], nullptr, 10) : 300;
+    uint32_t font_size = argc > 3 ? strtoul(argv[3], nullptr, 10) : 24;
+    const char *ppm_path = argc > 4 ? argv[4] : nullptr;
+    if (frames == 0) {
+        frames = 1;
+    }
+
+    FILE *fp = fopen(argv[1], "r");
+    if (!fp) {
+        perror("Failed to open file");
+        return EXIT_FAILURE;
+    }
+    int64_t load_start = profile_now();
+    RopeTree *tree = build_rope_from_file(fp);
+    fclose(fp);
+
+    LineIndex line_index = {0};
+    List *leaves = get_leaves(tree);
+    travelse_list_and_index_lines(leaves, &line_index);
+    free_list(leaves);
+    int64_t load_ns = profile_now() - load_start;
+
+    RenderContext ctx = {0};
+    ctx.renderer = create_soft_renderer();
+    ctx.fonts = create_font_cache(ctx.renderer, "./Iosevka-Regular.ttf");
+    ctx.shape_cache = create_shape_cache(SHAPE_CACHE_CAPACITY);
+    ctx.column_cache = create_column_cache();
+    ctx.highlight = create_highlight_index();
+    if (ctx.highlight) {
+        ctx.highlight->enabled = highlights_path(argv[1]);
+    }
+    if (!set_render_font_size(&ctx, font_size)) {
+        return EXIT_FAILURE;
+    }
+
+    // Scroll through the whole document, one cursor position per frame
+    int64_t *frame_ns = malloc(frames * sizeof(int64_t));
+    struct Cursor cursor = {0};
+    for (size_t i = 0; i < frames; ++i) {
+        cursor.line = line_index.line_num * i / frames;
+        ctx.scroll.follow_cursor = true;
+        int64_t start = profile_now();
+        render_document(&ctx, tree, &line_index, cursor, BENCH_WIDTH,
+                        BENCH_HEIGHT);
+        frame_ns[i] = profile_now() - start;
+    }
+
+    if (ppm_path) {
+        cursor.line = 0;
+        ctx.scroll.follow_cursor = true;
+        render_document(&ctx, tree, &line_index, cursor, BENCH_WIDTH,
+                        BENCH_HEIGHT);
+        soft_renderer_write_ppm(ctx.renderer, ppm_path);
+    }
+
+    int64_t total_ns = 0;
+    for (size_t i = 0; i < frames; ++i) {
+        total_ns += frame_ns[i];
+    }
+    qsort(frame_ns, frames, sizeof(int64_t), compare_ns);
+
+    printf("file: %.2f MB, %zu lines, loaded in %.2f ms\n",
+           tree->length / (1024.0 * 1024.0), line_index.line_num,
+           load_ns / 1e6);
+    printf("frames: %zu, %.1f fps, p50 %.3f ms, p99 %.3f ms\n", frames,
+           frames * 1e9 / total_ns, frame_ns[frames / 2] / 1e6,
+           frame_ns[frames * 99 / 100] / 1e6);
+    for (ProfilePhase phase = 0; phase < PHASE_COUNT; ++phase) {
+        ProfileStats stats = profile_stats(phase);
+        printf("  %-10s p50 %.3f ms, p99 %.3f ms\n", profile_phase_name(phase),
+               stats.p50_ns / 1e6, stats.p99_ns / 1e6);
+    }
+
+    free(frame_ns);
+    free_shape_cache(ctx.shape_cache);
+    free_column_cache(ctx.column_cache);
+    free_highlight_index(ctx.highlight);
+    free(ctx.line_text);
+    free_font_cache(ctx.fonts);
+    ctx.renderer->destroy(ctx.renderer);
+    free_tree(tree->root);
+    free(tree);
+    return 0;
+}
@@ -0,0 +1,231 @@
+#include "clipboard.h"
+#include <X11/Xatom.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Clipboard *create_clipboard(Display *dsp, Window win) {
+    Clipboard *clipboard = calloc(1, sizeof(Clipboard));
+    if (!clipboard) {
+        perror("Failed to allocate clipboard");
+        return nullptr;
+    }
+    clipboard->dsp = dsp;
+    clipboard->win = win;
+    clipboard->clipboard = XInternAtom(dsp, "CLIPBOARD", False);
+    clipboard->targets = XInternAtom(dsp, "TARGETS", False);
+    clipboard->utf8_string = XInternAtom(dsp, "UTF8_STRING", False);
+    clipboard->incr = XInternAtom(dsp, "INCR", False);
+    clipboard->paste_property = XInternAtom(dsp, "EDITOR_PASTE", False);
+    // requests are counted in 4 byte units, leave room for the header
+    long max_request = XExtendedMaxRequestSize(dsp);
+    if (!max_request) {
+        max_request = XMaxRequestSize(dsp);
+    }
+    clipboard->chunk_bytes = MIN(CLIPBOARD_CHUNK_BYTES,
+                                 (size_t)max_request * 4 - 1024);
+    return clipboard;
+}
+
+// Transfers still running are cut short, the requestor gets the empty
+// closing chunk next
+static void end_transfers(Clipboard *clipboard) {
+    for (size_t i = 0; i < clipboard->transfer_count; ++i) {
+        clipboard->transfers[i].offset = SIZE_MAX;
+    }
+}
+
+static void drop_slice(Clipboard *clipboard) {
+    end_transfers(clipboard);
+    free_rope(clipboard->slice);
+    free_line_index(&clipboard->lines);
+    clipboard->slice = nullptr;
+}
+
+void free_clipboard(Clipboard *clipboard) {
+    if (!clipboard) {
+        return;
+    }
+    drop_slice(clipboard);
+    free(clipboard->transfers);
+    free(clipboard);
+}
+
+void set_clipboard(Clipboard *clipboard, RopeTree *slice, LineIndex lines) {
+    drop_slice(clipboard);
+    clipboard->slice = slice;
+    clipboard->lines = lines;
+    XSetSelectionOwner(clipboard->dsp, clipboard->clipboard, clipboard->win,
+                       CurrentTime);
+}
+
+void request_clipboard(Clipboard *clipboard) {
+    XConvertSelection(clipboard->dsp, clipboard->clipboard,
+                      clipboard->utf8_string, clipboard->paste_property,
+                      clipboard->win, CurrentTime);
+}
+
+void handle_selection_clear(Clipboard *clipboard) {
+    drop_slice(clipboard);
+}
+
+static ClipboardTransfer *add_transfer(Clipboard *clipboard) {
+    if (clipboard->transfer_count == clipboard->transfer_capacity) {
+        size_t capacity =
+            clipboard->transfer_capacity ? clipboard->transfer_capacity * 2 : 4;
+        ClipboardTransfer *grown = realloc(
+            clipboard->transfers, capacity * sizeof(ClipboardTransfer));
+        if (!grown) {
+            perror("Failed to grow clipboard transfers");
+            return nullptr;
+        }
+        clipboard->transfers = grown;
+        clipboard->transfer_capacity = capacity;
+    }
+    return &clipboard->transfers[clipboard->transfer_count++];
+}
+
+// Puts the slice into property of requestor, in one piece if it fits and
+// as an INCR transfer otherwise
+static bool send_slice(Clipboard *clipboard, Window requestor, Atom property,
+                       Atom target) {
+    size_t length = clipboard->slice->length;
+    if (length <= clipboard->chunk_bytes) {
+        char *text = malloc(length + 1);
+        if (!text) {
+            perror("Failed to allocate clipboard text");
+            return false;
+        }
+        if (copy_range(clipboard->slice->root, 0, length, text) < length) {
+            free(text);
+            return false;
+        }
+        XChangeProperty(clipboard->dsp, requestor, property, target, 8,
+                        PropModeReplace, (unsigned char *)text, length);
+        free(text);
+        return true;
+    }
+
+    ClipboardTransfer *transfer = add_transfer(clipboard);
+    if (!transfer) {
+        return false;
+    }
+    *transfer = (ClipboardTransfer){requestor, property, target, 0, false};
+    // chunks follow as the requestor deletes the property
+    XSelectInput(clipboard->dsp, requestor, PropertyChangeMask);
+    long size = length;
+    XChangeProperty(clipboard->dsp, requestor, property, clipboard->incr, 32,
+                    PropModeReplace, (unsigned char *)&size, 1);
+    return true;
+}
+
+void handle_selection_request(Clipboard *clipboard,
+                              XSelectionRequestEvent *event) {
+    XSelectionEvent reply = {
+        .type = SelectionNotify,
+        .display = event->display,
+        .requestor = event->requestor,
+        .selection = event->selection,
+        .target = event->target,
+        .property = None,
+        .time = event->time,
+    };
+    // clients from before ICCCM leave the property out
+    Atom property = event->property ? event->property : event->target;
+    if (event->selection == clipboard->clipboard && clipboard->slice) {
+        if (event->target == clipboard->targets) {
+            Atom targets[] = {clipboard->targets, clipboard->utf8_string,
+                              XA_STRING};
+            XChangeProperty(clipboard->dsp, event->requestor, property,
+                            XA_ATOM, 32, PropModeReplace,
+                            (unsigned char *)targets,
+                            sizeof(targets) / sizeof(*targets));
+            reply.property = property;
+        } else if ((event->target == clipboard->utf8_string ||
+                    event->target == XA_STRING) &&
+                   send_slice(clipboard, event->requestor, property,
+                              event->target)) {
+            reply.property = property;
+        }
+    }
+    XSendEvent(clipboard->dsp, event->requestor, False, NoEventMask,
+               (XEvent *)&reply);
+}
+
+void handle_property_notify(Clipboard *clipboard, XPropertyEvent *event) {
+    if (event->state != PropertyDelete) {
+        return;
+    }
+    for (size_t i = 0; i < clipboard->transfer_count; ++i) {
+        ClipboardTransfer *transfer = &clipboard->transfers[i];
+        if (transfer->requestor != event->window ||
+            transfer->property != event->atom) {
+            continue;
+        }
+        if (transfer->done) {
+            // the requestor took the empty chunk, the transfer is over
+            XSelectInput(clipboard->dsp, transfer->requestor, NoEventMask);
+            clipboard->transfers[i] =
+                clipboard->transfers[--clipboard->transfer_count];
+            return;
+        }
+        size_t length = clipboard->slice ? clipboard->slice->length : 0;
+        size_t chunk = transfer->offset < length
+                           ? MIN(clipboard->chunk_bytes,
+                                 length - transfer->offset)
+                           : 0;
+        char *text = malloc(chunk + 1);
+        if (!text) {
+            perror("Failed to allocate clipboard chunk");
+            chunk = 0;
+        } else if (chunk && copy_range(clipboard->slice->root,
+                                       transfer->offset, chunk,
+                                       text) < chunk) {
+            // an empty chunk ends the transfer, cut short rather than
+            // sending text that was never read
+            chunk = 0;
+            transfer->offset = length;
+        }
+        XChangeProperty(clipboard->dsp, transfer->requestor,
+                        transfer->property, transfer->target, 8,
+                        PropModeReplace, (unsigned char *)text, chunk);
+        free(text);
+        transfer->offset += chunk;
+        transfer->done = !chunk;
+        return;
+    }
+}
+
+char *read_selection_notify(Clipboard *clipboard, XSelectionEvent *event,
+                            size_t *length) {
+    if (event->property == None) {
+        return nullptr;
+    }
+    Atom type;
+    int format;
+    unsigned long items, remaining;
+    unsigned char *data = nullptr;
+    // an empty read tells the type and size
+    XGetWindowProperty(clipboard->dsp, clipboard->win, event->property, 0, 0,
+                       False, AnyPropertyType, &type, &format, &items,
+                       &remaining, &data);
+    XFree(data);
+    if (type == clipboard->incr || format != 8) {
+        return nullptr;
+    }
+    data = nullptr;
+    XGetWindowProperty(clipboard->dsp, clipboard->win, event->property, 0,
+                       (remaining + 3) / 4, True, AnyPropertyType, &type,
+                       &format, &items, &remaining, &data);
+    char *text = malloc(items + 1);
+    if (!text) {
+        perror("Failed to allocate pasted text");
+        XFree(data);
+        return nullptr;
+    }
+    memcpy(text, data, items);
+    text[items] = '\0';
+    XFree(data);
+    *length = items;
+    return text;
+}
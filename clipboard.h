@@ -0,0 +1,70 @@
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+#include "cursor.h"
+#include "rope.h"
+#include <X11/Xlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Most bytes put into one property, larger selections are sent to other
+// programs in chunks of this with the INCR protocol
+#define CLIPBOARD_CHUNK_BYTES (256 << 10)
+
+// Requestor that takes a large selection chunk by chunk, the next one is
+// written whenever it deletes the property
+typedef struct {
+    Window requestor;
+    Atom property;
+    Atom target;
+    size_t offset; // bytes sent so far
+    bool done;     // the closing empty chunk was written
+} ClipboardTransfer;
+
+// Text copied or cut, kept as a rope slice so that text still on disk is
+// only referenced. The window owns CLIPBOARD while it is set
+typedef struct {
+    Display *dsp;
+    Window win;
+    Atom clipboard;
+    Atom targets;
+    Atom utf8_string;
+    Atom incr;
+    Atom paste_property; // where pastes from other programs arrive
+    size_t chunk_bytes;
+    RopeTree *slice; // nullptr once another program took CLIPBOARD
+    LineIndex lines; // lines of slice, counted from 0
+    ClipboardTransfer *transfers;
+    size_t transfer_count;
+    size_t transfer_capacity;
+} Clipboard;
+
+[[nodiscard]]
+Clipboard *create_clipboard(Display *dsp, Window win);
+
+void free_clipboard(Clipboard *clipboard);
+
+// Takes over slice and lines and claims CLIPBOARD for them
+void set_clipboard(Clipboard *clipboard, RopeTree *slice, LineIndex lines);
+
+// Asks the owner of CLIPBOARD for its text, it arrives with a
+// SelectionNotify
+void request_clipboard(Clipboard *clipboard);
+
+// Answers another program asking for the slice
+void handle_selection_request(Clipboard *clipboard,
+                              XSelectionRequestEvent *event);
+
+// Another program took CLIPBOARD, the slice is dropped
+void handle_selection_clear(Clipboard *clipboard);
+
+// Sends the next chunk once a requestor deleted the last one
+void handle_property_notify(Clipboard *clipboard, XPropertyEvent *event);
+
+// Text requested by request_clipboard, nullptr if there is none. Text
+// sent with INCR is not taken
+[[nodiscard]]
+char *read_selection_notify(Clipboard *clipboard, XSelectionEvent *event,
+                            size_t *length);
+
+#endif
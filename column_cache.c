@@ -0,0 +1,175 @@
+#include "column_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static void reset_line_columns(LineColumns *columns, size_t line) {
+    columns->line = line;
+    columns->count = 0;
+    columns->scanned = (ColumnCheckpoint){0, 0};
+}
+
+ColumnCache *create_column_cache() {
+    ColumnCache *cache = calloc(1, sizeof(ColumnCache));
+    if (!cache) {
+        perror("Failed to allocate column cache");
+        return nullptr;
+    }
+    clear_column_cache(cache);
+    return cache;
+}
+
+void clear_column_cache(ColumnCache *cache) {
+    for (size_t i = 0; i < COLUMN_CACHE_LINES; ++i) {
+        reset_line_columns(&cache->lines[i], SIZE_MAX);
+    }
+}
+
+void free_column_cache(ColumnCache *cache) {
+    if (!cache) {
+        return;
+    }
+    for (size_t i = 0; i < COLUMN_CACHE_LINES; ++i) {
+        free(cache->lines[i].checkpoints);
+    }
+    free(cache);
+}
+
+static LineColumns *get_line_columns(ColumnCache *cache, size_t line) {
+    for (size_t i = 0; i < COLUMN_CACHE_LINES; ++i) {
+        if (cache->lines[i].line == line) {
+            return &cache->lines[i];
+        }
+    }
+    LineColumns *columns = &cache->lines[cache->next];
+    cache->next = (cache->next + 1) % COLUMN_CACHE_LINES;
+    reset_line_columns(columns, line);
+    return columns;
+}
+
+static void add_checkpoint(LineColumns *columns, ColumnCheckpoint checkpoint) {
+    if (columns->count == columns->capacity) {
+        size_t new_cap = columns->capacity ? columns->capacity * 2 : 16;
+        ColumnCheckpoint *grown = realloc(
+            columns->checkpoints, new_cap * sizeof(ColumnCheckpoint));
+        if (!grown) {
+            return;
+        }
+        columns->checkpoints = grown;
+        columns->capacity = new_cap;
+    }
+    columns->checkpoints[columns->count++] = checkpoint;
+}
+
+// Walks the line from pos until the character covering column or the end
+// of the line, adding checkpoints on the way if record is set
+static ColumnCheckpoint scan_columns(ColumnCache *cache, LineColumns *columns,
+                                     RopeTree *tree, size_t line_start,
+                                     size_t line_length, ColumnCheckpoint pos,
+                                     size_t column, bool record) {
+    char chunk[COLUMN_SCAN_BYTES];
+    while (pos.byte < line_length) {
+        size_t length = line_length - pos.byte;
+        length = length < sizeof(chunk) ? length : sizeof(chunk);
+        length = copy_range(tree->root, line_start + pos.byte, length, chunk);
+        if (!length) {
+            break;
+        }
+
+        for (size_t i = 0; i < length; ++i) {
+            unsigned char c = chunk[i];
+            if ((c & 0xC0) == 0x80) {
+                continue; // utf8 continuation byte
+            }
+            size_t width = c == '\t' ? cache->tab_w : 1;
+            ColumnCheckpoint here = {pos.byte + i, pos.column};
+            if (column < here.column + width) {
+                return here;
+            }
+            if (record &&
+                here.column >= columns->checkpoints[columns->count - 1].column +
+                                   COLUMN_CHECKPOINT) {
+                add_checkpoint(columns, here);
+            }
+            pos.column += width;
+        }
+        pos.byte += length;
+    }
+    return pos;
+}
+
+size_t seek_column(ColumnCache *cache, RopeTree *tree, LineIndex *index,
+                   size_t line, size_t column, uint32_t tab_w,
+                   size_t *start_column) {
+    if (tab_w != cache->tab_w) {
+        clear_column_cache(cache);
+        cache->tab_w = tab_w;
+    }
+
+    size_t line_start = get_line_offset(index, line);
+    size_t line_length = get_line_length(index, line);
+    if (line + 1 < index->line_num) {
+        line_length--; // new line
+    }
+
+    LineColumns *columns = get_line_columns(cache, line);
+    if (!columns->count) {
+        add_checkpoint(columns, (ColumnCheckpoint){0, 0});
+    }
+
+    // Extend the scanned part of the line up to column first
+    if (columns->scanned.byte < line_length &&
+        columns->scanned.column <= column) {
+        columns->scanned = scan_columns(
+            cache, columns, tree, line_start, line_length, columns->scanned,
+            column + COLUMN_CHECKPOINT, true);
+    }
+
+    // Last checkpoint at or before column
+    size_t low = 0;
+    size_t high = columns->count;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (columns->checkpoints[mid].column <= column) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    ColumnCheckpoint found =
+        scan_columns(cache, columns, tree, line_start, line_length,
+                     columns->checkpoints[low], column, false);
+    *start_column = found.column;
+    return found.byte;
+}
+
+void invalidate_column_line(ColumnCache *cache, size_t line, size_t byte) {
+    for (size_t i = 0; i < COLUMN_CACHE_LINES; ++i) {
+        LineColumns *columns = &cache->lines[i];
+        if (columns->line != line) {
+            continue;
+        }
+        // A checkpoint at byte may now start inside a different character
+        while (columns->count > 1 &&
+               columns->checkpoints[columns->count - 1].byte >= byte) {
+            columns->count--;
+        }
+        if (columns->count && columns->scanned.byte >= byte) {
+            columns->scanned = columns->checkpoints[columns->count - 1];
+        }
+    }
+}
+
+void shift_column_lines(ColumnCache *cache, size_t line, int64_t delta) {
+    for (size_t i = 0; i < COLUMN_CACHE_LINES; ++i) {
+        LineColumns *columns = &cache->lines[i];
+        if (columns->line == SIZE_MAX || columns->line < line) {
+            continue;
+        }
+        if (delta < 0 && columns->line < line + (size_t)-delta) {
+            reset_line_columns(columns, SIZE_MAX);
+        } else {
+            columns->line += delta;
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef COLUMN_CACHE_H
+#define COLUMN_CACHE_H
+
+#include "cursor.h"
+#include "rope.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Lines longer than this are only laid out where they are on screen
+#define LONG_LINE_BYTES 4096
+
+// Columns between two checkpoints of a line
+#define COLUMN_CHECKPOINT 1024
+
+// Long lines whose checkpoints are kept at once
+#define COLUMN_CACHE_LINES 64
+
+// Bytes read from the rope at a time while scanning a line
+#define COLUMN_SCAN_BYTES 4096
+
+typedef struct {
+    size_t byte;   // offset in the line of a character start
+    size_t column; // column that character starts at
+} ColumnCheckpoint;
+
+// Checkpoints of one long line, built lazily up to the furthest column
+// that was asked for
+typedef struct {
+    size_t line; // SIZE_MAX when the slot is unused
+    ColumnCheckpoint *checkpoints;
+    size_t count;
+    size_t capacity;
+    ColumnCheckpoint scanned; // first character not scanned yet
+} LineColumns;
+
+typedef struct {
+    LineColumns lines[COLUMN_CACHE_LINES];
+    size_t next; // slot replaced on the next miss
+    uint32_t tab_w;
+} ColumnCache;
+
+[[nodiscard]]
+ColumnCache *create_column_cache();
+
+void clear_column_cache(ColumnCache *cache);
+
+void free_column_cache(ColumnCache *cache);
+
+// Byte offset in line of the character covering column, start_column
+// receives the column that character starts at
+size_t seek_column(ColumnCache *cache, RopeTree *tree, LineIndex *index,
+                   size_t line, size_t column, uint32_t tab_w,
+                   size_t *start_column);
+
+// Forgets the checkpoints of line after byte, called after an edit
+void invalidate_column_line(ColumnCache *cache, size_t line, size_t byte);
+
+// Moves lines from line on by delta after lines were inserted or deleted,
+// deleted lines are dropped
+void shift_column_lines(ColumnCache *cache, size_t line, int64_t delta);
+
+#endif
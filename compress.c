@@ -0,0 +1,144 @@
+#include "compress.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t read_word(const char *at) {
+    uint32_t word;
+    memcpy(&word, at, sizeof(word));
+    return word;
+}
+
+static size_t hash_word(uint32_t word) {
+    return (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Lengths past the 15 a token holds follow it in bytes of 255
+static uint8_t *put_length(uint8_t *out, size_t length) {
+    for (; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = length;
+    return out;
+}
+
+static bool read_length(const uint8_t **in, const uint8_t *end,
+                        size_t *length) {
+    uint8_t byte;
+    do {
+        if (*in == end) {
+            return false;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Literals followed by a match, match_length 0 for the last literals
+static uint8_t *put_sequence(uint8_t *out, const char *literals,
+                             size_t literal_length, size_t offset,
+                             size_t match_length) {
+    size_t match_extra = match_length ? match_length - LZ_MIN_MATCH : 0;
+    *out++ = (literal_length < 15 ? literal_length : 15) << 4 |
+             (match_extra < 15 ? match_extra : 15);
+    if (literal_length >= 15) {
+        out = put_length(out, literal_length - 15);
+    }
+    memcpy(out, literals, literal_length);
+    out += literal_length;
+    if (!match_length) {
+        return out;
+    }
+    *out++ = offset & 0xFF;
+    *out++ = offset >> 8;
+    if (match_extra >= 15) {
+        out = put_length(out, match_extra - 15);
+    }
+    return out;
+}
+
+size_t compress_bound(size_t length) { return length + length / 255 + 16; }
+
+size_t compress_text(const char *src, size_t length, char *dst) {
+    // positions plus one, 0 is an empty slot
+    uint32_t *table = calloc((size_t)1 << LZ_HASH_BITS, sizeof(uint32_t));
+    if (!table) {
+        perror("Failed to allocate compression table");
+        return 0;
+    }
+    uint8_t *out = (uint8_t *)dst;
+    size_t anchor = 0;
+    size_t at = 0;
+    // the last word is left to the literals so every match reads whole words
+    size_t limit = length > LZ_MIN_MATCH ? length - LZ_MIN_MATCH : 0;
+    while (at < limit) {
+        uint32_t word = read_word(src + at);
+        size_t slot = hash_word(word);
+        size_t candidate = table[slot];
+        table[slot] = at + 1;
+        // positions past 4 GB are not remembered, the text still round trips
+        if (at + 1 > UINT32_MAX || !candidate ||
+            at + 1 - candidate > LZ_MAX_OFFSET ||
+            read_word(src + candidate - 1) != word) {
+            at++;
+            continue;
+        }
+        candidate--;
+        size_t match = LZ_MIN_MATCH;
+        while (at + match < length &&
+               src[candidate + match] == src[at + match]) {
+            match++;
+        }
+        out = put_sequence(out, src + anchor, at - anchor, at - candidate,
+                           match);
+        at += match;
+        anchor = at;
+    }
+    out = put_sequence(out, src + anchor, length - anchor, 0, 0);
+    free(table);
+    return out - (uint8_t *)dst;
+}
+
+bool decompress_text(const char *src, size_t size, char *dst, size_t length) {
+    const uint8_t *in = (const uint8_t *)src;
+    const uint8_t *end = in + size;
+    size_t written = 0;
+    while (in < end) {
+        uint8_t token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !read_length(&in, end, &literals)) {
+            return false;
+        }
+        if (literals > (size_t)(end - in) || literals > length - written) {
+            return false;
+        }
+        memcpy(dst + written, in, literals);
+        in += literals;
+        written += literals;
+        if (in == end) {
+            break;
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+        size_t offset = in[0] | in[1] << 8;
+        in += 2;
+        size_t match = token & 15;
+        if (match == 15 && !read_length(&in, end, &match)) {
+            return false;
+        }
+        match += LZ_MIN_MATCH;
+        if (!offset || offset > written || match > length - written) {
+            return false;
+        }
+        // matches may overlap what they copy, so byte by byte
+        for (size_t i = 0; i < match; ++i) {
+            dst[written + i] = dst[written - offset + i];
+        }
+        written += match;
+    }
+    return written == length;
+}
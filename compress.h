@@ -0,0 +1,29 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// LZ77 in the layout of LZ4 blocks: a token with the literal and match
+// lengths, the literals, then a two byte offset back to the match. Fast
+// enough to pack and unpack a document on a switch
+
+// Matches are at least this long and at most this far back
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+// Positions remembered while looking for matches, as a power of two
+#define LZ_HASH_BITS 16
+
+// Most bytes length bytes can compress to
+size_t compress_bound(size_t length);
+
+// Compresses length bytes of src into dst, which holds compress_bound
+// bytes, returns the compressed size or 0 on failure
+size_t compress_text(const char *src, size_t length, char *dst);
+
+// Decompresses size bytes of src into the length bytes of dst, false if
+// src does not decompress to exactly that
+bool decompress_text(const char *src, size_t size, char *dst, size_t length);
+
+#endif
@@ -4,67 +4,774 @@
 #include <stdio.h>
 #include <string.h>
 
+static size_t count_newlines(const char *text, size_t length) {
+    const char *end = text + length;
+    size_t count = 0;
+    while ((text = memchr(text, '\n', end - text))) {
+        count++;
+        text++;
+    }
+    return count;
+}
+
+// delta may wrap around to take away
+static void fenwick_add(size_t *tree, size_t count, size_t chunk,
+                        size_t delta) {
+    for (size_t i = chunk + 1; i <= count; i += i & -i) {
+        tree[i] += delta;
+    }
+}
+
+// Sum over the first chunks
+static size_t fenwick_sum(const size_t *tree, size_t chunks) {
+    size_t sum = 0;
+    for (size_t i = chunks; i; i -= i & -i) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+// Chunk holding position target of the summed up values, count if target
+// is past them all. rest receives target less the sum of the chunks before
+static size_t fenwick_find(const size_t *tree, size_t count, size_t target,
+                           size_t *rest) {
+    size_t step = 1;
+    while (step * 2 <= count) {
+        step *= 2;
+    }
+    size_t at = 0;
+    for (; step; step /= 2) {
+        if (at + step <= count && tree[at + step] <= target) {
+            at += step;
+            target -= tree[at];
+        }
+    }
+    *rest = target;
+    return at;
+}
+
+// Sets both trees and the totals up again after chunks were added or
+// removed in the middle
+static void rebuild_trees(LineIndex *idx) {
+    size_t count = idx->chunk_count;
+    for (size_t i = 1; i <= count; ++i) {
+        idx->length_tree[i] = idx->chunks[i - 1].length;
+        idx->newline_tree[i] = idx->chunks[i - 1].newlines;
+    }
+    for (size_t i = 1; i <= count; ++i) {
+        size_t parent = i + (i & -i);
+        if (parent <= count) {
+            idx->length_tree[parent] += idx->length_tree[i];
+            idx->newline_tree[parent] += idx->newline_tree[i];
+        }
+    }
+    idx->length = fenwick_sum(idx->length_tree, count);
+    idx->line_num = count ? fenwick_sum(idx->newline_tree, count) + 1 : 0;
+}
+
+static bool reserve_chunks(LineIndex *idx, size_t count) {
+    if (count <= idx->capacity) {
+        return true;
+    }
+    size_t new_cap = idx->capacity ? idx->capacity : 8;
+    while (new_cap < count) {
+        new_cap *= 2;
+    }
+    LineChunk *chunks = realloc(idx->chunks, new_cap * sizeof(LineChunk));
+    if (chunks) {
+        idx->chunks = chunks;
+    }
+    size_t *lengths =
+        chunks ? realloc(idx->length_tree, (new_cap + 1) * sizeof(size_t))
+               : nullptr;
+    if (lengths) {
+        idx->length_tree = lengths;
+    }
+    size_t *newlines =
+        lengths ? realloc(idx->newline_tree, (new_cap + 1) * sizeof(size_t))
+                : nullptr;
+    if (!newlines) {
+        perror("Failed to allocate line index");
+        return false;
+    }
+    idx->newline_tree = newlines;
+    idx->capacity = new_cap;
+    return true;
+}
+
+static bool reserve_ends(LineChunk *chunk, size_t count) {
+    if (count <= chunk->capacity) {
+        return true;
+    }
+    size_t new_cap = chunk->capacity ? chunk->capacity : 8;
+    while (new_cap < count) {
+        new_cap *= 2;
+    }
+    size_t *ends = realloc(chunk->ends, new_cap * sizeof(size_t));
+    if (!ends) {
+        perror("Failed to allocate line index");
+        return false;
+    }
+    chunk->ends = ends;
+    chunk->capacity = new_cap;
+    return true;
+}
+
+// Adds chunk after the last one, or in place of the empty chunk of an
+// empty text
+static bool push_chunk(LineIndex *idx, LineChunk chunk) {
+    size_t count = idx->chunk_count;
+    if (count && idx->chunks[count - 1].length == 0) {
+        free(idx->chunks[count - 1].ends);
+        idx->chunks[count - 1] = chunk;
+        fenwick_add(idx->length_tree, count, count - 1, chunk.length);
+        fenwick_add(idx->newline_tree, count, count - 1, chunk.newlines);
+        idx->length += chunk.length;
+        idx->line_num += chunk.newlines;
+        return true;
+    }
+    if (!reserve_chunks(idx, count + 1)) {
+        return false;
+    }
+    size_t i = ++idx->chunk_count;
+    idx->chunks[i - 1] = chunk;
+    // node i sums the chunks after i - (i & -i), all of them before the
+    // new one but itself
+    size_t below = i - (i & -i);
+    idx->length_tree[i] = chunk.length +
+                          fenwick_sum(idx->length_tree, i - 1) -
+                          fenwick_sum(idx->length_tree, below);
+    idx->newline_tree[i] = chunk.newlines +
+                           fenwick_sum(idx->newline_tree, i - 1) -
+                           fenwick_sum(idx->newline_tree, below);
+    idx->length += chunk.length;
+    idx->line_num = (idx->line_num ? idx->line_num : 1) + chunk.newlines;
+    return true;
+}
+
+// Offset after new line k of chunk. A lazy chunk whose page could not be
+// read has its new lines taken to be at its end, so the counts still add
+// up
+static size_t newline_end(const LineChunk *chunk, size_t k) {
+    return chunk->lazy ? chunk->length - chunk->newlines + k + 1
+                       : chunk->ends[k];
+}
+
+// New lines of chunk ending at or before offset
+static size_t newlines_before(const LineChunk *chunk, size_t offset) {
+    size_t low = 0;
+    size_t high = chunk->newlines;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (newline_end(chunk, mid) <= offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Finds the new lines of a lazy chunk by reading its page. The chunk stays
+// lazy if they cannot be allocated
+static void index_chunk(const LineIndex *idx, LineChunk *chunk) {
+    if (!chunk->lazy) {
+        return;
+    }
+    size_t *ends = malloc(MAX(chunk->newlines, 1) * sizeof(size_t));
+    if (!ends) {
+        perror("Failed to allocate line index");
+        return;
+    }
+    const char *page = page_in(idx->file, chunk->offset / FILE_PAGE_SPAN);
+    size_t count = 0;
+    if (page) {
+        const char *start = page + chunk->offset % FILE_PAGE_SPAN;
+        const char *end = start + chunk->length;
+        const char *text = start;
+        while (count < chunk->newlines &&
+               (text = memchr(text, '\n', end - text))) {
+            ends[count++] = ++text - start;
+        }
+    }
+    for (; count < chunk->newlines; ++count) {
+        ends[count] = newline_end(chunk, count);
+    }
+    chunk->ends = ends;
+    chunk->capacity = MAX(chunk->newlines, 1);
+    chunk->lazy = false;
+}
+
+size_t get_line_offset(const LineIndex *idx, size_t line) {
+    if (line == 0 || idx->chunk_count == 0) {
+        return 0;
+    }
+    size_t k;
+    size_t chunk =
+        fenwick_find(idx->newline_tree, idx->chunk_count, line - 1, &k);
+    if (chunk == idx->chunk_count) {
+        return idx->length;
+    }
+    index_chunk(idx, &idx->chunks[chunk]);
+    return fenwick_sum(idx->length_tree, chunk) +
+           newline_end(&idx->chunks[chunk], k);
+}
+
+size_t get_line_length(const LineIndex *idx, size_t line) {
+    size_t end = line + 1 < idx->line_num ? get_line_offset(idx, line + 1)
+                                          : idx->length;
+    return end - get_line_offset(idx, line);
+}
+
 size_t line_column_to_offset(LineIndex idx, size_t line, size_t column) {
-    return idx.line_offset[line] + column;
+    return get_line_offset(&idx, line) + column;
 }
 
 void offset_to_line_column(LineIndex idx, size_t byte_offset, size_t *line,
                            size_t *column) {
-    for (size_t i = 0; i < idx.line_num; ++i) {
-        if (i == idx.line_num - 1 || byte_offset < idx.line_offset[i + 1]) {
-            *line = i;
-            *column = byte_offset - idx.line_offset[i];
+    size_t rest;
+    size_t chunk =
+        fenwick_find(idx.length_tree, idx.chunk_count, byte_offset, &rest);
+    *line = fenwick_sum(idx.newline_tree, chunk);
+    if (chunk < idx.chunk_count) {
+        index_chunk(&idx, &idx.chunks[chunk]);
+        *line += newlines_before(&idx.chunks[chunk], rest);
+    }
+    *column = byte_offset - get_line_offset(&idx, *line);
+}
+
+size_t line_index_bytes(const LineIndex *idx) {
+    size_t bytes =
+        idx->capacity * (sizeof(LineChunk) + 2 * sizeof(size_t));
+    for (size_t i = 0; i < idx->chunk_count; ++i) {
+        bytes += idx->chunks[i].capacity * sizeof(size_t);
+    }
+    return bytes;
+}
+
+void free_line_index(LineIndex *idx) {
+    for (size_t i = 0; i < idx->chunk_count; ++i) {
+        free(idx->chunks[i].ends);
+    }
+    free(idx->chunks);
+    free(idx->length_tree);
+    free(idx->newline_tree);
+    release_paged_file(idx->file);
+    *idx = (LineIndex){0};
+}
+
+void clear_line_index(LineIndex *idx) {
+    free_line_index(idx);
+    push_chunk(idx, (LineChunk){0});
+}
+
+// Cuts a chunk grown past twice LINE_CHUNK_BYTES into chunks of that size
+static void split_chunk(LineIndex *idx, size_t chunk) {
+    size_t count =
+        (idx->chunks[chunk].length + LINE_CHUNK_BYTES - 1) / LINE_CHUNK_BYTES;
+    LineChunk *pieces = calloc(count, sizeof(LineChunk));
+    if (!pieces || !reserve_chunks(idx, idx->chunk_count + count - 1)) {
+        free(pieces);
+        return;
+    }
+    LineChunk *whole = &idx->chunks[chunk];
+    size_t k = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t start = i * LINE_CHUNK_BYTES;
+        LineChunk *piece = &pieces[i];
+        piece->length = MIN(LINE_CHUNK_BYTES, whole->length - start);
+        size_t first = k;
+        while (k < whole->newlines &&
+               whole->ends[k] <= start + piece->length) {
+            k++;
+        }
+        if (!reserve_ends(piece, k - first)) {
+            for (size_t j = 0; j < i; ++j) {
+                free(pieces[j].ends);
+            }
+            free(pieces);
+            return;
+        }
+        piece->newlines = k - first;
+        for (size_t j = first; j < k; ++j) {
+            piece->ends[j - first] = whole->ends[j] - start;
+        }
+    }
+    free(whole->ends);
+
+    if (chunk + 1 == idx->chunk_count) {
+        // no other node of the trees sums the last chunk, so the pieces
+        // are pushed in its place without rebuilding them
+        idx->chunk_count--;
+        idx->length -= whole->length;
+        idx->line_num -= whole->newlines;
+        for (size_t i = 0; i < count; ++i) {
+            push_chunk(idx, pieces[i]);
+        }
+    } else {
+        memmove(&idx->chunks[chunk + count], &idx->chunks[chunk + 1],
+                (idx->chunk_count - chunk - 1) * sizeof(LineChunk));
+        memcpy(&idx->chunks[chunk], pieces, count * sizeof(LineChunk));
+        idx->chunk_count += count - 1;
+        rebuild_trees(idx);
+    }
+    free(pieces);
+}
+
+// Chunk an edit at byte_offset goes into, the last one at the end of the
+// text. rest receives the offset in the chunk
+static size_t edit_chunk(const LineIndex *idx, size_t byte_offset,
+                         size_t *rest) {
+    size_t chunk =
+        fenwick_find(idx->length_tree, idx->chunk_count, byte_offset, rest);
+    if (chunk == idx->chunk_count) {
+        chunk--;
+        *rest = idx->chunks[chunk].length;
+    }
+    return chunk;
+}
+
+// Makes room in chunk for newlines new line ends at rest and moves the
+// ends after it by length. at receives where the new ends go
+static bool open_gap(const LineIndex *idx, LineChunk *chunk, size_t rest,
+                     size_t newlines, size_t length, size_t *at) {
+    index_chunk(idx, chunk);
+    if (chunk->lazy || !reserve_ends(chunk, chunk->newlines + newlines)) {
+        return false;
+    }
+    *at = newlines_before(chunk, rest);
+    size_t following = chunk->newlines - *at;
+    if (following) {
+        memmove(&chunk->ends[*at + newlines], &chunk->ends[*at],
+                following * sizeof(size_t));
+    }
+    for (size_t i = *at + newlines; i < chunk->newlines + newlines; ++i) {
+        chunk->ends[i] += length;
+    }
+    return true;
+}
+
+// Counts length bytes and newlines new lines added to chunk, both wrap
+// around to take away
+static void grow_chunk(LineIndex *idx, size_t chunk, size_t length,
+                       size_t newlines) {
+    idx->chunks[chunk].length += length;
+    idx->chunks[chunk].newlines += newlines;
+    fenwick_add(idx->length_tree, idx->chunk_count, chunk, length);
+    fenwick_add(idx->newline_tree, idx->chunk_count, chunk, newlines);
+    idx->length += length;
+    idx->line_num += newlines;
+    if (idx->chunks[chunk].length > 2 * LINE_CHUNK_BYTES) {
+        split_chunk(idx, chunk);
+    }
+}
+
+// Adds text after the last chunk, filling it up to LINE_CHUNK_BYTES
+static void push_text(LineIndex *idx, const char *text, size_t length) {
+    while (length) {
+        size_t last = idx->chunk_count - 1;
+        if (!idx->chunk_count || idx->chunks[last].lazy ||
+            idx->chunks[last].length >= LINE_CHUNK_BYTES) {
+            if (!push_chunk(idx, (LineChunk){0})) {
+                return;
+            }
+            last = idx->chunk_count - 1;
+        }
+        LineChunk *chunk = &idx->chunks[last];
+        size_t taken = MIN(length, LINE_CHUNK_BYTES - chunk->length);
+        size_t newlines = count_newlines(text, taken);
+        if (!reserve_ends(chunk, chunk->newlines + newlines)) {
+            return;
+        }
+        const char *start = text;
+        const char *end = text + taken;
+        size_t at = chunk->newlines;
+        while ((text = memchr(text, '\n', end - text))) {
+            chunk->ends[at++] = chunk->length + (++text - start);
+        }
+        grow_chunk(idx, last, taken, newlines);
+        text = end;
+        length -= taken;
+    }
+}
+
+// Adds the part of chunk from..from+length after the last chunk of idx
+static void push_part(LineIndex *idx, const LineChunk *chunk, size_t from,
+                      size_t length) {
+    size_t first = newlines_before(chunk, from);
+    LineChunk part = {.length = length};
+    if (!reserve_ends(&part, newlines_before(chunk, from + length) - first)) {
+        return;
+    }
+    part.newlines = newlines_before(chunk, from + length) - first;
+    for (size_t i = 0; i < part.newlines; ++i) {
+        part.ends[i] = newline_end(chunk, first + i) - from;
+    }
+    if (!push_chunk(idx, part)) {
+        free(part.ends);
+    }
+}
+
+void insert_text_to_index(LineIndex *idx, size_t byte_offset, const char *text,
+                          size_t length) {
+    if (idx->line_num == 0) {
+        clear_line_index(idx);
+    }
+    if (byte_offset == idx->length) {
+        push_text(idx, text, length);
+        return;
+    }
+    size_t rest;
+    size_t chunk = edit_chunk(idx, byte_offset, &rest);
+    size_t newlines = count_newlines(text, length);
+    size_t at;
+    if (!open_gap(idx, &idx->chunks[chunk], rest, newlines, length, &at)) {
+        return;
+    }
+    size_t *ends = idx->chunks[chunk].ends;
+    const char *start = text;
+    const char *end = text + length;
+    while ((text = memchr(text, '\n', end - text))) {
+        ends[at++] = rest + (++text - start);
+    }
+    grow_chunk(idx, chunk, length, newlines);
+}
+
+// Removes chunks a delete emptied, an empty text keeps one empty chunk
+static void drop_empty_chunks(LineIndex *idx) {
+    size_t kept = 0;
+    for (size_t i = 0; i < idx->chunk_count; ++i) {
+        if (idx->chunks[i].length) {
+            idx->chunks[kept++] = idx->chunks[i];
+        } else {
+            free(idx->chunks[i].ends);
+        }
+    }
+    if (!kept) {
+        idx->chunks[kept++] = (LineChunk){0};
+    }
+    idx->chunk_count = kept;
+    rebuild_trees(idx);
+}
+
+void delete_text_from_index(LineIndex *idx, size_t byte_offset, size_t length) {
+    bool emptied = false;
+    while (length) {
+        size_t rest;
+        size_t chunk =
+            fenwick_find(idx->length_tree, idx->chunk_count, byte_offset, &rest);
+        if (chunk == idx->chunk_count) {
+            break;
+        }
+        LineChunk *c = &idx->chunks[chunk];
+        size_t taken = MIN(length, c->length - rest);
+        size_t removed = c->newlines;
+        if (taken == c->length) {
+            // whole chunks go without reading their pages
+            emptied = true;
+        } else {
+            index_chunk(idx, c);
+            if (c->lazy) {
+                return;
+            }
+            size_t from = newlines_before(c, rest);
+            size_t to = newlines_before(c, rest + taken);
+            removed = to - from;
+            if (c->newlines > to) {
+                memmove(&c->ends[from], &c->ends[to],
+                        (c->newlines - to) * sizeof(size_t));
+            }
+            for (size_t i = from; i < c->newlines - removed; ++i) {
+                c->ends[i] -= taken;
+            }
+        }
+        c->length -= taken;
+        c->newlines -= removed;
+        fenwick_add(idx->length_tree, idx->chunk_count, chunk, -taken);
+        fenwick_add(idx->newline_tree, idx->chunk_count, chunk, -removed);
+        idx->length -= taken;
+        idx->line_num -= removed;
+        length -= taken;
+    }
+    if (emptied) {
+        drop_empty_chunks(idx);
+    }
+}
+
+// Chunk of lines for the index idx is about to take it in, lazy if both
+// read from the same file
+static void push_copy(LineIndex *idx, const LineIndex *lines,
+                      LineChunk *chunk, size_t from, size_t length) {
+    if (chunk->lazy && from == 0 && length == chunk->length &&
+        (!idx->file || idx->file == lines->file)) {
+        if (!idx->file) {
+            idx->file = lines->file;
+            retain_paged_file(idx->file);
+        }
+        push_chunk(idx, *chunk);
+        return;
+    }
+    index_chunk(lines, chunk);
+    push_part(idx, chunk, from, length);
+}
+
+void insert_lines_to_index(LineIndex *idx, size_t byte_offset,
+                           const LineIndex *lines) {
+    if (idx->line_num == 0) {
+        clear_line_index(idx);
+    }
+    if (lines->length == 0) {
+        return;
+    }
+    size_t rest;
+    size_t chunk = edit_chunk(idx, byte_offset, &rest);
+    LineChunk *target = &idx->chunks[chunk];
+    if (lines->chunk_count == 1 && !lines->chunks[0].lazy) {
+        const LineChunk *from = &lines->chunks[0];
+        size_t at;
+        if (!open_gap(idx, target, rest, from->newlines, from->length, &at)) {
             return;
         }
+        for (size_t i = 0; i < from->newlines; ++i) {
+            target->ends[at + i] = rest + from->ends[i];
+        }
+        grow_chunk(idx, chunk, from->length, from->newlines);
+        return;
+    }
+
+    // The target chunk is cut in two around the chunks of lines, lazy ones
+    // stay lazy
+    LineIndex middle = {.file = idx->file};
+    retain_paged_file(middle.file);
+    index_chunk(idx, target);
+    if (rest) {
+        push_part(&middle, target, 0, rest);
+    }
+    for (size_t i = 0; i < lines->chunk_count; ++i) {
+        LineChunk *from = &lines->chunks[i];
+        push_copy(&middle, lines, from, 0, from->length);
+    }
+    if (rest < target->length) {
+        push_part(&middle, target, rest, target->length - rest);
+    }
+    if (middle.length != target->length + lines->length ||
+        !reserve_chunks(idx, idx->chunk_count + middle.chunk_count - 1)) {
+        free_line_index(&middle);
+        return;
+    }
+    target = &idx->chunks[chunk];
+    free(target->ends);
+    memmove(&idx->chunks[chunk + middle.chunk_count],
+            &idx->chunks[chunk + 1],
+            (idx->chunk_count - chunk - 1) * sizeof(LineChunk));
+    memcpy(&idx->chunks[chunk], middle.chunks,
+           middle.chunk_count * sizeof(LineChunk));
+    idx->chunk_count += middle.chunk_count - 1;
+    rebuild_trees(idx);
+    if (!idx->file) {
+        idx->file = middle.file;
+        retain_paged_file(idx->file);
+    }
+    // the chunks moved over, their ends are not freed with middle
+    middle.chunk_count = 0;
+    free_line_index(&middle);
+}
+
+void copy_index_range(const LineIndex *idx, size_t byte_offset, size_t length,
+                      LineIndex *range) {
+    free_line_index(range);
+    size_t rest;
+    size_t chunk =
+        fenwick_find(idx->length_tree, idx->chunk_count, byte_offset, &rest);
+    for (; length && chunk < idx->chunk_count; ++chunk) {
+        LineChunk *from = &idx->chunks[chunk];
+        size_t taken = MIN(length, from->length - rest);
+        push_copy(range, idx, from, rest, taken);
+        length -= taken;
+        rest = 0;
+    }
+    if (!range->chunk_count) {
+        clear_line_index(range);
     }
 }
 
-void ensure_line_index_capacity(LineIndex *idx) {
-    if (idx->line_num >= idx->capacity) {
-        size_t new_cap = idx->capacity ? idx->capacity * 2 : 8;
-        idx->line_offset = realloc(idx->line_offset, new_cap * sizeof(size_t));
-        idx->line_length = realloc(idx->line_length, new_cap * sizeof(size_t));
-        idx->capacity = new_cap;
+// Applies count edits lying inside chunk, which starts at start, in one
+// pass over its new lines
+static void edit_chunk_lines(LineIndex *idx, size_t chunk, size_t start,
+                             const RopeEdit *edits, size_t count) {
+    LineChunk *c = &idx->chunks[chunk];
+    index_chunk(idx, c);
+    if (c->lazy) {
+        return;
+    }
+    size_t capacity = c->newlines;
+    for (size_t i = 0; i < count; ++i) {
+        capacity += count_newlines(edits[i].text, edits[i].text_length);
+    }
+    size_t *ends = malloc(MAX(capacity, 1) * sizeof(size_t));
+    if (!ends) {
+        perror("Failed to allocate line index");
+        return;
+    }
+    // offsets past an edit move by what it added less what it took away,
+    // the difference wraps around while it is negative
+    size_t shift = 0;
+    size_t old = 0;
+    size_t newlines = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t from = edits[i].offset - start;
+        while (old < c->newlines && c->ends[old] <= from) {
+            ends[newlines++] = c->ends[old++] + shift;
+        }
+        while (old < c->newlines && c->ends[old] <= from + edits[i].length) {
+            old++;
+        }
+        const char *text = edits[i].text;
+        const char *end = text + edits[i].text_length;
+        const char *newline = text;
+        while ((newline = memchr(newline, '\n', end - newline))) {
+            ends[newlines++] = from + shift + (++newline - text);
+        }
+        shift += edits[i].text_length - edits[i].length;
+    }
+    while (old < c->newlines) {
+        ends[newlines++] = c->ends[old++] + shift;
+    }
+    free(c->ends);
+    c->ends = ends;
+    c->capacity = MAX(capacity, 1);
+    grow_chunk(idx, chunk, shift, newlines - c->newlines);
+    if (!idx->chunks[chunk].length) {
+        drop_empty_chunks(idx);
     }
 }
 
-void add_line_to_index(LineIndex *idx, size_t offset, size_t length) {
-    ensure_line_index_capacity(idx);
-    idx->line_offset[idx->line_num] = offset;
-    idx->line_length[idx->line_num] = length;
-    idx->line_num++;
+void apply_edits_to_index(LineIndex *idx, const RopeEdit *edits,
+                          size_t count) {
+    if (idx->line_num == 0) {
+        clear_line_index(idx);
+    }
+    // Edits go from the last one on, so the offsets of earlier ones stay
+    // as they are. Those in the same chunk are applied together
+    size_t end = count;
+    while (end > 0) {
+        const RopeEdit *last = &edits[end - 1];
+        size_t rest;
+        size_t chunk = edit_chunk(idx, last->offset, &rest);
+        size_t start = last->offset - rest;
+        size_t first = end - 1;
+        while (first > 0 && edits[first - 1].offset >= start) {
+            first--;
+        }
+        if (first + 1 == end ||
+            last->offset + last->length > start + idx->chunks[chunk].length) {
+            // the last edit may reach into the chunks after
+            delete_text_from_index(idx, last->offset, last->length);
+            insert_text_to_index(idx, last->offset, last->text,
+                                 last->text_length);
+            end--;
+            continue;
+        }
+        edit_chunk_lines(idx, chunk, start, &edits[first], end - first);
+        end = first;
+    }
 }
 
-void delete_line_from_index(LineIndex *idx, size_t line_to_delete) {
-    if (line_to_delete >= idx->line_num) {
-        perror("Line to delete is out of bound");
+static void index_leaf(LineIndex *idx, Node *leaf) {
+    LazyRange *lazy = leaf->lazy;
+    if (lazy && (!idx->file || idx->file == lazy->file)) {
+        if (!idx->file) {
+            idx->file = lazy->file;
+            retain_paged_file(idx->file);
+        }
+        // a page that cannot be read counts as having no new lines
+        size_t newlines = 0;
+        count_page_newlines(lazy->file, lazy->offset, leaf->rank, &newlines);
+        push_chunk(idx, (LineChunk){.length = leaf->rank,
+                                    .newlines = newlines,
+                                    .offset = lazy->offset,
+                                    .lazy = true});
         return;
     }
+    const char *text = leaf_text(leaf);
+    if (text) {
+        push_text(idx, text, leaf->rank);
+    } else {
+        push_chunk(idx, (LineChunk){.length = leaf->rank});
+    }
+}
 
-    for (size_t i = line_to_delete; i + 1 < idx->line_num; ++i) {
-        idx->line_offset[i] = idx->line_offset[i + 1];
-        idx->line_length[i] = idx->line_length[i + 1];
+void index_leaves(LineIndex *idx, Node *node) {
+    if (!node) {
+        return;
+    }
+    if (!node->left && !node->right) {
+        index_leaf(idx, node);
+        return;
     }
-    idx->line_num--;
+    index_leaves(idx, node->left);
+    index_leaves(idx, node->right);
 }
 
 void travelse_list_and_index_lines(List *list, LineIndex *line_index) {
-    line_index->line_num = 0;
-    size_t offset = 0;
-    size_t curr_line_length = 0;
+    free_line_index(line_index);
     while (list) {
-        for (size_t i = 0; i < strlen(list->leaf->data); ++i) {
-            char c = list->leaf->data[i];
-            curr_line_length++;
-            if (c == '\n') {
-                add_line_to_index(line_index, offset, curr_line_length);
-                offset += curr_line_length;
-                curr_line_length = 0;
-            }
-        }
+        index_leaf(line_index, list->leaf);
         list = list->next;
     }
-    if (curr_line_length) {
-        add_line_to_index(line_index, offset, curr_line_length);
+    if (!line_index->chunk_count) {
+        clear_line_index(line_index);
+    }
+}
+
+static bool cursor_before(struct Cursor a, struct Cursor b) {
+    return a.line < b.line || (a.line == b.line && a.column < b.column);
+}
+
+static bool same_cursor(struct Cursor a, struct Cursor b) {
+    return a.line == b.line && a.column == b.column;
+}
+
+void add_cursor(CursorList *list, struct Cursor cursor) {
+    // new cursors mostly go past the last one
+    size_t at = list->count;
+    while (at > 0 && cursor_before(cursor, list->cursors[at - 1])) {
+        at--;
     }
+    if (at > 0 && same_cursor(cursor, list->cursors[at - 1])) {
+        return;
+    }
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 8;
+        struct Cursor *cursors =
+            realloc(list->cursors, capacity * sizeof(struct Cursor));
+        if (!cursors) {
+            perror("Failed to allocate cursors");
+            return;
+        }
+        list->cursors = cursors;
+        list->capacity = capacity;
+    }
+    memmove(&list->cursors[at + 1], &list->cursors[at],
+            (list->count - at) * sizeof(struct Cursor));
+    list->cursors[at] = cursor;
+    list->count++;
+}
+
+void merge_cursors(CursorList *list, struct Cursor main) {
+    size_t kept = 0;
+    for (size_t i = 0; i < list->count; ++i) {
+        struct Cursor cursor = list->cursors[i];
+        if (same_cursor(cursor, main) ||
+            (kept && same_cursor(cursor, list->cursors[kept - 1]))) {
+            continue;
+        }
+        list->cursors[kept++] = cursor;
+    }
+    list->count = kept;
+}
+
+void free_cursor_list(CursorList *list) {
+    free(list->cursors);
+    *list = (CursorList){0};
 }
@@ -2,6 +2,7 @@
 #define CURSOR_H
 
 #include "rope.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -13,6 +14,14 @@ struct Cursor {
     size_t desired_column;
 };
 
+// Carets edited and moved along with the main cursor, sorted by line and
+// column without duplicates
+typedef struct {
+    struct Cursor *cursors;
+    size_t count;
+    size_t capacity;
+} CursorList;
+
 struct Line {
     uint32_t length;
     int32_t idx;
@@ -20,24 +29,86 @@ struct Line {
     Line *prev;
 };
 
+// Bytes of text a chunk of the line index covers, edited chunks are split
+// again once they grow to twice this. Lazy chunks cover one leaf of a page
+#define LINE_CHUNK_BYTES (64 << 10)
+
+// New lines of a stretch of text. Lazy chunks only know how many there are,
+// where they are is found by reading the page once a line in it is looked up
+typedef struct {
+    size_t length;
+    size_t newlines;
+    size_t *ends;    // offset after every new line in the chunk, nullptr
+                     // while lazy
+    size_t capacity; // of ends
+    size_t offset;   // in the index's file while lazy, as in LazyRange
+    bool lazy;
+} LineChunk;
+
+// Lines of a text as new line counts per chunk. Fenwick trees over the
+// chunk lengths and counts find the chunk of a line or offset, so memory
+// grows with the chunks that were looked at or edited, not with lines
 typedef struct {
-    size_t *line_offset; // line_offset[i] - offset in rope of start of line i
-    size_t *line_length; // lenghth in bytes of line i
-    size_t line_num;     // nuber of lines of file
-    size_t capacity;     // allocated capacity
+    LineChunk *chunks;
+    size_t *length_tree;  // fenwick tree of chunk lengths, 1 based
+    size_t *newline_tree; // fenwick tree of chunk new lines, 1 based
+    size_t chunk_count;
+    size_t capacity;
+    size_t length;   // of the text
+    size_t line_num; // new lines plus one, 0 while nothing was indexed
+    PagedFile *file; // backing of lazy chunks, one reference held
 } LineIndex;
 
+// Offset in the text where line starts
+size_t get_line_offset(const LineIndex *idx, size_t line);
+
+// Bytes of line, its new line included
+size_t get_line_length(const LineIndex *idx, size_t line);
+
 size_t line_column_to_offset(LineIndex idx, size_t line, size_t column);
 
 void offset_to_line_column(LineIndex idx, size_t byte_offset, size_t *line,
                            size_t *column);
 
-void ensure_line_index_capacity(LineIndex *idx);
+// Bytes allocated for the chunks and their new line ends, used or not
+size_t line_index_bytes(const LineIndex *idx);
+
+// Index of an empty text, one empty line
+void clear_line_index(LineIndex *idx);
 
-void add_line_to_index(LineIndex *idx, size_t offset, size_t length);
+void free_line_index(LineIndex *idx);
 
-void delete_line_from_index(LineIndex *idx, size_t line_to_delete);
+// Keep the chunks in sync with an edit of the rope at byte_offset
+void insert_text_to_index(LineIndex *idx, size_t byte_offset, const char *text,
+                          size_t length);
+
+void delete_text_from_index(LineIndex *idx, size_t byte_offset, size_t length);
+
+// Index update for text inserted at byte_offset whose own lines are in
+// lines. Used for text that is not at hand as a string
+void insert_lines_to_index(LineIndex *idx, size_t byte_offset,
+                           const LineIndex *lines);
+
+// Lines of the length bytes at byte_offset as an index of their own
+void copy_index_range(const LineIndex *idx, size_t byte_offset, size_t length,
+                      LineIndex *range);
+
+// Index update for a batch of apply_edits
+void apply_edits_to_index(LineIndex *idx, const RopeEdit *edits, size_t count);
+
+// Adds the leaves under node after the text idx has. Lazy leaves become
+// lazy chunks, counted without reading their pages where the file knows
+// them
+void index_leaves(LineIndex *idx, Node *node);
 
 void travelse_list_and_index_lines(List *list, LineIndex *line_index);
 
+// Adds cursor in order, unless the list has it already
+void add_cursor(CursorList *list, struct Cursor cursor);
+
+// Drops cursors that moved onto each other or onto main
+void merge_cursors(CursorList *list, struct Cursor main);
+
+void free_cursor_list(CursorList *list);
+
 #endif
@@ -0,0 +1,401 @@
+#include "document.h"
+#include "compress.h"
+#include "session.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct DocumentWorker {
+    pthread_t thread;
+    Document *doc; // only read by the thread
+    bool unpacking;
+    atomic_bool cancel;
+    atomic_bool done;
+    bool failed;
+    // packing results
+    char *packed;
+    size_t packed_size;
+    Memento **mementos; // swapped for the matching packed histories
+    char **histories;
+    size_t *history_sizes;
+    size_t *history_lengths; // unpacked
+    size_t memento_count;
+    // unpacking results
+    RopeTree *tree;
+    LineIndex index;
+};
+
+// Line caches are rebuilt from the line count once shown again
+static void free_line_caches(Document *doc) {
+    doc->wrap_enabled = doc->wrap->enabled;
+    doc->highlight_enabled = doc->highlight->enabled;
+    free_wrap_index(doc->wrap);
+    free_column_cache(doc->column_cache);
+    free_highlight_index(doc->highlight);
+    doc->wrap = nullptr;
+    doc->column_cache = nullptr;
+    doc->highlight = nullptr;
+}
+
+static bool create_line_caches(Document *doc) {
+    doc->wrap = create_wrap_index();
+    doc->column_cache = create_column_cache();
+    doc->highlight = create_highlight_index();
+    if (!doc->wrap || !doc->column_cache || !doc->highlight) {
+        free_wrap_index(doc->wrap);
+        free_column_cache(doc->column_cache);
+        free_highlight_index(doc->highlight);
+        doc->wrap = nullptr;
+        doc->column_cache = nullptr;
+        doc->highlight = nullptr;
+        return false;
+    }
+    doc->wrap->enabled = doc->wrap_enabled;
+    doc->highlight->enabled = doc->highlight_enabled;
+    return true;
+}
+
+static size_t chunk_count(size_t length) {
+    return (length + PACK_CHUNK_BYTES - 1) / PACK_CHUNK_BYTES;
+}
+
+// Compresses the text chunk by chunk, false if it fails or is cancelled
+static bool pack_text(DocumentWorker *worker) {
+    RopeTree *tree = worker->doc->tree;
+    size_t length = tree->length;
+    size_t count = chunk_count(length);
+    size_t bound = count * sizeof(uint32_t);
+    if (count) {
+        bound += (count - 1) * compress_bound(PACK_CHUNK_BYTES) +
+                 compress_bound(length - (count - 1) * PACK_CHUNK_BYTES);
+    }
+    char *text = malloc(MIN(length, PACK_CHUNK_BYTES) + 1);
+    char *packed = malloc(bound + 1);
+    if (!text || !packed) {
+        perror("Failed to allocate packing buffer");
+        free(text);
+        free(packed);
+        return false;
+    }
+    size_t size = 0;
+    for (size_t offset = 0; offset < length; offset += PACK_CHUNK_BYTES) {
+        size_t chunk = MIN(PACK_CHUNK_BYTES, length - offset);
+        uint32_t chunk_size = 0;
+        if (!atomic_load(&worker->cancel) &&
+            copy_range(tree->root, offset, chunk, text) == chunk) {
+            chunk_size = compress_text(text, chunk,
+                                       packed + size + sizeof(uint32_t));
+        }
+        if (!chunk_size) {
+            free(text);
+            free(packed);
+            return false;
+        }
+        memcpy(packed + size, &chunk_size, sizeof(uint32_t));
+        size += sizeof(uint32_t) + chunk_size;
+    }
+    free(text);
+    // give back what the bound reserved
+    char *shrunk = realloc(packed, size + 1);
+    worker->packed = shrunk ? shrunk : packed;
+    worker->packed_size = size;
+    return true;
+}
+
+// Compresses the mementos that are not packed yet, one that fails to
+// compress is kept as it is
+static void pack_history(DocumentWorker *worker, const Caretaker *c) {
+    for (size_t i = 0; i < c->size && !atomic_load(&worker->cancel); ++i) {
+        Memento *m = c->history[i];
+        if (m->is_packed) {
+            continue;
+        }
+        size_t size, length;
+        char *packed = compress_memento(m, &size, &length);
+        if (packed) {
+            worker->mementos[worker->memento_count] = m;
+            worker->histories[worker->memento_count] = packed;
+            worker->history_sizes[worker->memento_count] = size;
+            worker->history_lengths[worker->memento_count] = length;
+            worker->memento_count++;
+        }
+    }
+}
+
+static void *pack_worker(void *arg) {
+    DocumentWorker *worker = arg;
+    Document *doc = worker->doc;
+    worker->failed = !pack_text(worker);
+    if (!worker->failed) {
+        pack_history(worker, doc->undo);
+        pack_history(worker, doc->redo);
+    }
+    atomic_store(&worker->done, true);
+    return nullptr;
+}
+
+// Decompresses the chunks into a tree and indexes their lines, false if
+// that fails or is cancelled
+static bool unpack_text(DocumentWorker *worker) {
+    const Document *doc = worker->doc;
+    size_t length = doc->packed_length;
+    size_t count = chunk_count(length);
+    char *text = malloc(MIN(length, PACK_CHUNK_BYTES) + 1);
+    Node **roots = malloc((count + 1) * sizeof(Node *));
+    RopeTree *tree = create_tree();
+    if (!text || !roots || !tree) {
+        perror("Failed to allocate unpacking buffer");
+        free(text);
+        free(roots);
+        free_rope(tree);
+        return false;
+    }
+    LineIndex index = {0};
+    clear_line_index(&index);
+    const char *at = doc->packed;
+    size_t unpacked = 0;
+    for (; unpacked < count; ++unpacked) {
+        size_t offset = unpacked * PACK_CHUNK_BYTES;
+        size_t chunk = MIN(PACK_CHUNK_BYTES, length - offset);
+        uint32_t chunk_size;
+        memcpy(&chunk_size, at, sizeof(uint32_t));
+        at += sizeof(uint32_t);
+        if (atomic_load(&worker->cancel)) {
+            break;
+        }
+        if (!decompress_text(at, chunk_size, text, chunk)) {
+            fprintf(stderr, "Packed document is corrupt\n");
+            break;
+        }
+        at += chunk_size;
+        roots[unpacked] = build_node_from_text(text, chunk);
+        insert_text_to_index(&index, offset, text, chunk);
+    }
+    free(text);
+    if (unpacked) {
+        tree->root = build_balanced(roots, 0, unpacked - 1);
+    }
+    free(roots);
+    if (unpacked < count) {
+        free_rope(tree);
+        free_line_index(&index);
+        return false;
+    }
+    tree->height = calc_tree_height(tree->root);
+    tree->length = length;
+    tree->nodes_count = count_nodes(tree->root);
+    worker->tree = tree;
+    worker->index = index;
+    return true;
+}
+
+static void *unpack_worker(void *arg) {
+    DocumentWorker *worker = arg;
+    worker->failed = !unpack_text(worker);
+    atomic_store(&worker->done, true);
+    return nullptr;
+}
+
+static bool start_worker(Document *doc, bool unpacking) {
+    DocumentWorker *worker = calloc(1, sizeof(DocumentWorker));
+    size_t history = doc->undo->size + doc->redo->size;
+    if (worker && !unpacking) {
+        worker->mementos = malloc((history + 1) * sizeof(Memento *));
+        worker->histories = malloc((history + 1) * sizeof(char *));
+        worker->history_sizes = malloc((history + 1) * sizeof(size_t));
+        worker->history_lengths = malloc((history + 1) * sizeof(size_t));
+    }
+    if (!worker || (!unpacking && (!worker->mementos || !worker->histories ||
+                                   !worker->history_sizes ||
+                                   !worker->history_lengths))) {
+        perror("Failed to allocate document worker");
+        if (worker) {
+            free(worker->mementos);
+            free(worker->histories);
+            free(worker->history_sizes);
+            free(worker->history_lengths);
+        }
+        free(worker);
+        return false;
+    }
+    worker->doc = doc;
+    worker->unpacking = unpacking;
+    int error = pthread_create(&worker->thread, nullptr,
+                               unpacking ? unpack_worker : pack_worker, worker);
+    if (error) {
+        fprintf(stderr, "Failed to start document worker: %s\n",
+                strerror(error));
+        free(worker->mementos);
+        free(worker->histories);
+        free(worker->history_sizes);
+        free(worker->history_lengths);
+        free(worker);
+        return false;
+    }
+    doc->worker = worker;
+    return true;
+}
+
+static void finish_packing(Document *doc, DocumentWorker *worker) {
+    for (size_t i = 0; i < worker->memento_count; ++i) {
+        if (worker->failed) {
+            free(worker->histories[i]);
+        } else {
+            pack_memento(worker->mementos[i], worker->histories[i],
+                         worker->history_sizes[i], worker->history_lengths[i]);
+        }
+    }
+    if (worker->failed) {
+        free(worker->packed);
+        // a stopped one is started again once the document is idle again
+        doc->pack_failed = !atomic_load(&worker->cancel);
+        return;
+    }
+    doc->packed = worker->packed;
+    doc->packed_size = worker->packed_size;
+    doc->packed_length = doc->tree->length;
+    free_rope(doc->tree);
+    doc->tree = nullptr;
+    free_line_index(&doc->index);
+    free_line_caches(doc);
+    doc->is_packed = true;
+}
+
+static void finish_unpacking(Document *doc, DocumentWorker *worker) {
+    if (worker->failed || !create_line_caches(doc)) {
+        free_rope(worker->tree);
+        free_line_index(&worker->index);
+        return;
+    }
+    doc->tree = worker->tree;
+    doc->index = worker->index;
+    free(doc->packed);
+    doc->packed = nullptr;
+    doc->packed_size = 0;
+    doc->packed_length = 0;
+    doc->is_packed = false;
+}
+
+// Waits for the worker and takes over its results, a cancelled one
+// leaves the document as it was
+static void join_worker(Document *doc) {
+    DocumentWorker *worker = doc->worker;
+    pthread_join(worker->thread, nullptr);
+    if (atomic_load(&worker->cancel)) {
+        worker->failed = true;
+    }
+    if (worker->unpacking) {
+        finish_unpacking(doc, worker);
+    } else {
+        finish_packing(doc, worker);
+    }
+    free(worker->mementos);
+    free(worker->histories);
+    free(worker->history_sizes);
+    free(worker->history_lengths);
+    free(worker);
+    doc->worker = nullptr;
+}
+
+static void stop_worker(Document *doc) {
+    if (doc->worker) {
+        atomic_store(&doc->worker->cancel, true);
+        join_worker(doc);
+    }
+}
+
+Document *create_document() {
+    Document *doc = calloc(1, sizeof(Document));
+    if (!doc) {
+        perror("Failed to allocate document");
+        return nullptr;
+    }
+    doc->tree = create_tree();
+    doc->undo = create_caretaker(DOCUMENT_HISTORY);
+    doc->redo = create_caretaker(DOCUMENT_HISTORY);
+    doc->wrap = create_wrap_index();
+    doc->column_cache = create_column_cache();
+    doc->highlight = create_highlight_index();
+    clear_line_index(&doc->index);
+    return doc;
+}
+
+void free_document(Document *doc) {
+    if (!doc) {
+        return;
+    }
+    stop_worker(doc);
+    free_file_loader(doc->loader);
+    free_file_watch(doc->watch);
+    free_rope(doc->tree);
+    free_line_index(&doc->index);
+    free_cursor_list(&doc->extra_cursors);
+    free_caretaker(doc->undo);
+    free_caretaker(doc->redo);
+    free_wrap_index(doc->wrap);
+    free_column_cache(doc->column_cache);
+    free_highlight_index(doc->highlight);
+    free(doc->packed);
+    free(doc->path);
+    free(doc);
+}
+
+void start_packing(Document *doc) {
+    if (doc->is_packed || doc->worker || doc->pack_failed || doc->loader) {
+        return;
+    }
+    if (doc->tree->file) {
+        // the text is on disk already, compressing it would read it all in
+        evict_pages(doc->tree->file);
+        free_line_caches(doc);
+        doc->is_packed = true;
+        return;
+    }
+    doc->pack_failed = !start_worker(doc, false);
+}
+
+bool prepare_document(Document *doc) {
+    doc->pack_failed = false;
+    if (doc->worker && !doc->worker->unpacking) {
+        // the text is still all there, packing stops after its chunk
+        stop_worker(doc);
+    }
+    if (doc->worker || !doc->is_packed) {
+        return !doc->worker;
+    }
+    if (doc->tree) {
+        // lazy, its pages come back as they are looked at
+        doc->is_packed = !create_line_caches(doc);
+        return !doc->is_packed;
+    }
+    start_worker(doc, true);
+    return false;
+}
+
+bool update_document(Document *doc) {
+    if (!doc->worker) {
+        return false;
+    }
+    if (!atomic_load(&doc->worker->done)) {
+        return true;
+    }
+    join_worker(doc);
+    return false;
+}
+
+size_t document_packed_bytes(const Document *doc) {
+    return doc->packed_size;
+}
+
+void save_document_session(const Document *doc) {
+    if (!doc->path || !doc->watch || !doc->watch->hashed ||
+        doc->watch->modified || doc->loader || !doc->tree || !doc->tree->file) {
+        return;
+    }
+    SessionView view = {doc->cursor.line, doc->cursor.column,
+                        doc->scroll.line};
+    save_session(doc->path, &doc->watch->hash, doc->watch->mtime_ns,
+                 doc->tree, doc->format, view);
+}
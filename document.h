@@ -0,0 +1,94 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include "column_cache.h"
+#include "cursor.h"
+#include "encoding.h"
+#include "highlight.h"
+#include "loader.h"
+#include "memento.h"
+#include "render.h"
+#include "rope.h"
+#include "watch.h"
+#include "wrap.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Documents kept unpacked, the one shown and the ones shown last so
+// switching back and forth between them stays O(1)
+#define RESIDENT_DOCUMENTS 2
+
+// Undo steps kept per document
+#define DOCUMENT_HISTORY 100
+
+// Text is packed in chunks of this many bytes, each compressed on its own
+// so the worker can be stopped between them
+#define PACK_CHUNK_BYTES (1 << 20)
+
+// Packs or unpacks a document off the editor thread
+typedef struct DocumentWorker DocumentWorker;
+
+// One open buffer. The shown document lives in the editor globals, the
+// others keep their state here. Font, glyph and shape caches are shared,
+// the line caches belong to the document
+typedef struct {
+    char *path; // nullptr until loaded or saved
+    RopeTree *tree;
+    LineIndex index;
+    struct Cursor cursor;
+    CursorList extra_cursors;
+    bool selecting;
+    struct Cursor selection_anchor;
+    Caretaker *undo;
+    Caretaker *redo;
+    FileLoader *loader;
+    FileWatch *watch;
+    TextFormat format;
+    WrapIndex *wrap;
+    ColumnCache *column_cache;
+    HighlightIndex *highlight;
+    Scroll scroll;
+    uint64_t last_shown;
+    // While packed the text is compressed into packed chunk by chunk, each
+    // after its compressed size, and the tree, index and line caches are
+    // freed. Lazy documents keep them and only drop their pages, which are
+    // read from the file again. The history is compressed as well
+    bool is_packed;
+    char *packed;
+    size_t packed_size;
+    size_t packed_length;
+    bool wrap_enabled;
+    bool highlight_enabled;
+    // the tree, history and packed text belong to it while it is set
+    DocumentWorker *worker;
+    bool pack_failed; // not tried again until the document is shown
+} Document;
+
+// Empty document with its own history and line caches
+[[nodiscard]]
+Document *create_document();
+
+void free_document(Document *doc);
+
+// Starts giving up the memory of an idle document on a worker, its loader
+// has to be done. Lazy documents drop their pages right away
+void start_packing(Document *doc);
+
+// Gets doc ready to be shown, packing is stopped and unpacking started on a
+// worker. True once it can be shown, false while it is being unpacked or
+// if that could not be started
+bool prepare_document(Document *doc);
+
+// Takes over what the worker of doc did once it is done, true while it is
+// still at work. A document that fails to unpack stays packed
+bool update_document(Document *doc);
+
+// Bytes of compressed text held by a packed document
+size_t document_packed_bytes(const Document *doc);
+
+// Keeps the layout, lines and view of a paged file that was not edited in
+// the session cache, so opening it again skips reading it
+void save_document_session(const Document *doc);
+
+#endif
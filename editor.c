@@ -1,6 +1,16 @@
+#include "clipboard.h"
 #include "cursor.h"
+#include "document.h"
+#include "loader.h"
 #include "memento.h"
+#include "memory_stats.h"
+#include "profiler.h"
+#include "render.h"
+#include "renderer.h"
 #include "rope.h"
+#include "save.h"
+#include "session.h"
+#include "watch.h"
 #include <GL/gl.h>
 #include <GL/glx.h>
 #include <GLFW/glfw3.h>
@@ -9,12 +19,14 @@
 #include <X11/Xutil.h>
 #include <cglm/types-struct.h>
 #include <limits.h>
+#include <poll.h>
 #include <runara/runara.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 struct State {
@@ -27,6 +39,17 @@ struct State {
 struct Cursor cursor =
     (struct Cursor){.line = 0, .column = 0, .desired_column = 0};
 
+// Carets besides cursor that typing and moving apply to as well, the view
+// follows cursor only
+CursorList extra_cursors;
+
+// Other end of the selection from cursor while selecting, there are no
+// extra cursors meanwhile
+bool selecting;
+struct Cursor selection_anchor;
+
+Clipboard *clipboard;
+
 Line *head;
 
 XIM xim;
@@ -40,240 +63,942 @@ struct State _state;
 
 RopeTree *rope_tree;
 
+LineIndex line_index = {0};
+
+// File streaming into rope_tree, nullptr when no load is running
+FileLoader *file_loader;
+
+// File the document was loaded from or saved to, nullptr if there is none
+FileWatch *file_watch;
+
+// Encoding and line ends of that file, saves write them back
+TextFormat file_format;
+
+// Undo and redo of the document
+Caretaker *undo_carataker;
+Caretaker *redo_caretaker;
+
+// Open documents. The state of the shown one lives in the globals above
+// and render_ctx, its entry is only brought up to date when another one
+// is shown
+Document **documents;
+size_t document_count;
+size_t active_document;
+uint64_t show_clock;
+
+// Packed document unpacking on its worker, shown once it is done. nullptr
+// if no switch is waiting
+Document *switching_to;
+
+// Memory stats go to stderr every MEMORY_DUMP_INTERVAL_NS while set
+bool dump_memory;
+struct timespec last_memory_dump;
+
+RenderContext render_ctx;
+
 uint32_t line_num = 0;
 
-vec2s get_cursor_pos() {
-    return (vec2s){.x = cursor.column * _font->space_w,
-                   .y = (cursor.line) * _font->size * 1.5f};
+// Upper bound on redraws, input is still handled in between
+#define TARGET_FPS 60
+#define FRAME_INTERVAL_NS (1000000000LL / TARGET_FPS)
+#define MEMORY_DUMP_INTERVAL_NS (5 * 1000000000LL)
+
+// Events the editor window listens to
+#define WINDOW_EVENT_MASK                                                      \
+    (StructureNotifyMask | KeyPressMask | KeyReleaseMask | ExposureMask |      \
+     ButtonPressMask)
+
+// What changed since the last frame
+typedef struct {
+    bool full;         // expose, font or whole buffer change
+    bool cursor;       // cursor moved, view may scroll
+    bool gutter;       // line count changed
+    size_t first_line; // edited lines, none if first_line > last_line
+    size_t last_line;
+} Damage;
+
+Damage damage = {.full = true, .first_line = SIZE_MAX, .last_line = 0};
+
+void damage_lines(size_t first, size_t last) {
+    damage.first_line = MIN(damage.first_line, first);
+    damage.last_line = MAX(damage.last_line, last);
 }
 
-void create_gl_context() {
-    int screen_id = DefaultScreen(_state.dsp);
+bool needs_redraw() {
+    if (damage.full || damage.cursor || damage.gutter) {
+        return true;
+    }
+    // edits outside the drawn lines do not change the picture
+    return damage.first_line <= damage.last_line &&
+           damage.first_line < render_ctx.last_line &&
+           damage.last_line >= render_ctx.first_line;
+}
 
-    int attribs[] = {GLX_RGBA, GLX_DEPTH_SIZE, 24, GLX_DOUBLEBUFFER, None};
+void clear_damage() {
+    damage = (Damage){.first_line = SIZE_MAX, .last_line = 0};
+}
 
-    XVisualInfo *visual_info = glXChooseVisual(_state.dsp, screen_id, attribs);
-    if (!visual_info) {
-        fprintf(stderr, "No suitable Opengl visual found\n");
-        return;
+// Updates the caches after text was added to the end of the document, the
+// old last line was extended and everything after it is new
+void extend_last_line(size_t last_line) {
+    size_t added = line_index.line_num - 1 - last_line;
+    invalidate_shaped_lines(render_ctx.shape_cache, last_line, last_line);
+    invalidate_column_line(render_ctx.column_cache, last_line, 0);
+    // disabled indexes are rebuilt from the line count once enabled,
+    // so they take no memory per line meanwhile
+    if (render_ctx.wrap->enabled) {
+        invalidate_wrap_line(render_ctx.wrap, last_line);
+        insert_wrap_lines(render_ctx.wrap, last_line + 1, added);
     }
+    if (render_ctx.highlight->enabled) {
+        insert_highlight_lines(render_ctx.highlight, last_line + 1, added);
+    }
+}
 
-    _state.gl_context =
-        glXCreateContext(_state.dsp, visual_info, nullptr, GL_TRUE);
-    if (!_state.gl_context) {
-        fprintf(stderr, "OpenGL cannot be created\n");
-        return;
+void clear_extra_cursors() {
+    if (extra_cursors.count) {
+        extra_cursors.count = 0;
+        damage.full = true;
+    }
+}
+
+void clear_selection() {
+    if (selecting) {
+        selecting = false;
+        damage.full = true;
+    }
+}
+
+// Start of the selection in the document, returns its length, 0 without
+// one
+size_t selection_range(size_t *start) {
+    struct Cursor anchor = selecting ? selection_anchor : cursor;
+    size_t from =
+        line_column_to_offset(line_index, anchor.line, anchor.column);
+    size_t to = line_column_to_offset(line_index, cursor.line, cursor.column);
+    *start = MIN(from, to);
+    return MAX(from, to) - *start;
+}
+
+// Rebuilds the per line caches from the line count on the next frame,
+// disabled ones take no memory per line until they are enabled
+void reset_line_caches() {
+    reset_wrap_lines(render_ctx.wrap,
+                     render_ctx.wrap->enabled ? line_index.line_num : 0);
+    clear_column_cache(render_ctx.column_cache);
+    reset_highlight_lines(render_ctx.highlight, render_ctx.highlight->enabled
+                                                    ? line_index.line_num
+                                                    : 0);
+}
+
+// Adds the blocks the loader has read since the last frame to the end of
+// the document
+void drain_loader() {
+    size_t last_line = line_index.line_num - 1;
+    size_t length = rope_tree->length;
+    int64_t edit_start = profile_now();
+    bool finished = drain_file_loader(file_loader, rope_tree, &line_index);
+    profile_record(PHASE_ROPE_EDIT, edit_start, profile_now());
+
+    if (rope_tree->length != length) {
+        extend_last_line(last_line);
+    }
+    render_ctx.load_progress = file_loader_progress(file_loader);
+    if (finished) {
+        if (file_watch) {
+            file_watch->length = rope_tree->length;
+            // a load cut short did not hash the whole file
+            file_watch->hash = file_loader->hash;
+            file_watch->hashed = file_loader->hash.length == file_watch->size;
+        }
+        free_file_loader(file_loader);
+        file_loader = nullptr;
+        render_ctx.loading = false;
     }
+    damage.full = true;
 }
 
-vec2s render_text(RnState *state, const char *text, RnFont *font, vec2s pos,
-                  RnColor color, int32_t cursor, bool render) {
+// Window title, the file name and where its document is among the others
+void update_title() {
+    Document *doc = documents[active_document];
+    const char *name = "untitled";
+    if (doc->path) {
+        const char *slash = strrchr(doc->path, '/');
+        name = slash ? slash + 1 : doc->path;
+    }
+    char title[256];
+    snprintf(title, sizeof(title), "%s [%zu/%zu]", name, active_document + 1,
+             document_count);
+    XStoreName(_state.dsp, _state.win, title);
+}
 
-    // Get the harfbuzz text information for the string
-    RnHarfbuzzText *hb_text = rn_hb_text_from_str(state, *font, text);
+// Starts streaming path into a new document, false if it cannot be read
+bool load_file(const char *path) {
+    // A paged file opened before comes back from the session cache without
+    // being read
+    LineIndex cached_index;
+    FileHash file_hash;
+    SessionView view = {0};
+    RopeTree *cached =
+        load_session(path, &cached_index, &file_format, &file_hash, &view);
+    if (!cached) {
+        // The file streams in from a worker thread, the first screen is
+        // drawn as soon as its block is indexed
+        file_loader = start_file_loader(path);
+        if (!file_loader) {
+            return false;
+        }
+        file_format = file_loader->format;
+    }
+    Document *doc = documents[active_document];
+    free(doc->path);
+    doc->path = strdup(path);
+    free_file_watch(file_watch);
+    free_rope(rope_tree);
+    // Mementos of lazy trees hold offsets into the file as it was, after a
+    // reload they would read the rewritten bytes
+    clear_caretaker(undo_carataker);
+    clear_caretaker(redo_caretaker);
+    if (cached) {
+        file_watch = create_file_watch(path, cached->file->size, &file_hash,
+                                       cached->length, file_format);
+        rope_tree = cached;
+        free_line_index(&line_index);
+        line_index = cached_index;
+    } else {
+        // the decoded length is known once the load finishes
+        file_watch = create_file_watch(path, file_loader->file_size, nullptr,
+                                       file_loader->file_size, file_format);
+        rope_tree = create_tree();
+        rope_tree->file = file_loader->paged;
+        retain_paged_file(rope_tree->file);
+        clear_line_index(&line_index);
+    }
+    reset_line_caches();
+    cursor = (struct Cursor){view.cursor_line, view.cursor_column,
+                             view.cursor_column};
+    if (cached) {
+        render_ctx.scroll = (Scroll){.line = view.scroll_line};
+    }
+    clear_extra_cursors();
+    clear_selection();
+    // lexing would read all of a paged file back in
+    render_ctx.highlight->enabled = !rope_tree->file && highlights_path(path);
+    render_ctx.loading = !cached;
+    render_ctx.load_progress = 0;
+    damage.full = true;
+    update_title();
+    return true;
+}
 
-    // Set highest bearing as font size
-    hb_text->highest_bearing = font->size;
+// Merges what other processes wrote to the file into the document, the
+// cursor stays on the text it was on
+void merge_file_watch() {
+    size_t last_line = line_index.line_num - 1;
+    size_t offset =
+        line_column_to_offset(line_index, cursor.line, cursor.column);
+    int64_t edit_start = profile_now();
+    FileChange change =
+        merge_file_changes(file_watch, &rope_tree, &line_index, &offset);
+    profile_record(PHASE_ROPE_EDIT, edit_start, profile_now());
+
+    switch (change) {
+    case FILE_UNCHANGED:
+        return;
+    case FILE_APPENDED:
+        extend_last_line(last_line);
+        damage.gutter = true;
+        damage_lines(last_line, line_index.line_num - 1);
+        return;
+    case FILE_PATCHED:
+        reset_line_caches();
+        offset_to_line_column(line_index, offset, &cursor.line,
+                              &cursor.column);
+        cursor.desired_column = cursor.column;
+        clear_extra_cursors();
+        clear_selection();
+        damage.full = true;
+        return;
+    case FILE_RELOAD: {
+        char *path = strdup(file_watch->path);
+        if (path) {
+            load_file(path);
+        }
+        free(path);
+    } break;
+    }
+}
 
-    vec2s start_pos = (vec2s){.x = pos.x, .y = pos.y};
+// The document no longer matches its file, later writes to the file are
+// not merged into it
+void mark_modified() {
+    if (file_watch) {
+        file_watch->modified = true;
+    }
+}
 
-    // New line characters
-    const int32_t line_feed = 0x000A;
-    const int32_t carriage_return = 0x000D;
-    const int32_t line_seperator = 0x2028;
-    const int32_t paragraph_seperator = 0x2029;
+// Takes the state of the shown document out of the globals
+void stash_document(Document *doc) {
+    doc->tree = rope_tree;
+    doc->index = line_index;
+    doc->cursor = cursor;
+    doc->extra_cursors = extra_cursors;
+    doc->selecting = selecting;
+    doc->selection_anchor = selection_anchor;
+    doc->undo = undo_carataker;
+    doc->redo = redo_caretaker;
+    doc->loader = file_loader;
+    doc->watch = file_watch;
+    doc->format = file_format;
+    doc->wrap = render_ctx.wrap;
+    doc->column_cache = render_ctx.column_cache;
+    doc->highlight = render_ctx.highlight;
+    doc->scroll = render_ctx.scroll;
+}
 
-    float textheight = 0;
+// Moves the state of documents[index] into the globals, it has to be
+// unpacked and the shown one stashed
+void show_document(size_t index) {
+    Document *doc = documents[index];
+    active_document = index;
+    switching_to = nullptr;
+    doc->last_shown = ++show_clock;
+    rope_tree = doc->tree;
+    line_index = doc->index;
+    cursor = doc->cursor;
+    extra_cursors = doc->extra_cursors;
+    selecting = doc->selecting;
+    selection_anchor = doc->selection_anchor;
+    undo_carataker = doc->undo;
+    redo_caretaker = doc->redo;
+    file_loader = doc->loader;
+    file_watch = doc->watch;
+    file_format = doc->format;
+    render_ctx.wrap = doc->wrap;
+    render_ctx.column_cache = doc->column_cache;
+    render_ctx.highlight = doc->highlight;
+    render_ctx.scroll = doc->scroll;
+    render_ctx.loading = file_loader != nullptr;
+    render_ctx.load_progress =
+        file_loader ? file_loader_progress(file_loader) : 0;
+    if (file_loader) {
+        // the lines that came in while it was hidden are not cached
+        reset_line_caches();
+    }
+    damage.full = true;
+    update_title();
+}
 
-    float scale = 1.0f;
-    if (font->selected_strike_size)
-        scale = ((float)font->size / (float)font->selected_strike_size);
+// Packs the documents besides the RESIDENT_DOCUMENTS shown last
+void pack_idle_documents() {
+    for (size_t i = 0; i < document_count; ++i) {
+        size_t newer = 0;
+        for (size_t k = 0; k < document_count; ++k) {
+            newer += documents[k]->last_shown > documents[i]->last_shown;
+        }
+        if (i != active_document && newer >= RESIDENT_DOCUMENTS) {
+            start_packing(documents[i]);
+        }
+    }
+}
 
-    for (unsigned int i = 0; i < hb_text->glyph_count; i++) {
-        // Get the glyph from the glyph index
-        RnGlyph glyph = rn_glyph_from_codepoint(
-            state, font, hb_text->glyph_info[i].codepoint);
+// Shows documents[index] instead of the shown one. A packed one is
+// unpacked on a worker first and shown by poll_documents once it is in,
+// the shown one takes input meanwhile
+void switch_document(size_t index) {
+    switching_to = nullptr;
+    if (index == active_document) {
+        return;
+    }
+    if (!prepare_document(documents[index])) {
+        switching_to = documents[index];
+        return;
+    }
+    stash_document(documents[active_document]);
+    show_document(index);
+}
 
-        uint32_t text_length = strlen(text);
-        uint32_t codepoint = rn_utf8_to_codepoint(
-            text, hb_text->glyph_info[i].cluster, text_length);
-        // Check if the unicode codepoint is a new line and advance
-        // to the next line if so
-        if (codepoint == line_feed || codepoint == carriage_return ||
-            codepoint == line_seperator || codepoint == paragraph_seperator) {
-            float font_height = font->face->size->metrics.height / 64.0f;
-            pos.x = start_pos.x;
-            pos.y += _font->size * 1.5f;
-            textheight += font_height;
+// Takes over finished packing and unpacking, shows the document a switch
+// waits for and packs the idle ones. True while a worker is at it
+bool poll_documents() {
+    pack_idle_documents();
+    bool working = false;
+    for (size_t i = 0; i < document_count; ++i) {
+        working |= update_document(documents[i]);
+    }
+    for (size_t i = 0; i < document_count && switching_to; ++i) {
+        if (documents[i] != switching_to || switching_to->worker) {
             continue;
         }
+        if (switching_to->is_packed) {
+            switching_to = nullptr; // it could not be unpacked
+        } else {
+            stash_document(documents[active_document]);
+            show_document(i);
+        }
+    }
+    return working;
+}
 
-        // Advance the x position by the tab width if
-        // we iterate a tab character
-        if (codepoint == '\t') {
-            pos.x += font->tab_w * font->space_w;
-            continue;
+// Opens an empty document after the shown one and shows it
+bool new_document() {
+    Document **grown =
+        realloc(documents, (document_count + 1) * sizeof(Document *));
+    if (!grown) {
+        perror("Failed to grow documents");
+        return false;
+    }
+    documents = grown;
+    Document *doc = create_document();
+    if (!doc) {
+        return false;
+    }
+    size_t index = 0;
+    if (document_count) {
+        // wrapping carries over to new documents
+        doc->wrap->enabled = render_ctx.wrap->enabled;
+        stash_document(documents[active_document]);
+        index = active_document + 1;
+    }
+    memmove(&documents[index + 1], &documents[index],
+            (document_count - index) * sizeof(Document *));
+    documents[index] = doc;
+    document_count++;
+    show_document(index);
+    return true;
+}
+
+// Closes the shown document and shows the one shown before it, which is
+// never packed, the last one gives way to an empty document
+void close_document() {
+    size_t closing = active_document;
+    if (document_count == 1) {
+        if (!new_document()) {
+            return;
+        }
+    } else {
+        size_t next = closing ? 0 : 1;
+        for (size_t i = 0; i < document_count; ++i) {
+            if (i != closing &&
+                documents[i]->last_shown > documents[next]->last_shown) {
+                next = i;
+            }
+        }
+        if (!prepare_document(documents[next])) {
+            return;
         }
+        stash_document(documents[closing]);
+        show_document(next);
+    }
+    save_document_session(documents[closing]);
+    free_document(documents[closing]);
+    document_count--;
+    memmove(&documents[closing], &documents[closing + 1],
+            (document_count - closing) * sizeof(Document *));
+    if (active_document > closing) {
+        active_document--;
+    }
+    update_title();
+}
 
-        // If the glyph is not with
-        if (!hb_text->glyph_info[i].codepoint) {
+// Keeps loading the documents that are not shown, true while any are
+bool drain_hidden_loaders() {
+    bool loading = false;
+    for (size_t i = 0; i < document_count; ++i) {
+        Document *doc = documents[i];
+        if (i == active_document || !doc->loader) {
+            continue;
+        }
+        if (!drain_file_loader(doc->loader, doc->tree, &doc->index)) {
+            loading = true;
             continue;
         }
-        float x_advance = (hb_text->glyph_pos[i].x_advance / 64.0f) * scale;
-        float y_advance = (hb_text->glyph_pos[i].y_advance / 64.0f) * scale;
-        float x_offset = (hb_text->glyph_pos[i].x_offset / 64.0f) * scale;
-        float y_offset = (hb_text->glyph_pos[i].y_offset / 64.0f) * scale;
+        free_file_loader(doc->loader);
+        doc->loader = nullptr;
+        if (doc->watch) {
+            doc->watch->length = doc->tree->length;
+        }
+        reset_wrap_lines(doc->wrap,
+                         doc->wrap->enabled ? doc->index.line_num : 0);
+        clear_column_cache(doc->column_cache);
+        reset_highlight_lines(doc->highlight, doc->highlight->enabled
+                                                  ? doc->index.line_num
+                                                  : 0);
+    }
+    return loading;
+}
+
+// Last column a cursor can take on line, the line break is not one
+size_t line_end_column(size_t line) {
+    size_t length = get_line_length(&line_index, line);
+    return line == line_index.line_num - 1 ? length : length - 1;
+}
+
+void move_left(struct Cursor *c) {
+    if (c->column > 0) {
+        c->column--;
+    } else if (c->line > 0) {
+        c->line--;
+        c->column = line_end_column(c->line);
+    }
+    c->desired_column = c->column;
+}
+
+void move_right(struct Cursor *c) {
+    if (c->column < line_end_column(c->line)) {
+        c->column++;
+    } else if (c->line + 1 < line_index.line_num) {
+        c->column = 0;
+        c->line++;
+    }
+    c->desired_column = c->column;
+}
+
+void move_up(struct Cursor *c) {
+    if (c->line > 0) {
+        c->line--;
+        c->column = MIN(line_end_column(c->line), c->desired_column);
+    }
+}
 
-        vec2s glyph_pos = {pos.x + x_offset,
-                           pos.y + hb_text->highest_bearing - y_offset};
+void move_down(struct Cursor *c) {
+    if (c->line < line_index.line_num - 1) {
+        c->line++;
+        c->column = MIN(line_end_column(c->line), c->desired_column);
+    }
+}
 
-        // Render the glyph
-        if (render) {
-            rn_glyph_render(state, glyph, *font, glyph_pos, color);
+// Moves every cursor, the ones that end up together become one
+void move_cursors(void (*move)(struct Cursor *)) {
+    clear_selection();
+    move(&cursor);
+    for (size_t i = 0; i < extra_cursors.count; ++i) {
+        move(&extra_cursors.cursors[i]);
+    }
+    if (extra_cursors.count) {
+        merge_cursors(&extra_cursors, cursor);
+        damage.full = true;
+    }
+    damage.cursor = true;
+}
+
+// Adds a cursor on the line below the last cursor, or above the first one,
+// at the column the cursor there wants. False if there is no such line
+bool add_cursor_line(bool down) {
+    clear_selection();
+    struct Cursor from = cursor;
+    if (extra_cursors.count) {
+        struct Cursor edge = down
+                                 ? extra_cursors.cursors[extra_cursors.count - 1]
+                                 : extra_cursors.cursors[0];
+        if (down ? edge.line > from.line : edge.line < from.line) {
+            from = edge;
         }
-        if (glyph.height > textheight) {
-            textheight = glyph.height;
+    }
+    if (down ? from.line + 1 >= line_index.line_num : from.line == 0) {
+        return false;
+    }
+    from.line = down ? from.line + 1 : from.line - 1;
+    from.column = MIN(line_end_column(from.line), from.desired_column);
+    add_cursor(&extra_cursors, from);
+    damage.full = true;
+    return true;
+}
+
+// Moves the cursor and selects from where it was, or extends the selection
+void select_with(void (*move)(struct Cursor *)) {
+    clear_extra_cursors();
+    if (!selecting) {
+        selecting = true;
+        selection_anchor = cursor;
+    }
+    move(&cursor);
+    damage.full = true;
+    damage.cursor = true;
+}
+
+// Every cursor in document order, cursor among the extra ones
+struct Cursor **ordered_cursors(size_t *count) {
+    *count = extra_cursors.count + 1;
+    struct Cursor **ordered = malloc(*count * sizeof(struct Cursor *));
+    if (!ordered) {
+        perror("Failed to allocate cursors");
+        return nullptr;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < extra_cursors.count; ++i) {
+        struct Cursor *extra = &extra_cursors.cursors[i];
+        bool main_next = extra->line > cursor.line ||
+                         (extra->line == cursor.line &&
+                          extra->column > cursor.column);
+        if (n == i && main_next) {
+            ordered[n++] = &cursor;
         }
+        ordered[n++] = extra;
+    }
+    if (n == extra_cursors.count) {
+        ordered[n++] = &cursor;
+    }
+    return ordered;
+}
+
+// Where an edit of a batch started in the old text
+typedef struct {
+    size_t line;
+    size_t column;
+    size_t removed; // line breaks it deleted
+} EditSite;
+
+// Brings the per line caches in line with one edit that added line breaks
+void update_line_caches(EditSite site, size_t added) {
+    invalidate_wrap_line(render_ctx.wrap, site.line);
+    invalidate_highlight_line(render_ctx.highlight, site.line);
+    invalidate_column_line(render_ctx.column_cache, site.line, site.column);
+    if (site.removed) {
+        delete_wrap_lines(render_ctx.wrap, site.line + 1, site.removed);
+        shift_column_lines(render_ctx.column_cache, site.line + 1,
+                           -(int64_t)site.removed);
+        delete_highlight_lines(render_ctx.highlight, site.line + 1,
+                               site.removed);
+    }
+    if (added) {
+        insert_wrap_lines(render_ctx.wrap, site.line + 1, added);
+        shift_column_lines(render_ctx.column_cache, site.line + 1, added);
+        insert_highlight_lines(render_ctx.highlight, site.line + 1, added);
+    }
+}
 
-        // Advance to the next glyph
-        pos.x += x_advance;
-        pos.y += y_advance;
+// Replaces the before bytes in front of every cursor with text, all in one
+// batch so the rope and line index are walked once however many cursors
+// there are. Each cursor ends up after its text
+void edit_at_cursors(const char *text, size_t length, size_t before) {
+    size_t count;
+    struct Cursor **ordered = ordered_cursors(&count);
+    RopeEdit *edits = malloc(count * sizeof(RopeEdit));
+    EditSite *sites = malloc(count * sizeof(EditSite));
+    if (!ordered || !edits || !sites) {
+        perror("Failed to allocate edits");
+        free(ordered);
+        free(edits);
+        free(sites);
+        return;
     }
 
-    return (vec2s){.x = pos.x, .y = pos.y};
+    size_t added = 0;
+    for (const char *at = text;
+         (at = memchr(at, '\n', text + length - at)); ++at) {
+        added++;
+    }
+    bool lines_changed = added > 0;
+    size_t previous = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t offset = line_column_to_offset(line_index, ordered[i]->line,
+                                              ordered[i]->column);
+        // deletes stop at the cursor before
+        size_t start = offset - MIN(before, offset - previous);
+        edits[i] = (RopeEdit){start, offset - start, text, length, nullptr};
+        EditSite *site = &sites[i];
+        offset_to_line_column(line_index, start, &site->line, &site->column);
+        site->removed = ordered[i]->line - site->line;
+        lines_changed |= site->removed > 0;
+        previous = offset;
+    }
+
+    mark_modified();
+    int64_t edit_start = profile_now();
+    rope_tree = apply_edits(rope_tree, edits, count);
+    int64_t index_start = profile_now();
+    apply_edits_to_index(&line_index, edits, count);
+    profile_record(PHASE_ROPE_EDIT, edit_start, index_start);
+    profile_record(PHASE_LINE_INDEX, index_start, profile_now());
+
+    size_t first_line = sites[0].line;
+    size_t last_line = sites[count - 1].line + added;
+    invalidate_shaped_lines(render_ctx.shape_cache, first_line, last_line);
+    if (count == 1 || !lines_changed) {
+        // from the back, so the lines before each edit stay where they were
+        for (size_t i = count; i-- > 0;) {
+            update_line_caches(sites[i], added);
+        }
+        damage_lines(first_line, last_line);
+    } else {
+        // moving the lines after every edit would cost more than a rebuild
+        reset_line_caches();
+        damage.full = true;
+    }
+    damage.gutter |= lines_changed;
+
+    size_t inserted = 0;
+    size_t deleted = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t offset = edits[i].offset + inserted - deleted + length;
+        offset_to_line_column(line_index, offset, &ordered[i]->line,
+                              &ordered[i]->column);
+        ordered[i]->desired_column = ordered[i]->column;
+        inserted += length;
+        deleted += edits[i].length;
+    }
+    merge_cursors(&extra_cursors, cursor);
+    damage.cursor = true;
+    free(ordered);
+    free(edits);
+    free(sites);
 }
 
-void render(uint32_t render_w, uint32_t render_h) {
-    glClear(GL_COLOR_BUFFER_BIT);
-    vec4s clear_color = rn_color_to_zto(rn_color_from_hex(0x282828));
-    glClearColor(clear_color.r, clear_color.g, clear_color.b, clear_color.a);
+// Like edit_at_cursors, but a selection is what gets replaced
+void replace_at_cursors(const char *text, size_t length, size_t before) {
+    if (selecting) {
+        size_t start;
+        size_t selected = selection_range(&start);
+        if (selected) {
+            offset_to_line_column(line_index, start + selected, &cursor.line,
+                                  &cursor.column);
+            before = selected;
+        }
+        clear_selection();
+    }
+    edit_at_cursors(text, length, before);
+}
 
-    rn_resize_display(_state.render_state, render_w, render_h);
+// Saves the document for undo before an edit
+void remember_document() {
+    Memento *m = create_memento(rope_tree, head);
+    m->cursor_line = cursor.line;
+    m->cursor_column = cursor.column;
+    m->cursor_desired_column = cursor.desired_column;
+    save_memento(undo_carataker, m);
+    clear_caretaker(redo_caretaker);
+}
 
-    rn_begin(_state.render_state);
+// Puts the selection on the clipboard as a slice of the rope, false if
+// nothing is selected
+bool copy_selection() {
+    size_t start;
+    size_t length = selection_range(&start);
+    if (!length) {
+        return false;
+    }
+    RopeTree *slice = copy_slice(rope_tree, start, length);
+    if (!slice) {
+        return false;
+    }
+    LineIndex lines = {0};
+    copy_index_range(&line_index, start, length, &lines);
+    set_clipboard(clipboard, slice, lines);
+    return true;
+}
 
-    vec2s cursor_pos = get_cursor_pos();
+// Splices a copy of the clipboard slice in place of the selection, the
+// text is only copied out for several cursors or when its lazy leaves
+// point into another file than the document's
+void paste_clipboard() {
+    RopeTree *slice = clipboard->slice;
+    if (!slice) {
+        // another program has it, the text arrives as SelectionNotify
+        request_clipboard(clipboard);
+        return;
+    }
+    if (extra_cursors.count ||
+        (slice->file && rope_tree->file && slice->file != rope_tree->file)) {
+        char *text = malloc(slice->length + 1);
+        if (!text) {
+            perror("Failed to allocate pasted text");
+            return;
+        }
+        if (copy_range(slice->root, 0, slice->length, text) < slice->length) {
+            free(text);
+            return;
+        }
+        remember_document();
+        replace_at_cursors(text, slice->length, 0);
+        free(text);
+        return;
+    }
 
-    float x_offset = 0;
-    if (cursor_pos.x >= render_w) {
-        x_offset = cursor_pos.x - render_w + _font->size;
+    size_t start;
+    size_t length = selection_range(&start);
+    clear_selection();
+    EditSite site;
+    size_t end_line, end_column;
+    offset_to_line_column(line_index, start, &site.line, &site.column);
+    offset_to_line_column(line_index, start + length, &end_line, &end_column);
+    site.removed = end_line - site.line;
+    size_t added = clipboard->lines.line_num - 1;
+
+    remember_document();
+    mark_modified();
+    RopeEdit edit = {start, length, nullptr, slice->length, slice};
+    int64_t edit_start = profile_now();
+    rope_tree = apply_edits(rope_tree, &edit, 1);
+    if (slice->file && !rope_tree->file) {
+        rope_tree->file = slice->file;
+        retain_paged_file(rope_tree->file);
     }
+    int64_t index_start = profile_now();
+    delete_text_from_index(&line_index, start, length);
+    insert_lines_to_index(&line_index, start, &clipboard->lines);
+    profile_record(PHASE_ROPE_EDIT, edit_start, index_start);
+    profile_record(PHASE_LINE_INDEX, index_start, profile_now());
+
+    invalidate_shaped_lines(render_ctx.shape_cache, site.line,
+                            site.line + added);
+    update_line_caches(site, added);
+    damage_lines(site.line, site.line + added);
+    damage.gutter |= added || site.removed;
+    offset_to_line_column(line_index, start + slice->length, &cursor.line,
+                          &cursor.column);
+    cursor.desired_column = cursor.column;
+    damage.cursor = true;
+}
 
-    float y_offset = 0;
-    if (cursor_pos.y >= render_h) {
-        y_offset = cursor_pos.y - render_h + _font->size;
+// Replaces every match of search in one batch over the rope and the line
+// index, undone as one step
+void replace_all(const char *search, const char *replacement) {
+    RopeEdit *edits;
+    size_t count;
+    if (!find_replace_edits(rope_tree, search, strlen(search), replacement,
+                            strlen(replacement), &edits, &count) ||
+        !count) {
+        free(edits);
+        return;
+    }
+    remember_document();
+    // the cursor stays with the text around it, or goes to the start of
+    // the match it was in
+    size_t offset =
+        line_column_to_offset(line_index, cursor.line, cursor.column);
+    size_t moved = offset;
+    for (size_t i = 0; i < count && edits[i].offset < offset; ++i) {
+        if (edits[i].offset + edits[i].length > offset) {
+            moved -= offset - edits[i].offset;
+            break;
+        }
+        moved = moved - edits[i].length + edits[i].text_length;
     }
 
-    float max_width = 0;
-    float x = 20;
-    float y = 20;
-    char buff[16];
-    sprintf(buff, "%d", line_num);
-    float width = rn_text_props(_state.render_state, buff, _font).width;
-    if (width > max_width) {
-        max_width = width;
-    }
-    for (int i = 1; i <= line_num; i++) {
-        sprintf(buff, "%d", i);
-        render_text(_state.render_state, buff, _font,
-                    (vec2s){20 - x_offset, y - y_offset},
-                    (RnColor){150, 150, 150, 255}, -1, True);
-        y += _font->size * 1.5f;
-    }
-    y = 20;
-
-    const float new_line_start_x = x + cursor_pos.x - x_offset + max_width + 10;
-
-    rn_rect_render(
-        _state.render_state,
-        (vec2s){x + cursor_pos.x - x_offset + max_width + 10, y + cursor_pos.y},
-        (vec2s){1, 1.5f * _font->size}, RN_WHITE);
-    List *leaves = get_leaves(rope_tree);
-    List *leaves_start = leaves;
-
-    vec2s rendering_start_point =
-        (vec2s){.x = x - x_offset + max_width + 10, .y = y - y_offset};
-
-    size_t total_text_length = 0;
-    // TODO: find better sollution this might be to slow for big files
-    for (List *l = leaves; l != nullptr; l = l->next) {
-        total_text_length += strlen(l->leaf->data);
-    }
-    char *text = malloc(total_text_length + 1);
-    if (!text) {
+    mark_modified();
+    int64_t edit_start = profile_now();
+    rope_tree = apply_edits(rope_tree, edits, count);
+    int64_t index_start = profile_now();
+    apply_edits_to_index(&line_index, edits, count);
+    profile_record(PHASE_ROPE_EDIT, edit_start, index_start);
+    profile_record(PHASE_LINE_INDEX, index_start, profile_now());
+    free(edits);
+
+    reset_line_caches();
+    clear_extra_cursors();
+    clear_selection();
+    offset_to_line_column(line_index, moved, &cursor.line, &cursor.column);
+    cursor.desired_column = cursor.column;
+    damage.full = true;
+    damage.cursor = true;
+}
+
+// Keys that move around without changing the document
+bool is_view_key(XKeyPressedEvent *event) {
+    KeySym keys[] = {XK_Up,   XK_Down, XK_Prior, XK_Next,
+                     XK_Home, XK_End,  XK_plus,  XK_minus};
+    for (size_t i = 0; i < sizeof(keys) / sizeof(*keys); ++i) {
+        if (event->keycode == XKeysymToKeycode(_state.dsp, keys[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int64_t elapsed_ns(struct timespec since) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (now.tv_sec - since.tv_sec) * 1000000000LL +
+           (now.tv_nsec - since.tv_nsec);
+}
+
+// Waits up to timeout_ns, or without limit if it is negative, for X events
+// or a write to the watched file, returns true if X events arrived
+bool wait_for_events(int64_t timeout_ns) {
+    XFlush(_state.dsp);
+    struct pollfd fds[] = {
+        {.fd = ConnectionNumber(_state.dsp), .events = POLLIN},
+        {.fd = file_watch ? file_watch->fd : -1, .events = POLLIN},
+    };
+    int timeout_ms = timeout_ns < 0 ? -1 : (timeout_ns + 999999) / 1000000;
+    return poll(fds, 2, timeout_ms) > 0 && fds[0].revents & POLLIN;
+}
+
+// Sizes of everything the editor holds, ropes of all documents included
+MemoryStats collect_memory_stats() {
+    MemoryStats stats = {
+        .rope = rope_stats(),
+        .line_index = line_index_bytes(&line_index),
+        .history = caretaker_bytes(undo_carataker) +
+                   caretaker_bytes(redo_caretaker),
+        .font_cache = font_cache_bytes(render_ctx.fonts),
+        .shape_cache = shape_cache_bytes(render_ctx.shape_cache),
+    };
+    for (size_t i = 0; i < document_count; ++i) {
+        const Document *doc = documents[i];
+        if (i == active_document) {
+            continue;
+        }
+        stats.line_index += line_index_bytes(&doc->index);
+        stats.history +=
+            caretaker_bytes(doc->undo) + caretaker_bytes(doc->redo);
+        stats.packed += document_packed_bytes(doc);
+        stats.packed_documents += doc->is_packed;
+    }
+    return stats;
+}
+
+void create_gl_context() {
+    int screen_id = DefaultScreen(_state.dsp);
+
+    int attribs[] = {GLX_RGBA, GLX_DEPTH_SIZE, 24, GLX_DOUBLEBUFFER, None};
+
+    XVisualInfo *visual_info = glXChooseVisual(_state.dsp, screen_id, attribs);
+    if (!visual_info) {
+        fprintf(stderr, "No suitable Opengl visual found\n");
+        return;
+    }
+
+    _state.gl_context =
+        glXCreateContext(_state.dsp, visual_info, nullptr, GL_TRUE);
+    if (!_state.gl_context) {
+        fprintf(stderr, "OpenGL cannot be created\n");
         return;
     }
-    text[0] = '\0';
-
-    for (List *l = leaves; l != nullptr; l = l->next) {
-        strcat(text, l->leaf->data);
-    }
-
-    render_text(_state.render_state, text, _font,
-                (vec2s){x - x_offset + max_width + 10, y - y_offset}, RN_WHITE,
-                -1, True);
-    // rn_text_render_ex(_state.render_state, text, _font,
-    //                   (vec2s){x - x_offset + max_width + 10, y - y_offset},
-    //                   RN_WHITE, _font->size * 1.5f, True);
-
-    // for (List *l = leaves; l != nullptr; l = l->next) {
-    //     text_props = rn_text_render(
-    //         _state.render_state, l->leaf->data, _font,
-    //         (vec2s){x - x_offset + max_width + 10, y - y_offset}, RN_WHITE);
-    //     int new_line_count = 0;
-    //     const char *last_nl = nullptr;
-    //     for (const char *p = l->leaf->data; p && *p != '\0'; ++p) {
-    //         if (*p == '\n') {
-    //             new_line_count++;
-    //             last_nl = p;
-    //         }
-    //     }
-    //
-    //     const char *after_last_nl = last_nl ? last_nl + 1 : l->leaf->data;
-    //
-    //     printf("string after last nl: %s\n", after_last_nl);
-    //     printf("Before adjust x=%f, y=%f\b", x, y);
-    //     y += new_line_count * _font->size * 1.5f;
-    //     if (new_line_count > 0) {
-    //         x = strlen(after_last_nl) * _font->space_w + 20;
-    //     } else {
-    //         x += strlen(after_last_nl) * _font->space_w;
-    //     }
-    //     printf("After adjust x=%f, y=%f\n", x, y);
-    //     // if (strncmp(l->leaf->data, "\n", 1) == 0) {
-    //     //     y += _font->size * 1.5f;
-    //     //     x = 20;
-    //     //     continue;
-    //     // }
-    // }
-
-    rn_end(_state.render_state);
-
-    glXSwapBuffers(_state.dsp, _state.win);
-
-    free_list(leaves_start);
-    leaves = nullptr;
-    leaves_start = nullptr;
 }
 
-void render_bottom_bar(uint32_t render_w, uint32_t render_h, Window win,
-                       char *buffer) {
-    glClear(GL_COLOR_BUFFER_BIT);
-    vec4s clear_color = rn_color_to_zto(rn_color_from_hex(0x282828));
-    glClearColor(clear_color.r, clear_color.g, clear_color.b, clear_color.a);
+// Runs on the render thread, which draws from then on
+void attach_gl_context(void *) {
+    glXMakeCurrent(_state.dsp, _state.win, _state.gl_context);
+}
 
-    rn_resize_display(_state.render_state, render_w, render_h);
+void render(uint32_t render_w, uint32_t render_h) {
+    render_ctx.has_selection = selecting;
+    if (selecting) {
+        bool anchor_first =
+            selection_anchor.line < cursor.line ||
+            (selection_anchor.line == cursor.line &&
+             selection_anchor.column < cursor.column);
+        render_ctx.selection_start = anchor_first ? selection_anchor : cursor;
+        render_ctx.selection_end = anchor_first ? cursor : selection_anchor;
+    }
+    render_document(&render_ctx, rope_tree, &line_index, cursor, render_w,
+                    render_h);
+}
 
-    rn_begin(_state.render_state);
+void render_bottom_bar(uint32_t render_w, uint32_t render_h, Window win,
+                       char *buffer) {
+    Renderer *renderer = render_ctx.renderer;
+    renderer->begin(renderer, render_w, render_h, rn_color_from_hex(0x282828));
 
     float x = 20;
     float y = render_h - 40;
 
-    rn_text_render(_state.render_state, buffer, _font, (vec2s){x, y}, RN_WHITE);
-
-    rn_end(_state.render_state);
+    render_text(&render_ctx, buffer, strlen(buffer), SHAPE_NO_LINE,
+                (vec2s){x, y}, RN_WHITE, true);
 
-    glXSwapBuffers(_state.dsp, _state.win);
+    renderer->end(renderer);
 }
 
 Line *add_new_line(Line *prev) {
@@ -330,10 +1055,13 @@ char *open_bottom_bar(int window_width, int window_height) {
         } break;
         }
     }
+    XSelectInput(_state.dsp, _state.win, WINDOW_EVENT_MASK);
     return buff;
 }
 
 int main() {
+    // the render thread swaps buffers on the same display connection
+    XInitThreads();
     _state.dsp = XOpenDisplay(0);
 
     xim = XOpenIM(_state.dsp, nullptr, nullptr, nullptr);
@@ -355,8 +1083,7 @@ int main() {
     int attribute_value_mask = CWBackingPixel | CWEventMask;
     XSetWindowAttributes window_attributes;
     window_attributes.backing_pixel = 0xffffccaa;
-    window_attributes.event_mask =
-        StructureNotifyMask | KeyPressMask | KeyReleaseMask | ExposureMask;
+    window_attributes.event_mask = WINDOW_EVENT_MASK;
 
     _state.win =
         XCreateWindow(_state.dsp, root_window, window_x, window_y, window_width,
@@ -383,146 +1110,322 @@ int main() {
     _state.render_state =
         rn_init(window_x, window_height, (RnGLLoader)glXGetProcAddressARB);
 
-    _font =
-        rn_load_font(_state.render_state, "./Iosevka-Regular.ttf", font_size);
-
-    rope_tree = create_tree();
-    size_t carataker_capacity = 100;
-    Caretaker *undo_carataker = create_caretaker(carataker_capacity);
-    Caretaker *redo_caretaker = create_caretaker(carataker_capacity);
-
-    LineIndex line_index = {nullptr, nullptr, 0, 0};
-    add_line_to_index(&line_index, 0, 0);
+    // Input and edits stay on this thread, frames are drawn on another
+    Renderer *gl_renderer =
+        create_gl_renderer(_state.render_state, _state.dsp, _state.win);
+    glXMakeCurrent(_state.dsp, None, nullptr);
+    render_ctx.renderer =
+        create_threaded_renderer(gl_renderer, attach_gl_context, nullptr);
+    if (!render_ctx.renderer) {
+        return EXIT_FAILURE;
+    }
+    render_ctx.fonts =
+        create_font_cache(render_ctx.renderer, "./Iosevka-Regular.ttf");
+    render_ctx.shape_cache = create_shape_cache(SHAPE_CACHE_CAPACITY);
+    _font = set_render_font_size(&render_ctx, font_size);
+    render_ctx.extra_cursors = &extra_cursors;
+    clipboard = create_clipboard(_state.dsp, _state.win);
+    if (!clipboard || !new_document()) {
+        return EXIT_FAILURE;
+    }
 
-    render(window_width, window_height);
+    struct timespec last_frame = {0};
     int is_window_open = 1;
     while (is_window_open) {
+        // Drain every queued event before drawing, then draw at most once
+        // per frame interval
+        if (!XPending(_state.dsp)) {
+            if (dump_memory &&
+                elapsed_ns(last_memory_dump) >= MEMORY_DUMP_INTERVAL_NS) {
+                MemoryStats stats = collect_memory_stats();
+                print_memory_stats(&stats, stderr);
+                timespec_get(&last_memory_dump, TIME_UTC);
+            }
+            if (file_loader) {
+                drain_loader();
+            }
+            bool hidden_loading = drain_hidden_loaders();
+            bool documents_working = poll_documents();
+            if (needs_redraw()) {
+                int64_t wait_ns = FRAME_INTERVAL_NS - elapsed_ns(last_frame);
+                if (wait_ns <= 0 || !wait_for_events(wait_ns)) {
+                    if (render_ctx.show_hud) {
+                        render_ctx.memory = collect_memory_stats();
+                    }
+                    render(window_width, window_height);
+                    timespec_get(&last_frame, TIME_UTC);
+                    clear_damage();
+                }
+                continue;
+            }
+            clear_damage();
+            // the input changed nothing on screen, it has no latency
+            profile_take_input();
+            if (file_loader || hidden_loading || documents_working) {
+                // poll the loaders and document workers instead of
+                // blocking on the next event
+                wait_for_events(FRAME_INTERVAL_NS);
+                continue;
+            }
+
+            // Lex the rest of the document while no events are waiting
+            HighlightIndex *hl = render_ctx.highlight;
+            if (hl->valid < hl->line_num &&
+                hl->line_num == line_index.line_num) {
+                // the viewport was drawn from a guessed state
+                bool guessed = hl->valid < render_ctx.first_line;
+                lex_until(hl, rope_tree, &line_index, hl->line_num,
+                          HIGHLIGHT_IDLE_LINES);
+                if (guessed && hl->valid >= render_ctx.first_line) {
+                    damage.full = true;
+                }
+                continue;
+            }
+
+            if (file_watch && file_changed(file_watch)) {
+                merge_file_watch();
+                continue;
+            }
+            // sleep until input arrives, the file is written or the next
+            // memory dump is due
+            int64_t timeout_ns =
+                dump_memory ? MAX(MEMORY_DUMP_INTERVAL_NS -
+                                      elapsed_ns(last_memory_dump),
+                                  0)
+                            : -1;
+            if (!wait_for_events(timeout_ns)) {
+                continue;
+            }
+        }
+
         XEvent general_event;
         XNextEvent(_state.dsp, &general_event);
+        int64_t event_start = profile_now();
+        if (general_event.type == KeyPress ||
+            general_event.type == ButtonPress) {
+            profile_input(event_start);
+        }
 
         switch (general_event.type) {
         case KeyPress: {
             XKeyPressedEvent *event = (XKeyPressedEvent *)&general_event;
             if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Escape)) {
+                if (file_loader) {
+                    // keeps the part that was read already, which no longer
+                    // matches the file
+                    cancel_file_loader(file_loader);
+                    free_file_watch(file_watch);
+                    file_watch = nullptr;
+                    break;
+                }
+                if (extra_cursors.count || selecting) {
+                    clear_extra_cursors();
+                    clear_selection();
+                    break;
+                }
                 is_window_open = 0;
                 break;
             }
-            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Return)) {
-                rope_tree =
-                    insert(rope_tree,
-                           line_column_to_offset(line_index, cursor.line,
-                                                 cursor.column++),
-                           "\n");
-                line_index.line_length[cursor.line]++;
-
-                if (cursor.column != line_index.line_length[cursor.line]) {
-                    size_t tmp = line_index.line_length[cursor.line];
-                    line_index.line_length[cursor.line] = cursor.column;
-                    add_line_to_index(
-                        &line_index,
-                        line_column_to_offset(line_index, cursor.line,
-                                              cursor.column),
-                        tmp - line_index.line_length[cursor.line]);
-                    cursor.line++;
-                } else {
-                    add_line_to_index(&line_index,
-                                      line_column_to_offset(line_index,
-                                                            cursor.line++,
-                                                            cursor.column),
-                                      0);
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_F3)) {
+                render_ctx.show_hud = !render_ctx.show_hud;
+                damage.full = true;
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_W) &&
+                event->state & ControlMask) {
+                render_ctx.wrap->enabled = !render_ctx.wrap->enabled;
+                damage.full = true;
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_F4)) {
+                profile_write_chrome_trace("./editor_trace.json");
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_F5)) {
+                dump_memory = !dump_memory;
+                // the first dump comes right away
+                last_memory_dump = (struct timespec){0};
+                break;
+            }
+            // Documents open, close and switch while others load
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_N) &&
+                event->state & ControlMask) {
+                new_document();
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_O) &&
+                event->state & ControlMask) {
+                char *f_path = open_bottom_bar(window_width, window_height);
+                if (new_document() && !load_file(f_path)) {
+                    close_document();
                 }
-                cursor.column = 0;
-                cursor.desired_column = cursor.column;
-                render(window_width, window_height);
+                free(f_path);
+                damage.full = true;
                 break;
             }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Q) &&
+                event->state & ControlMask) {
+                close_document();
+                break;
+            }
+            if ((event->keycode == XKeysymToKeycode(_state.dsp, XK_Prior) ||
+                 event->keycode == XKeysymToKeycode(_state.dsp, XK_Next)) &&
+                event->state & ControlMask) {
+                bool next =
+                    event->keycode == XKeysymToKeycode(_state.dsp, XK_Next);
+                switch_document((active_document +
+                                 (next ? 1 : document_count - 1)) %
+                                document_count);
+                break;
+            }
+            // Only viewing works until the whole file is in
+            if (file_loader && !is_view_key(event)) {
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Return)) {
+                replace_at_cursors("\n", 1, 0);
+                break;
+            }
+            // Shift selects what the cursor moves over
             if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Left)) {
-                if (cursor.column > 0) {
-                    cursor.column--;
-                } else if (cursor.line > 0) {
-                    cursor.line--;
-                    cursor.column = line_index.line_length[cursor.line] - 1;
+                event->state & ShiftMask ? select_with(move_left)
+                                         : move_cursors(move_left);
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Right)) {
+                event->state & ShiftMask ? select_with(move_right)
+                                         : move_cursors(move_right);
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_BackSpace)) {
+                if (cursor.column == 0 && cursor.line == 0 &&
+                    !extra_cursors.count && !selecting) {
+                    break;
                 }
+                replace_at_cursors("", 0, 1);
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_A) &&
+                event->state & ControlMask) {
+                clear_extra_cursors();
+                selecting = true;
+                selection_anchor = (struct Cursor){0};
+                cursor.line = line_index.line_num - 1;
+                cursor.column = get_line_length(&line_index, cursor.line);
                 cursor.desired_column = cursor.column;
-                render(window_width, window_height);
+                damage.full = true;
+                damage.cursor = true;
                 break;
             }
-            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Right)) {
-                if ((cursor.line != line_index.line_num - 1 &&
-                     cursor.column < line_index.line_length[cursor.line] - 1) ||
-                    (cursor.line == line_index.line_num - 1 &&
-                     cursor.column < line_index.line_length[cursor.line])) {
-                    cursor.column++;
-                } else if (cursor.line + 1 < line_index.line_num) {
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_C) &&
+                event->state & ControlMask) {
+                copy_selection();
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_X) &&
+                event->state & ControlMask) {
+                if (copy_selection()) {
+                    remember_document();
+                    replace_at_cursors("", 0, 0);
+                }
+                break;
+            }
+            // asks for the text to search, then for its replacement
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_H) &&
+                event->state & ControlMask) {
+                char *search = open_bottom_bar(window_width, window_height);
+                char *replacement =
+                    open_bottom_bar(window_width, window_height);
+                if (*search) {
+                    replace_all(search, replacement);
+                }
+                free(search);
+                free(replacement);
+                damage.full = true;
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_V) &&
+                event->state & ControlMask) {
+                paste_clipboard();
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Prior) ||
+                event->keycode == XKeysymToKeycode(_state.dsp, XK_Next)) {
+                // the view moves by the same page so the cursor keeps its
+                // place on screen
+                size_t page = window_height / (font_size * 1.5f);
+                clear_extra_cursors();
+                clear_selection();
+                bool down =
+                    event->keycode == XKeysymToKeycode(_state.dsp, XK_Next);
+                if (down) {
+                    cursor.line =
+                        MIN(cursor.line + page, line_index.line_num - 1);
+                } else {
+                    cursor.line = cursor.line > page ? cursor.line - page : 0;
+                }
+                cursor.column =
+                    MIN(line_end_column(cursor.line), cursor.desired_column);
+                scroll_rows(&render_ctx, down ? page : -(float)page);
+                damage.cursor = true;
+                break;
+            }
+            if ((event->keycode == XKeysymToKeycode(_state.dsp, XK_Home) ||
+                 event->keycode == XKeysymToKeycode(_state.dsp, XK_End)) &&
+                event->state & ControlMask) {
+                clear_extra_cursors();
+                clear_selection();
+                if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Home)) {
+                    cursor.line = 0;
                     cursor.column = 0;
-                    cursor.line++;
+                } else {
+                    cursor.line = line_index.line_num - 1;
+                    cursor.column = get_line_length(&line_index, cursor.line);
                 }
                 cursor.desired_column = cursor.column;
-                render(window_width, window_height);
+                damage.cursor = true;
                 break;
             }
-            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_BackSpace)) {
-                line_index.line_length[cursor.line]--;
-                if (cursor.column > 0) {
-                    cursor.column--;
-                } else if (cursor.line > 0) {
-                    delete_line_from_index(&line_index, cursor.line--);
-                    cursor.column = line_index.line_length[cursor.line];
+            // Alt adds cursors, on the next line or on every line below
+            if ((event->keycode == XKeysymToKeycode(_state.dsp, XK_Up) ||
+                 event->keycode == XKeysymToKeycode(_state.dsp, XK_Down)) &&
+                event->state & Mod1Mask) {
+                add_cursor_line(event->keycode ==
+                                XKeysymToKeycode(_state.dsp, XK_Down));
+                break;
+            }
+            if (event->keycode == XKeysymToKeycode(_state.dsp, XK_End) &&
+                event->state & Mod1Mask) {
+                while (add_cursor_line(true)) {
                 }
-                rope_tree =
-                    rope_delete(rope_tree,
-                                line_column_to_offset(line_index, cursor.line,
-                                                      cursor.column),
-                                1);
-
-                cursor.desired_column = cursor.column;
-                render(window_width, window_height);
                 break;
             }
             if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Up)) {
-                if (cursor.line > 0) {
-                    cursor.line--;
-                    size_t line_lenght =
-                        cursor.line == line_index.line_num - 1
-                            ? line_index.line_length[cursor.line]
-                            : line_index.line_length[cursor.line] - 1;
-                    cursor.column = MIN(line_lenght, cursor.desired_column);
-                }
-                render(window_width, window_height);
+                event->state & ShiftMask ? select_with(move_up)
+                                         : move_cursors(move_up);
                 break;
             }
             if (event->keycode == XKeysymToKeycode(_state.dsp, XK_Down)) {
-                if (cursor.line < line_index.line_num - 1) {
-                    cursor.line++;
-                    size_t line_lenght =
-                        cursor.line == line_index.line_num - 1
-                            ? line_index.line_length[cursor.line]
-                            : line_index.line_length[cursor.line] - 1;
-                    cursor.column = MIN(line_lenght, cursor.desired_column);
-                }
-                render(window_width, window_height);
+                event->state & ShiftMask ? select_with(move_down)
+                                         : move_cursors(move_down);
                 break;
             }
             if (event->keycode == XKeysymToKeycode(_state.dsp, XK_plus) &&
                 event->state & ControlMask) {
                 if (font_size + 6 <= 90) {
                     font_size += 6;
-                    // WORKAROUND - rn_set_font_size causes segmentation fault
-                    _font = rn_load_font(_state.render_state,
-                                         "./Iosevka-Regular.ttf", font_size);
+                    _font = set_render_font_size(&render_ctx, font_size);
                 }
-                render(window_width, window_height);
+                damage.full = true;
                 break;
             }
             if (event->keycode == XKeysymToKeycode(_state.dsp, XK_minus) &&
                 event->state & ControlMask) {
                 if (font_size - 6 >= 6) {
                     font_size -= 6;
-                    // WORKAROUND - rn_set_font_size causes segmentation fault
-                    _font = rn_load_font(_state.render_state,
-                                         "./Iosevka-Regular.ttf", font_size);
+                    _font = set_render_font_size(&render_ctx, font_size);
                 }
-                render(window_width, window_height);
+                damage.full = true;
                 break;
             }
             struct Cursor prev_cursor;
@@ -530,54 +1433,34 @@ int main() {
                 event->state & ControlMask) {
 
                 char *f_path = open_bottom_bar(window_width, window_height);
-                FILE *fp = fopen(f_path, "w");
-                if (!fp) {
-                    perror("Failed to open file");
-                    return EXIT_FAILURE;
+                // A failed save leaves the file untouched, so keep editing
+                size_t file_size;
+                FileHash file_hash;
+                if (save_rope(rope_tree, f_path, file_format, &file_size,
+                              &file_hash)) {
+                    free_file_watch(file_watch);
+                    file_watch = create_file_watch(f_path, file_size,
+                                                   &file_hash,
+                                                   rope_tree->length,
+                                                   file_format);
+                    Document *doc = documents[active_document];
+                    free(doc->path);
+                    doc->path = strdup(f_path);
+                    update_title();
                 }
-                save_to_file(rope_tree->root, fp);
-                fclose(fp);
+                free(f_path);
+                damage.full = true;
 
                 break;
             }
             if (event->keycode == XKeysymToKeycode(_state.dsp, XK_L) &&
                 event->state & ControlMask) {
                 char *f_path = open_bottom_bar(window_width, window_height);
-
-                FILE *fp = fopen(f_path, "r");
-
-                if (!fp) {
-                    perror("Failed to open file");
-                    return EXIT_FAILURE;
-                }
-                fseek(fp, 0, SEEK_END);
-                size_t file_size = ftell(fp);
-                rewind(fp);
-
-                size_t chunk_num = (file_size + CHUNK_BASE - 1) / CHUNK_BASE;
-                char **chunks = malloc(chunk_num * sizeof(char *));
-
-                for (size_t i = 0; i < chunk_num; ++i) {
-                    chunks[i] = malloc(chunk_num + 1);
-                    size_t read = fread(chunks[i], 1, CHUNK_BASE, fp);
-                    chunks[i][read] = '\0';
-                }
-                fclose(fp);
-                free_tree(rope_tree->root);
-                free(rope_tree);
-                rope_tree = build_rope(chunks, 0, chunk_num - 1);
-                for (size_t i = 0; i < chunk_num; ++i) {
-                    free(chunks[i]);
-                }
-                free(chunks);
-
-                List *leaves = get_leaves(rope_tree);
-                travelse_list_and_index_lines(leaves, &line_index);
-                cursor.line = line_index.line_num - 1;
-                cursor.column = line_index.line_length[cursor.line];
-                free_list(leaves);
-
-                render(window_width, window_height);
+                // A path that cannot be opened is reported on stderr and
+                // the document is left as it was, so keep editing
+                load_file(f_path);
+                free(f_path);
+                damage.full = true;
                 break;
             }
             if (event->keycode == XKeysymToKeycode(_state.dsp, XK_U) &&
@@ -586,16 +1469,26 @@ int main() {
                 if (!m)
                     break;
                 save_memento(redo_caretaker, m);
-                free_tree(rope_tree->root);
-                free(rope_tree);
-                rope_tree = restore_from_memento(m, &head);
+                RopeTree *restored = restore_from_memento(m, &head);
+                if (!restored)
+                    break;
+                mark_modified();
+                free_rope(rope_tree);
+                rope_tree = restored;
+                int64_t collect_start = profile_now();
                 List *leaves = get_leaves(rope_tree);
+                int64_t index_start = profile_now();
                 travelse_list_and_index_lines(leaves, &line_index);
+                profile_record(PHASE_LEAF_COLLECT, collect_start, index_start);
+                profile_record(PHASE_LINE_INDEX, index_start, profile_now());
                 free_list(leaves);
+                reset_line_caches();
+                clear_extra_cursors();
+                clear_selection();
                 cursor.line = m->cursor_line;
                 cursor.column = m->cursor_column;
                 cursor.desired_column = m->cursor_desired_column;
-                render(window_width, window_height);
+                damage.full = true;
                 break;
             }
             if (event->keycode == XKeysymToKeycode(_state.dsp, XK_R) &&
@@ -604,16 +1497,26 @@ int main() {
                 if (!m)
                     break;
                 save_memento(undo_carataker, m);
-                free_tree(rope_tree->root);
-                free(rope_tree);
-                rope_tree = restore_from_memento(m, &head);
+                RopeTree *restored = restore_from_memento(m, &head);
+                if (!restored)
+                    break;
+                mark_modified();
+                free_rope(rope_tree);
+                rope_tree = restored;
+                int64_t collect_start = profile_now();
                 List *leaves = get_leaves(rope_tree);
+                int64_t index_start = profile_now();
                 travelse_list_and_index_lines(leaves, &line_index);
+                profile_record(PHASE_LEAF_COLLECT, collect_start, index_start);
+                profile_record(PHASE_LINE_INDEX, index_start, profile_now());
                 free_list(leaves);
+                reset_line_caches();
+                clear_extra_cursors();
+                clear_selection();
                 cursor.line = m->cursor_line;
                 cursor.column = m->cursor_column;
                 cursor.desired_column = m->cursor_desired_column;
-                render(window_width, window_height);
+                damage.full = true;
                 break;
             }
 
@@ -626,21 +1529,21 @@ int main() {
             utf8_str[len_utf8_str] = '\0';
 
             if (len_utf8_str != 0) {
-                Memento *m = create_memento(rope_tree, head);
-                m->cursor_line = cursor.line;
-                m->cursor_column = cursor.column;
-                m->cursor_desired_column = cursor.desired_column;
-                save_memento(undo_carataker, m);
-                clear_caretaker(redo_caretaker);
-                rope_tree = insert(rope_tree,
-                                   line_column_to_offset(
-                                       line_index, cursor.line, cursor.column),
-                                   utf8_str);
-                cursor.column++;
-                cursor.desired_column = cursor.column;
-                line_index.line_length[cursor.line]++;
+                remember_document();
+                replace_at_cursors(utf8_str, len_utf8_str, 0);
+            }
+            damage.cursor = true;
+        } break;
+        case ButtonPress: {
+            // wheel steps arrive as presses of buttons 4 and 5
+            XButtonEvent *event = (XButtonEvent *)&general_event;
+            if (event->button == Button4) {
+                scroll_rows(&render_ctx, -SCROLL_WHEEL_ROWS);
+                damage.full = true;
+            } else if (event->button == Button5) {
+                scroll_rows(&render_ctx, SCROLL_WHEEL_ROWS);
+                damage.full = true;
             }
-            render(window_width, window_height);
         } break;
         case ClientMessage: {
             if ((Atom)general_event.xclient.data.l[0] == atom_delete_window) {
@@ -648,12 +1551,48 @@ int main() {
             }
         } break;
         case Expose: {
-            render(window_width, window_height);
+            damage.full = true;
+        } break;
+        case SelectionRequest: {
+            handle_selection_request(clipboard,
+                                     &general_event.xselectionrequest);
+        } break;
+        case SelectionClear: {
+            handle_selection_clear(clipboard);
+        } break;
+        case PropertyNotify: {
+            handle_property_notify(clipboard, &general_event.xproperty);
+        } break;
+        case SelectionNotify: {
+            // text another program had on the clipboard
+            size_t length;
+            char *text = read_selection_notify(
+                clipboard, &general_event.xselection, &length);
+            if (text && length && !file_loader) {
+                remember_document();
+                replace_at_cursors(text, length, 0);
+            }
+            free(text);
         } break;
         }
+        // the view follows the cursor only after it moved, scrolling
+        // alone leaves it off screen
+        if (damage.cursor) {
+            render_ctx.scroll.follow_cursor = true;
+        }
+        profile_record(PHASE_EVENTS, event_start, profile_now());
     }
 
-    free_tree(rope_tree->root);
-    free(rope_tree);
+    stash_document(documents[active_document]);
+    for (size_t i = 0; i < document_count; ++i) {
+        save_document_session(documents[i]);
+        free_document(documents[i]);
+    }
+    free(documents);
+    free_clipboard(clipboard);
+    free_shape_cache(render_ctx.shape_cache);
+    free_font_cache(render_ctx.fonts);
+    free(render_ctx.line_text);
+    render_ctx.renderer->destroy(render_ctx.renderer);
     return 0;
 }
@@ -0,0 +1,383 @@
+#include "encoding.h"
+#include <string.h>
+
+#define REPLACEMENT_CHAR 0xFFFD
+
+static bool is_high_surrogate(uint32_t unit) {
+    return unit >= 0xD800 && unit <= 0xDBFF;
+}
+
+static bool is_low_surrogate(uint32_t unit) {
+    return unit >= 0xDC00 && unit <= 0xDFFF;
+}
+
+static uint32_t read_unit(TextEncoding encoding, const char *at) {
+    const uint8_t *bytes = (const uint8_t *)at;
+    return encoding == TEXT_UTF16LE ? bytes[0] | bytes[1] << 8
+                                    : bytes[0] << 8 | bytes[1];
+}
+
+size_t unit_bytes(TextFormat format) {
+    return format.encoding == TEXT_UTF8 ? 1 : 2;
+}
+
+size_t bom_length(TextFormat format) {
+    if (!format.bom) {
+        return 0;
+    }
+    return format.encoding == TEXT_UTF8 ? 3 : 2;
+}
+
+uint32_t last_unit(TextFormat format, const char *text, size_t length) {
+    if (format.encoding == TEXT_UTF8) {
+        return length ? (uint8_t)text[length - 1] : 0;
+    }
+    length &= ~(size_t)1;
+    return length ? read_unit(format.encoding, text + length - 2) : 0;
+}
+
+TextFormat detect_text_format(const char *text, size_t length) {
+    const uint8_t *bytes = (const uint8_t *)text;
+    size_t sample = length < FORMAT_SAMPLE_BYTES ? length : FORMAT_SAMPLE_BYTES;
+    TextFormat format = {TEXT_UTF8, false, false};
+    if (sample >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB &&
+        bytes[2] == 0xBF) {
+        format.bom = true;
+    } else if (sample >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE) {
+        format = (TextFormat){TEXT_UTF16LE, true, false};
+    } else if (sample >= 2 && bytes[0] == 0xFE && bytes[1] == 0xFF) {
+        format = (TextFormat){TEXT_UTF16BE, true, false};
+    } else {
+        // Without a mark UTF-16 shows as mostly zero high bytes
+        size_t units = sample / 2;
+        size_t even_zeros = 0;
+        size_t odd_zeros = 0;
+        for (size_t i = 0; i < units * 2; i += 2) {
+            even_zeros += !bytes[i];
+            odd_zeros += !bytes[i + 1];
+        }
+        if (units && odd_zeros * 2 > units && even_zeros * 16 < units) {
+            format.encoding = TEXT_UTF16LE;
+        } else if (units && even_zeros * 2 > units && odd_zeros * 16 < units) {
+            format.encoding = TEXT_UTF16BE;
+        }
+    }
+
+    size_t unit = unit_bytes(format);
+    size_t end = sample - (sample - bom_length(format)) % unit;
+    size_t crlf = 0;
+    size_t lf = 0;
+    uint32_t prev = 0;
+    for (size_t i = bom_length(format); i < end; i += unit) {
+        uint32_t c = unit == 1 ? bytes[i] : read_unit(format.encoding, text + i);
+        if (c == '\n') {
+            prev == '\r' ? crlf++ : lf++;
+        }
+        prev = c;
+    }
+    // a file mixing both keeps its line ends as they are, so writing it
+    // back unedited gives the same bytes
+    format.crlf = crlf && !lf;
+    return format;
+}
+
+// True if a \r in text is followed by \n
+static bool has_crlf(const char *text, size_t length) {
+    const char *cr = memchr(text, '\r', length);
+    while (cr && cr + 1 < text + length) {
+        if (cr[1] == '\n') {
+            return true;
+        }
+        cr = memchr(cr + 1, '\r', text + length - cr - 1);
+    }
+    return false;
+}
+
+bool decodes_to_itself(TextFormat format, uint32_t prev, const char *text,
+                       size_t length, bool last) {
+    if (format.encoding != TEXT_UTF8) {
+        return false;
+    }
+    if (!format.crlf) {
+        return true;
+    }
+    // a \r held back from the text before comes out first
+    if (prev == '\r' && (length ? text[0] != '\n' : last)) {
+        return false;
+    }
+    if (!last && length && text[length - 1] == '\r') {
+        return false;
+    }
+    return !has_crlf(text, length);
+}
+
+size_t decoded_capacity(size_t length) {
+    // a lone high surrogate and the unit after it take 6 bytes for 2
+    return 3 * length + 4;
+}
+
+static size_t put_utf8(uint32_t code_point, char *dst) {
+    if (code_point < 0x80) {
+        dst[0] = code_point;
+        return 1;
+    }
+    if (code_point < 0x800) {
+        dst[0] = 0xC0 | code_point >> 6;
+        dst[1] = 0x80 | (code_point & 0x3F);
+        return 2;
+    }
+    if (code_point < 0x10000) {
+        dst[0] = 0xE0 | code_point >> 12;
+        dst[1] = 0x80 | (code_point >> 6 & 0x3F);
+        dst[2] = 0x80 | (code_point & 0x3F);
+        return 3;
+    }
+    dst[0] = 0xF0 | code_point >> 18;
+    dst[1] = 0x80 | (code_point >> 12 & 0x3F);
+    dst[2] = 0x80 | (code_point >> 6 & 0x3F);
+    dst[3] = 0x80 | (code_point & 0x3F);
+    return 4;
+}
+
+static size_t decode_utf8(bool crlf, uint32_t prev, const char *text,
+                          size_t length, bool last, char *dst) {
+    if (!crlf) {
+        memcpy(dst, text, length);
+        return length;
+    }
+    size_t written = 0;
+    if (prev == '\r' && (length ? text[0] != '\n' : last)) {
+        dst[written++] = '\r';
+    }
+    size_t i = 0;
+    while (i < length) {
+        // memchr is vectorized by libc, runs without \r are copied whole
+        const char *cr = memchr(text + i, '\r', length - i);
+        size_t run = (cr ? (size_t)(cr - text) : length) - i;
+        memcpy(dst + written, text + i, run);
+        written += run;
+        i += run;
+        if (cr) {
+            // the \r of a \r\n is dropped, one ending the text is held
+            // back for the next call to pair up
+            i++;
+            if (i < length ? text[i] != '\n' : last) {
+                dst[written++] = '\r';
+            }
+        }
+    }
+    return written;
+}
+
+// Four units at a time while they are ASCII other than \r, the usual case
+// for logs and source. Returns the units taken
+static size_t decode_ascii_units(TextEncoding encoding, const char *text,
+                                 size_t length, char *dst) {
+    size_t i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, text + i, sizeof(word));
+        if (encoding == TEXT_UTF16BE) {
+            word = (word & 0x00FF00FF00FF00FFULL) << 8 |
+                   (word >> 8 & 0x00FF00FF00FF00FFULL);
+        }
+        uint64_t cr = word ^ 0x000D000D000D000DULL;
+        if (word & 0xFF80FF80FF80FF80ULL ||
+            (cr - 0x0001000100010001ULL) & ~cr & 0x8000800080008000ULL) {
+            break;
+        }
+        for (size_t k = 0; k < 4; ++k) {
+            dst[i / 2 + k] = word >> (16 * k);
+        }
+    }
+#endif
+    return i / 2;
+}
+
+static size_t decode_utf16(TextEncoding encoding, bool crlf, uint32_t prev,
+                           const char *text, size_t length, bool last,
+                           char *dst) {
+    length &= ~(size_t)1;
+    size_t written = 0;
+    size_t i = 0;
+    while (i < length) {
+        // a \r or high surrogate before changes what the next unit means
+        if (prev != '\r' && !is_high_surrogate(prev)) {
+            size_t units =
+                decode_ascii_units(encoding, text + i, length - i, dst + written);
+            if (units) {
+                written += units;
+                i += units * 2;
+                prev = (uint8_t)dst[written - 1];
+                continue;
+            }
+        }
+
+        uint32_t unit = read_unit(encoding, text + i);
+        i += 2;
+        if (is_high_surrogate(prev) && !is_low_surrogate(unit)) {
+            written += put_utf8(REPLACEMENT_CHAR, dst + written);
+        }
+        if (crlf && prev == '\r' && unit != '\n') {
+            dst[written++] = '\r';
+        }
+        if (is_low_surrogate(unit)) {
+            uint32_t code_point =
+                is_high_surrogate(prev)
+                    ? 0x10000 + ((prev - 0xD800) << 10) + (unit - 0xDC00)
+                    : REPLACEMENT_CHAR;
+            written += put_utf8(code_point, dst + written);
+        } else if ((unit != '\r' || !crlf) && !is_high_surrogate(unit)) {
+            // \r waits for the unit after it in \r\n files
+            written += put_utf8(unit, dst + written);
+        }
+        prev = unit;
+    }
+    if (crlf && prev == '\r' && last) {
+        dst[written++] = '\r';
+    }
+    return written;
+}
+
+size_t decode_text(TextFormat format, uint32_t prev, const char *text,
+                   size_t length, bool last, char *dst) {
+    if (format.encoding == TEXT_UTF8) {
+        return decode_utf8(format.crlf, prev, text, length, last, dst);
+    }
+    return decode_utf16(format.encoding, format.crlf, prev, text, length, last,
+                        dst);
+}
+
+size_t encoded_capacity(size_t length) {
+    // \n becomes \r\n in two UTF-16 units
+    return 4 * length + 8;
+}
+
+static size_t put_unit(TextEncoding encoding, uint32_t unit, char *dst) {
+    if (encoding == TEXT_UTF16LE) {
+        dst[0] = unit & 0xFF;
+        dst[1] = unit >> 8;
+    } else {
+        dst[0] = unit >> 8;
+        dst[1] = unit & 0xFF;
+    }
+    return 2;
+}
+
+static size_t put_utf16(TextEncoding encoding, uint32_t code_point,
+                        char *dst) {
+    if (code_point < 0x10000) {
+        return put_unit(encoding, code_point, dst);
+    }
+    code_point -= 0x10000;
+    put_unit(encoding, 0xD800 + (code_point >> 10), dst);
+    put_unit(encoding, 0xDC00 + (code_point & 0x3FF), dst + 2);
+    return 4;
+}
+
+// Length of the UTF-8 sequence lead starts, 0 if it cannot start one
+static size_t sequence_length(uint8_t lead) {
+    if (lead < 0x80) {
+        return 1;
+    }
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        return 2;
+    }
+    if (lead >= 0xE0 && lead <= 0xEF) {
+        return 3;
+    }
+    if (lead >= 0xF0 && lead <= 0xF4) {
+        return 4;
+    }
+    return 0;
+}
+
+static uint32_t sequence_code_point(const uint8_t *sequence, size_t length) {
+    uint32_t code_point = sequence[0] & (0x7F >> length);
+    for (size_t i = 1; i < length; ++i) {
+        code_point = code_point << 6 | (sequence[i] & 0x3F);
+    }
+    return code_point;
+}
+
+static size_t encode_utf8(bool crlf, const char *text, size_t length,
+                          char *dst) {
+    if (!crlf) {
+        memcpy(dst, text, length);
+        return length;
+    }
+    size_t written = 0;
+    size_t i = 0;
+    while (i < length) {
+        const char *lf = memchr(text + i, '\n', length - i);
+        size_t run = (lf ? (size_t)(lf - text) : length) - i;
+        memcpy(dst + written, text + i, run);
+        written += run;
+        i += run;
+        if (lf) {
+            dst[written++] = '\r';
+            dst[written++] = '\n';
+            i++;
+        }
+    }
+    return written;
+}
+
+size_t encode_text(TextEncoder *encoder, const char *text, size_t length,
+                   char *dst) {
+    TextFormat format = encoder->format;
+    if (format.encoding == TEXT_UTF8) {
+        return encode_utf8(format.crlf, text, length, dst);
+    }
+
+    size_t written = 0;
+    for (size_t i = 0; i < length; ++i) {
+        uint8_t byte = text[i];
+        if (encoder->partial_length) {
+            if ((byte & 0xC0) == 0x80) {
+                encoder->partial[encoder->partial_length++] = byte;
+                if (encoder->partial_length ==
+                    sequence_length(encoder->partial[0])) {
+                    written += put_utf16(
+                        format.encoding,
+                        sequence_code_point(encoder->partial,
+                                            encoder->partial_length),
+                        dst + written);
+                    encoder->partial_length = 0;
+                }
+                continue;
+            }
+            // the sequence was cut short
+            written += put_utf16(format.encoding, REPLACEMENT_CHAR,
+                                 dst + written);
+            encoder->partial_length = 0;
+        }
+
+        size_t needed = sequence_length(byte);
+        if (needed == 1) {
+            if (byte == '\n' && format.crlf) {
+                written += put_unit(format.encoding, '\r', dst + written);
+            }
+            written += put_unit(format.encoding, byte, dst + written);
+        } else if (needed == 0) {
+            written += put_utf16(format.encoding, REPLACEMENT_CHAR,
+                                 dst + written);
+        } else {
+            encoder->partial[0] = byte;
+            encoder->partial_length = 1;
+        }
+    }
+    return written;
+}
+
+size_t encode_bom(TextFormat format, char *dst) {
+    if (!format.bom) {
+        return 0;
+    }
+    if (format.encoding == TEXT_UTF8) {
+        memcpy(dst, "\xEF\xBB\xBF", 3);
+        return 3;
+    }
+    return put_unit(format.encoding, 0xFEFF, dst);
+}
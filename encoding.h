@@ -0,0 +1,72 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes looked at to tell the format of a file
+#define FORMAT_SAMPLE_BYTES 4096
+
+typedef enum {
+    TEXT_UTF8,
+    TEXT_UTF16LE,
+    TEXT_UTF16BE,
+} TextEncoding;
+
+// How a file stores its text. Documents always hold UTF-8, with \n line
+// ends if the file used \r\n. The format is kept to write the file back
+// the way it was
+typedef struct {
+    TextEncoding encoding;
+    bool bom;
+    bool crlf; // every line looked at ended in \r\n
+} TextFormat;
+
+// Carries a UTF-8 sequence split between two calls to encode_text
+typedef struct {
+    TextFormat format;
+    uint8_t partial[4];
+    size_t partial_length;
+} TextEncoder;
+
+// Guesses the format from the start of a file
+TextFormat detect_text_format(const char *text, size_t length);
+
+// Bytes the byte order mark of format takes at the start of the file
+size_t bom_length(TextFormat format);
+
+// Bytes per code unit, ranges passed to decode_text start on a unit
+size_t unit_bytes(TextFormat format);
+
+// Last code unit of text, 0 if there is none
+uint32_t last_unit(TextFormat format, const char *text, size_t length);
+
+// True if text decodes to itself, so it can be used without a copy
+bool decodes_to_itself(TextFormat format, uint32_t prev, const char *text,
+                       size_t length, bool last);
+
+// Upper bound on the bytes decode_text writes for length bytes
+size_t decoded_capacity(size_t length);
+
+// Decodes text, which follows the code unit prev, to UTF-8 and returns the
+// bytes written to dst. In a crlf format \r\n becomes \n and a lone \r is
+// kept, other formats keep their line ends as they are. A \r ending text
+// is held back unless last is set, the next call writes it or drops it
+// from prev, so decoding a file piece by piece gives the same text as
+// decoding it at once
+size_t decode_text(TextFormat format, uint32_t prev, const char *text,
+                   size_t length, bool last, char *dst);
+
+// Upper bound on the bytes encode_text writes for length bytes
+size_t encoded_capacity(size_t length);
+
+// Encodes UTF-8 text with \n line ends back to the format of the encoder,
+// returns the bytes written to dst
+size_t encode_text(TextEncoder *encoder, const char *text, size_t length,
+                   char *dst);
+
+// Byte order mark of format written to dst, returns its length
+size_t encode_bom(TextFormat format, char *dst);
+
+#endif
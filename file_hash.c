@@ -0,0 +1,47 @@
+#include "file_hash.h"
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+FileHash start_file_hash() {
+    FileHash hash = {.length = 0};
+    for (size_t lane = 0; lane < FILE_HASH_LANES; ++lane) {
+        hash.lanes[lane] = FNV_OFFSET_BASIS;
+    }
+    return hash;
+}
+
+void update_file_hash(FileHash *hash, const char *bytes, size_t length) {
+    const uint8_t *at = (const uint8_t *)bytes;
+    // kept in locals, the byte loads could alias hash otherwise
+    uint64_t lanes[FILE_HASH_LANES];
+    memcpy(lanes, hash->lanes, sizeof(lanes));
+    size_t lane = hash->length % FILE_HASH_LANES;
+    size_t i = 0;
+    // up to the next byte of the first lane
+    for (; i < length && lane; ++i) {
+        lanes[lane] = (lanes[lane] ^ at[i]) * FNV_PRIME;
+        lane = (lane + 1) % FILE_HASH_LANES;
+    }
+    for (; i + FILE_HASH_LANES <= length; i += FILE_HASH_LANES) {
+        for (size_t k = 0; k < FILE_HASH_LANES; ++k) {
+            lanes[k] = (lanes[k] ^ at[i + k]) * FNV_PRIME;
+        }
+    }
+    for (; i < length; ++i) {
+        lanes[lane] = (lanes[lane] ^ at[i]) * FNV_PRIME;
+        lane++;
+    }
+    memcpy(hash->lanes, lanes, sizeof(lanes));
+    hash->length += length;
+}
+
+bool same_file_hash(const FileHash *a, const FileHash *b) {
+    for (size_t lane = 0; lane < FILE_HASH_LANES; ++lane) {
+        if (a->lanes[lane] != b->lanes[lane]) {
+            return false;
+        }
+    }
+    return a->length == b->length;
+}
@@ -0,0 +1,27 @@
+#ifndef FILE_HASH_H
+#define FILE_HASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// FNV-1a runs over this many lanes, every byte goes to the lane of its
+// position so the multiplies overlap and the hash does not depend on how
+// the file was split into reads
+#define FILE_HASH_LANES 8
+
+// Hash of the first length bytes of a file
+typedef struct {
+    uint64_t lanes[FILE_HASH_LANES];
+    uint64_t length;
+} FileHash;
+
+// Hash of no bytes
+FileHash start_file_hash();
+
+// Adds the length bytes that follow what hash covers so far
+void update_file_hash(FileHash *hash, const char *bytes, size_t length);
+
+bool same_file_hash(const FileHash *a, const FileHash *b);
+
+#endif
@@ -0,0 +1,76 @@
+#include "font_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+FontCache *create_font_cache(Renderer *renderer, const char *path) {
+    FontCache *cache = calloc(1, sizeof(FontCache));
+    if (!cache) {
+        perror("Failed to allocate font cache");
+        return nullptr;
+    }
+    cache->renderer = renderer;
+    cache->path = strdup(path);
+    return cache;
+}
+
+static void free_instance(FontCache *cache, FontInstance *instance) {
+    // frames drawn before the font goes may still use the glyph cache
+    cache->renderer->free_font(cache->renderer, instance->font);
+    free_glyph_cache(instance->glyph_cache);
+    instance->font = nullptr;
+    instance->glyph_cache = nullptr;
+}
+
+FontInstance *get_font(FontCache *cache, uint32_t size) {
+    cache->clock++;
+    for (size_t i = 0; i < cache->count; ++i) {
+        if (cache->instances[i].font->size == size) {
+            cache->instances[i].last_used = cache->clock;
+            return &cache->instances[i];
+        }
+    }
+
+    RnFont *font =
+        cache->renderer->load_font(cache->renderer, cache->path, size);
+    if (!font) {
+        return nullptr;
+    }
+
+    FontInstance *instance;
+    if (cache->count < FONT_CACHE_CAPACITY) {
+        instance = &cache->instances[cache->count++];
+    } else {
+        // the font in use was just touched, so it is never the one evicted
+        instance = &cache->instances[0];
+        for (size_t i = 1; i < cache->count; ++i) {
+            if (cache->instances[i].last_used < instance->last_used) {
+                instance = &cache->instances[i];
+            }
+        }
+        free_instance(cache, instance);
+    }
+    instance->font = font;
+    instance->glyph_cache = create_glyph_cache(font);
+    instance->last_used = cache->clock;
+    return instance;
+}
+
+size_t font_cache_bytes(const FontCache *cache) {
+    size_t bytes = sizeof(FontCache);
+    for (size_t i = 0; i < cache->count; ++i) {
+        bytes += glyph_cache_bytes(cache->instances[i].glyph_cache);
+    }
+    return bytes;
+}
+
+void free_font_cache(FontCache *cache) {
+    if (!cache) {
+        return;
+    }
+    for (size_t i = 0; i < cache->count; ++i) {
+        free_instance(cache, &cache->instances[i]);
+    }
+    free(cache->path);
+    free(cache);
+}
@@ -0,0 +1,39 @@
+#ifndef FONT_CACHE_H
+#define FONT_CACHE_H
+
+#include "glyph_cache.h"
+#include "renderer.h"
+#include <runara/runara.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sizes kept loaded at once, zooming back to one of them is free
+#define FONT_CACHE_CAPACITY 4
+
+// One loaded size of the font together with its glyphs
+typedef struct {
+    RnFont *font;
+    GlyphCache *glyph_cache;
+    uint64_t last_used;
+} FontInstance;
+
+typedef struct {
+    Renderer *renderer; // backend loading and freeing the fonts
+    char *path;
+    FontInstance instances[FONT_CACHE_CAPACITY];
+    size_t count;
+    uint64_t clock;
+} FontCache;
+
+[[nodiscard]]
+FontCache *create_font_cache(Renderer *renderer, const char *path);
+
+// Instance of size, loaded on a miss in place of the least recently used
+FontInstance *get_font(FontCache *cache, uint32_t size);
+
+// Bytes of the glyph caches of every loaded size, faces are runara's
+size_t font_cache_bytes(const FontCache *cache);
+
+void free_font_cache(FontCache *cache);
+
+#endif
@@ -0,0 +1,67 @@
+#include "glyph_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GLYPH_SLOTS_INITIAL 256
+
+GlyphCache *create_glyph_cache(RnFont *font) {
+    GlyphCache *cache = malloc(sizeof(GlyphCache));
+    if (!cache) {
+        perror("Failed to allocate glyph cache");
+        return nullptr;
+    }
+    cache->font_id = font->id;
+    cache->font_size = font->size;
+    cache->monospace = FT_IS_FIXED_WIDTH(font->face);
+    for (uint32_t c = 0; c < GLYPH_ASCII_COUNT; ++c) {
+        cache->ascii_index[c] = FT_Get_Char_Index(font->face, c);
+        cache->ascii_loaded[c] = false;
+    }
+    cache->slot_count = GLYPH_SLOTS_INITIAL;
+    cache->slots = calloc(cache->slot_count, sizeof(GlyphSlot));
+    cache->used = 0;
+    return cache;
+}
+
+size_t glyph_cache_bytes(const GlyphCache *cache) {
+    if (!cache) {
+        return 0;
+    }
+    return sizeof(GlyphCache) + cache->slot_count * sizeof(GlyphSlot);
+}
+
+void free_glyph_cache(GlyphCache *cache) {
+    if (!cache) {
+        return;
+    }
+    free(cache->slots);
+    free(cache);
+}
+
+uint32_t utf8_decode(const char *text, size_t length, size_t *bytes) {
+    const unsigned char *s = (const unsigned char *)text;
+    if (length == 0) {
+        *bytes = 0;
+        return 0;
+    }
+    if (s[0] < 0x80) {
+        *bytes = 1;
+        return s[0];
+    }
+    size_t count = (s[0] & 0xE0) == 0xC0   ? 2
+                   : (s[0] & 0xF0) == 0xE0 ? 3
+                   : (s[0] & 0xF8) == 0xF0 ? 4
+                                           : 1;
+    if (count == 1 || count > length) {
+        // invalid or truncated sequence, skip a single byte
+        *bytes = 1;
+        return 0xFFFD;
+    }
+    uint32_t codepoint = s[0] & (0x7F >> count);
+    for (size_t i = 1; i < count; ++i) {
+        codepoint = (codepoint << 6) | (s[i] & 0x3F);
+    }
+    *bytes = count;
+    return codepoint;
+}
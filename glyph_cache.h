@@ -0,0 +1,44 @@
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <runara/runara.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GLYPH_ASCII_COUNT 128
+
+typedef struct {
+    uint32_t glyph_index;
+    bool used;
+    RnGlyph glyph;
+} GlyphSlot;
+
+// Glyphs of one font instance, looked up without runara's linear search.
+// The GL backend rasterizes into it, layout only reads the ASCII indices
+typedef struct {
+    uint64_t font_id;
+    uint32_t font_size;
+    bool monospace; // every glyph advances by the same width
+    // direct table for ASCII codepoints
+    uint32_t ascii_index[GLYPH_ASCII_COUNT];
+    bool ascii_loaded[GLYPH_ASCII_COUNT];
+    RnGlyph ascii[GLYPH_ASCII_COUNT];
+    // open addressing on harfbuzz glyph index for everything else
+    GlyphSlot *slots;
+    size_t slot_count;
+    size_t used;
+} GlyphCache;
+
+[[nodiscard]]
+GlyphCache *create_glyph_cache(RnFont *font);
+
+// Bytes of the lookup tables, the glyph bitmaps live in runara's atlas
+size_t glyph_cache_bytes(const GlyphCache *cache);
+
+void free_glyph_cache(GlyphCache *cache);
+
+// Decodes the codepoint at text, stores its size in bytes
+uint32_t utf8_decode(const char *text, size_t length, size_t *bytes);
+
+#endif
@@ -0,0 +1,383 @@
+#include "highlight.h"
+#include "column_cache.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const keywords[] = {
+    "alignas",  "alignof",   "auto",          "break",    "case",
+    "const",    "constexpr", "continue",      "default",  "do",
+    "else",     "enum",      "extern",        "false",    "for",
+    "goto",     "if",        "inline",        "nullptr",  "register",
+    "restrict", "return",    "sizeof",        "static",   "static_assert",
+    "struct",   "switch",    "thread_local",  "true",     "typedef",
+    "typeof",   "union",     "volatile",      "while",
+};
+
+static const char *const types[] = {
+    "bool",     "char",     "double",   "float",     "int",
+    "int8_t",   "int16_t",  "int32_t",  "int64_t",   "long",
+    "short",    "signed",   "size_t",   "ssize_t",   "uint8_t",
+    "uint16_t", "uint32_t", "uint64_t", "uintptr_t", "unsigned",
+    "void",
+};
+
+// Extensions of the files the C tables fit
+static const char *const c_extensions[] = {
+    ".c", ".h", ".cc", ".cpp", ".cxx", ".hh", ".hpp", ".hxx", ".inl",
+};
+
+bool highlights_path(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(slash ? slash : path, '.');
+    if (!dot) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(c_extensions) / sizeof(*c_extensions);
+         ++i) {
+        if (!strcmp(dot, c_extensions[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+HighlightIndex *create_highlight_index() {
+    HighlightIndex *hl = calloc(1, sizeof(HighlightIndex));
+    if (!hl) {
+        perror("Failed to allocate highlight index");
+        return nullptr;
+    }
+    return hl;
+}
+
+void free_highlight_index(HighlightIndex *hl) {
+    if (!hl) {
+        return;
+    }
+    free(hl->end_state);
+    free(hl->spans);
+    free(hl->text);
+    free(hl);
+}
+
+static void reserve_highlight_lines(HighlightIndex *hl, size_t line_num) {
+    if (line_num <= hl->capacity) {
+        return;
+    }
+    size_t new_cap = hl->capacity ? hl->capacity : 64;
+    while (new_cap < line_num) {
+        new_cap *= 2;
+    }
+    hl->end_state = realloc(hl->end_state, new_cap * sizeof(LexState));
+    hl->capacity = new_cap;
+}
+
+void reset_highlight_lines(HighlightIndex *hl, size_t line_num) {
+    reserve_highlight_lines(hl, line_num);
+    memset(hl->end_state, LEX_UNKNOWN, line_num * sizeof(LexState));
+    hl->line_num = line_num;
+    hl->valid = 0;
+    hl->known = 0;
+}
+
+void invalidate_highlight_line(HighlightIndex *hl, size_t line) {
+    if (line >= hl->line_num) {
+        return;
+    }
+    if (line < hl->valid) {
+        hl->known = hl->valid;
+        hl->valid = line;
+    } else if (line < hl->known) {
+        hl->known = line;
+    }
+}
+
+void insert_highlight_lines(HighlightIndex *hl, size_t at, size_t count) {
+    if (at == 0 || at > hl->line_num) {
+        return; // not built yet, the next frame resets it
+    }
+    reserve_highlight_lines(hl, hl->line_num + count);
+    // The lines below now follow the last inserted line
+    LexState split_end = hl->end_state[at - 1];
+    memmove(&hl->end_state[at + count], &hl->end_state[at],
+            (hl->line_num - at) * sizeof(LexState));
+    memset(&hl->end_state[at - 1], LEX_UNKNOWN, count * sizeof(LexState));
+    hl->end_state[at + count - 1] = split_end;
+    hl->line_num += count;
+
+    if (hl->valid >= at) {
+        hl->valid += count;
+    }
+    if (hl->known >= at) {
+        hl->known += count;
+    }
+    invalidate_highlight_line(hl, at - 1);
+}
+
+void delete_highlight_lines(HighlightIndex *hl, size_t at, size_t count) {
+    if (at == 0 || at + count > hl->line_num) {
+        return;
+    }
+    // The joined line ends where the last deleted one did
+    hl->end_state[at - 1] = hl->end_state[at + count - 1];
+    memmove(&hl->end_state[at], &hl->end_state[at + count],
+            (hl->line_num - at - count) * sizeof(LexState));
+    hl->line_num -= count;
+
+    if (hl->valid > at) {
+        hl->valid = hl->valid - count > at ? hl->valid - count : at;
+    }
+    if (hl->known > at) {
+        hl->known = hl->known - count > at ? hl->known - count : at;
+    }
+    invalidate_highlight_line(hl, at - 1);
+}
+
+LexState line_start_state(HighlightIndex *hl, size_t line) {
+    if (line == 0 || line > hl->valid) {
+        return LEX_NORMAL;
+    }
+    return hl->end_state[line - 1];
+}
+
+static void add_span(HighlightIndex *hl, size_t start, size_t end,
+                     TokenKind kind) {
+    if (end <= start) {
+        return;
+    }
+    if (hl->span_count) {
+        TokenSpan *last = &hl->spans[hl->span_count - 1];
+        if (last->kind == kind && last->start + last->length == start) {
+            last->length += end - start;
+            return;
+        }
+    }
+    if (hl->span_count == hl->span_capacity) {
+        size_t new_cap = hl->span_capacity ? hl->span_capacity * 2 : 64;
+        TokenSpan *grown = realloc(hl->spans, new_cap * sizeof(TokenSpan));
+        if (!grown) {
+            return;
+        }
+        hl->spans = grown;
+        hl->span_capacity = new_cap;
+    }
+    hl->spans[hl->span_count++] = (TokenSpan){start, end - start, kind};
+}
+
+static bool is_ident_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static bool is_word_in(const char *const *list, size_t count, const char *word,
+                       size_t length) {
+    for (size_t i = 0; i < count; ++i) {
+        if (strlen(list[i]) == length && !memcmp(list[i], word, length)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Index after the closing */, or length if the comment does not end here
+static size_t skip_comment(const char *text, size_t length, size_t i,
+                           bool *closed) {
+    for (; i + 1 < length; ++i) {
+        if (text[i] == '*' && text[i + 1] == '/') {
+            *closed = true;
+            return i + 2;
+        }
+    }
+    *closed = false;
+    return length;
+}
+
+// Index after the closing quote, continued is set if the line ends in an
+// escaped new line
+static size_t skip_quoted(const char *text, size_t length, size_t i,
+                          char quote, bool *continued) {
+    *continued = false;
+    while (i < length) {
+        if (text[i] == '\\') {
+            if (i + 1 == length) {
+                *continued = true;
+                return length;
+            }
+            i += 2;
+            continue;
+        }
+        if (text[i++] == quote) {
+            return i;
+        }
+    }
+    return length;
+}
+
+// C like lexer, spans are only collected if record is set
+static LexState lex(HighlightIndex *hl, LexState state, const char *text,
+                    size_t length, bool record) {
+    hl->span_count = 0;
+    size_t i = 0;
+    if (state == LEX_COMMENT) {
+        bool closed;
+        i = skip_comment(text, length, 0, &closed);
+        if (record) {
+            add_span(hl, 0, i, TOKEN_COMMENT);
+        }
+        if (!closed) {
+            return LEX_COMMENT;
+        }
+    } else if (state == LEX_STRING) {
+        bool continued;
+        i = skip_quoted(text, length, 0, '"', &continued);
+        if (record) {
+            add_span(hl, 0, i, TOKEN_STRING);
+        }
+        if (continued) {
+            return LEX_STRING;
+        }
+    }
+
+    // '#' only starts a directive before anything else on the line
+    bool line_start = state == LEX_NORMAL;
+    while (i < length) {
+        size_t start = i;
+        char c = text[i];
+        char next = i + 1 < length ? text[i + 1] : '\0';
+        TokenKind kind = TOKEN_TEXT;
+
+        if (c == '/' && next == '/') {
+            i = length;
+            kind = TOKEN_COMMENT;
+        } else if (c == '/' && next == '*') {
+            bool closed;
+            i = skip_comment(text, length, i + 2, &closed);
+            if (!closed) {
+                if (record) {
+                    add_span(hl, start, i, TOKEN_COMMENT);
+                }
+                return LEX_COMMENT;
+            }
+            kind = TOKEN_COMMENT;
+        } else if (c == '"' || c == '\'') {
+            bool continued;
+            i = skip_quoted(text, length, i + 1, c, &continued);
+            kind = TOKEN_STRING;
+            if (continued && c == '"') {
+                if (record) {
+                    add_span(hl, start, i, TOKEN_STRING);
+                }
+                return LEX_STRING;
+            }
+        } else if (c == '#' && line_start) {
+            i++;
+            while (i < length && (text[i] == ' ' || text[i] == '\t')) {
+                i++;
+            }
+            size_t word = i;
+            while (i < length && is_ident_char(text[i])) {
+                i++;
+            }
+            kind = TOKEN_PREPROCESSOR;
+            // <header> of an include reads as a string
+            if (record && i - word == 7 && !memcmp(text + word, "include", 7)) {
+                add_span(hl, start, i, kind);
+                start = i;
+                while (i < length && text[i] == ' ') {
+                    i++;
+                }
+                if (i < length && text[i] == '<') {
+                    add_span(hl, start, i, TOKEN_TEXT);
+                    start = i;
+                    while (i < length && text[i++] != '>') {
+                    }
+                    kind = TOKEN_STRING;
+                } else {
+                    kind = TOKEN_TEXT;
+                }
+            }
+        } else if (isdigit((unsigned char)c) ||
+                   (c == '.' && isdigit((unsigned char)next))) {
+            i++;
+            while (i < length && (is_ident_char(text[i]) || text[i] == '.')) {
+                i++;
+            }
+            kind = TOKEN_NUMBER;
+        } else if (is_ident_char(c)) {
+            while (i < length && is_ident_char(text[i])) {
+                i++;
+            }
+            if (record) {
+                if (is_word_in(keywords, sizeof(keywords) / sizeof(*keywords),
+                               text + start, i - start)) {
+                    kind = TOKEN_KEYWORD;
+                } else if (is_word_in(types, sizeof(types) / sizeof(*types),
+                                      text + start, i - start)) {
+                    kind = TOKEN_TYPE;
+                }
+            }
+        } else {
+            i++;
+        }
+
+        if (c != ' ' && c != '\t') {
+            line_start = false;
+        }
+        if (record) {
+            add_span(hl, start, i, kind);
+        }
+    }
+    return LEX_NORMAL;
+}
+
+LexState tokenize_line(HighlightIndex *hl, LexState state, const char *text,
+                       size_t length) {
+    return lex(hl, state, text, length, true);
+}
+
+bool lex_until(HighlightIndex *hl, RopeTree *tree, LineIndex *index,
+               size_t line, size_t budget) {
+    line = line < hl->line_num ? line : hl->line_num;
+    for (size_t n = 0; hl->valid < line; ++n) {
+        if (n == budget) {
+            return false;
+        }
+        size_t current = hl->valid;
+        LexState state = line_start_state(hl, current);
+        LexState end = state;
+
+        // Huge lines are passed through instead of being copied out
+        size_t start = get_line_offset(index, current);
+        size_t length = get_line_length(index, current);
+        if (length <= LONG_LINE_BYTES) {
+            if (length > hl->text_capacity) {
+                char *grown = realloc(hl->text, length);
+                if (!grown) {
+                    return false;
+                }
+                hl->text = grown;
+                hl->text_capacity = length;
+            }
+            if (copy_range(tree->root, start, length, hl->text) < length) {
+                return false;
+            }
+            if (length && hl->text[length - 1] == '\n') {
+                length--;
+            }
+            end = lex(hl, state, hl->text, length, false);
+        }
+
+        if (end == hl->end_state[current] && current + 1 < hl->known) {
+            // Ends as before the edit, so do all the lines after it
+            hl->valid = hl->known;
+        } else {
+            hl->end_state[current] = end;
+            hl->valid = current + 1;
+            if (hl->known < hl->valid) {
+                hl->known = hl->valid;
+            }
+        }
+    }
+    return true;
+}
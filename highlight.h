@@ -0,0 +1,92 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include "cursor.h"
+#include "rope.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lexer state carried from the end of one line to the next
+typedef uint8_t LexState;
+#define LEX_NORMAL 0
+#define LEX_COMMENT 1 // inside /* */
+#define LEX_STRING 2  // string continued with a backslash
+#define LEX_UNKNOWN 0xFF
+
+// Lines lexed synchronously ahead of the viewport before falling back to
+// lexing the viewport from a guessed state
+#define HIGHLIGHT_EAGER_LINES 4096
+
+// Lines lexed per call while the editor is idle
+#define HIGHLIGHT_IDLE_LINES 2048
+
+typedef enum {
+    TOKEN_TEXT,
+    TOKEN_KEYWORD,
+    TOKEN_TYPE,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_COMMENT,
+    TOKEN_PREPROCESSOR,
+    TOKEN_COUNT
+} TokenKind;
+
+typedef struct {
+    uint32_t start;
+    uint32_t length;
+    TokenKind kind;
+} TokenSpan;
+
+// End of line lexer states of the document, kept valid from the top down
+typedef struct {
+    bool enabled;
+    LexState *end_state;
+    size_t line_num;
+    size_t capacity;
+    size_t valid; // lines before valid have their final end state
+    // lines in [valid, known) are still right if the line at valid ends in
+    // the same state as before the edit
+    size_t known;
+    // spans of the last tokenized line
+    TokenSpan *spans;
+    size_t span_count;
+    size_t span_capacity;
+    char *text; // line copied out of the rope while lexing
+    size_t text_capacity;
+} HighlightIndex;
+
+// True if the file at path is C or C++ by its extension, the only language
+// the lexer knows
+bool highlights_path(const char *path);
+
+// Disabled until a document of a highlighted language is loaded
+[[nodiscard]]
+HighlightIndex *create_highlight_index();
+
+void free_highlight_index(HighlightIndex *hl);
+
+// Forgets every line, used after loads and undo
+void reset_highlight_lines(HighlightIndex *hl, size_t line_num);
+
+// Lines inserted at at after the line before them was split
+void insert_highlight_lines(HighlightIndex *hl, size_t at, size_t count);
+
+// Lines deleted at at after being joined into the line before them
+void delete_highlight_lines(HighlightIndex *hl, size_t at, size_t count);
+
+void invalidate_highlight_line(HighlightIndex *hl, size_t line);
+
+// State the line starts in, LEX_NORMAL if the lines above are not lexed
+LexState line_start_state(HighlightIndex *hl, size_t line);
+
+// Lexes from the first invalid line until every line before line is valid
+// or budget lines were lexed, returns true if line was reached
+bool lex_until(HighlightIndex *hl, RopeTree *tree, LineIndex *index,
+               size_t line, size_t budget);
+
+// Splits a line into hl->spans and returns the state it ends in
+LexState tokenize_line(HighlightIndex *hl, LexState state, const char *text,
+                       size_t length);
+
+#endif
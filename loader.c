@@ -0,0 +1,337 @@
+#include "loader.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Lazy leaves are cut per page, so blocks have to start on page boundaries
+static_assert(LOAD_FIRST_BLOCK_BYTES % FILE_PAGE_BYTES == 0);
+
+// Lazy leaves for the pages of one block, the text itself is not kept.
+// Pages are decoded one by one the way page_in decodes them, so every leaf
+// is as long as its page will be. Their lengths and new lines go into the
+// page table, the line index counts whole pages from it. false if the
+// leaves cannot be allocated
+static bool build_lazy_block(FileLoader *loader, size_t offset,
+                             const char *raw, size_t length, uint32_t prev,
+                             Node **root, size_t *text_length) {
+    *text_length = 0;
+    size_t count = (length + FILE_PAGE_BYTES - 1) / FILE_PAGE_BYTES;
+    Node **leaves = malloc(count * sizeof(Node *));
+    char *text = malloc(decoded_capacity(FILE_PAGE_BYTES));
+    if (!leaves || !text) {
+        perror("Failed to allocate lazy leaves");
+        free(leaves);
+        free(text);
+        return false;
+    }
+    size_t leaf_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t start = i * FILE_PAGE_BYTES;
+        size_t page_length = MIN(FILE_PAGE_BYTES, length - start);
+        size_t skip = offset + start ? 0 : bom_length(loader->format);
+        bool last = offset + start + page_length == loader->file_size;
+        size_t decoded = decode_text(loader->format, prev, raw + start + skip,
+                                     page_length - skip, last, text);
+        prev = last_unit(loader->format, raw + start, page_length);
+        if (decoded) {
+            size_t page = (offset + start) / FILE_PAGE_BYTES;
+            leaves[leaf_count++] = create_lazy_leaf(
+                loader->paged, page * FILE_PAGE_SPAN, decoded);
+            // every page is written by this thread only, the editor reads
+            // it once the block is drained under the lock
+            PageLines *lines = &loader->paged->page_lines[page];
+            lines->length = decoded;
+            lines->newlines = 0;
+            for (const char *at = text;
+                 (at = memchr(at, '\n', text + decoded - at)); ++at) {
+                lines->newlines++;
+            }
+        }
+        *text_length += decoded;
+    }
+    *root = leaf_count ? build_balanced(leaves, 0, leaf_count - 1) : nullptr;
+    free(leaves);
+    free(text);
+    return true;
+}
+
+// Decodes a block read into raw, the returned text may be raw itself
+static char *decode_block(FileLoader *loader, size_t offset, char *raw,
+                          size_t length, uint32_t prev, size_t *text_length) {
+    size_t skip = offset ? 0 : bom_length(loader->format);
+    bool last = offset + length == loader->file_size;
+    if (decodes_to_itself(loader->format, prev, raw + skip, length - skip,
+                          last)) {
+        memmove(raw, raw + skip, length - skip);
+        *text_length = length - skip;
+        return raw;
+    }
+    char *text = malloc(decoded_capacity(length));
+    if (text) {
+        *text_length = decode_text(loader->format, prev, raw + skip,
+                                   length - skip, last, text);
+    }
+    return text;
+}
+
+static void *load_blocks(void *arg) {
+    FileLoader *loader = arg;
+    size_t block_size = LOAD_FIRST_BLOCK_BYTES;
+    size_t offset = 0;
+    uint32_t prev = 0;
+    while (!atomic_load(&loader->cancel) && offset < loader->file_size) {
+        char *raw = malloc(block_size);
+        LoadBlock *block = malloc(sizeof(LoadBlock));
+        if (!raw || !block) {
+            perror("Failed to allocate load block");
+            free(raw);
+            free(block);
+            break;
+        }
+        // stop at the size the file had when it was opened, the pages of a
+        // lazy file end there
+        size_t wanted = MIN(block_size, loader->file_size - offset);
+        size_t length = fread(raw, 1, wanted, loader->fp);
+        if (length == 0) {
+            if (ferror(loader->fp)) {
+                perror("Failed to read file");
+            }
+            free(raw);
+            free(block);
+            break;
+        }
+
+        update_file_hash(&loader->hash, raw, length);
+
+        // The subtree is built here so the editor thread only links it in
+        // Lazy blocks keep no text, their leaves are indexed page by page
+        char *text = nullptr;
+        size_t text_length;
+        bool built;
+        if (loader->paged) {
+            built = build_lazy_block(loader, offset, raw, length, prev,
+                                     &block->root, &text_length);
+        } else {
+            text = decode_block(loader, offset, raw, length, prev,
+                                &text_length);
+            block->root =
+                text ? build_node_from_text(text, text_length) : nullptr;
+            built = text;
+        }
+        prev = last_unit(loader->format, raw, length);
+        if (text != raw) {
+            free(raw);
+        }
+        if (!built) {
+            perror("Failed to decode load block");
+            free(block);
+            break;
+        }
+        block->text = text;
+        block->length = text_length;
+        block->height = calc_tree_height(block->root);
+        block->nodes_count = count_nodes(block->root);
+        block->next = nullptr;
+
+        pthread_mutex_lock(&loader->lock);
+        if (loader->last) {
+            loader->last->next = block;
+        } else {
+            loader->first = block;
+        }
+        loader->last = block;
+        loader->queued += text_length;
+        // wait for the editor to catch up instead of holding the whole file
+        while (loader->queued > LOAD_QUEUE_BYTES &&
+               !atomic_load(&loader->cancel)) {
+            pthread_cond_wait(&loader->drained, &loader->lock);
+        }
+        pthread_mutex_unlock(&loader->lock);
+        atomic_fetch_add(&loader->read, length);
+        offset += length;
+        block_size = MIN(block_size * 2, LOAD_BLOCK_BYTES);
+    }
+
+    pthread_mutex_lock(&loader->lock);
+    loader->finished = true;
+    pthread_mutex_unlock(&loader->lock);
+    return nullptr;
+}
+
+FileLoader *start_file_loader(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("Failed to open file");
+        return nullptr;
+    }
+    FileLoader *loader = calloc(1, sizeof(FileLoader));
+    if (!loader) {
+        perror("Failed to allocate file loader");
+        fclose(fp);
+        return nullptr;
+    }
+    char sample[FORMAT_SAMPLE_BYTES];
+    size_t sampled = fread(sample, 1, sizeof(sample), fp);
+    loader->format = detect_text_format(sample, sampled);
+    fseek(fp, 0, SEEK_END);
+    loader->file_size = ftell(fp);
+    rewind(fp);
+    loader->fp = fp;
+    loader->hash = start_file_hash();
+    if (loader->file_size >= LAZY_FILE_BYTES) {
+        loader->paged = open_paged_file(path);
+        if (loader->paged) {
+            loader->paged->format = loader->format;
+        }
+    }
+    pthread_mutex_init(&loader->lock, nullptr);
+    pthread_cond_init(&loader->drained, nullptr);
+
+    int error = pthread_create(&loader->thread, nullptr, load_blocks, loader);
+    if (error) {
+        fprintf(stderr, "Failed to start file loader: %s\n", strerror(error));
+        release_paged_file(loader->paged);
+        pthread_cond_destroy(&loader->drained);
+        pthread_mutex_destroy(&loader->lock);
+        fclose(fp);
+        free(loader);
+        return nullptr;
+    }
+    return loader;
+}
+
+static void record_root(FileLoader *loader, Node *root, uint32_t height) {
+    if (loader->root_count == loader->root_capacity) {
+        size_t new_cap =
+            loader->root_capacity ? loader->root_capacity * 2 : 64;
+        Node **grown = realloc(loader->roots, new_cap * sizeof(Node *));
+        if (!grown) {
+            perror("Failed to allocate loaded blocks");
+            loader->unbalanced = true;
+            return;
+        }
+        loader->roots = grown;
+        loader->root_capacity = new_cap;
+    }
+    loader->roots[loader->root_count++] = root;
+    loader->max_height = MAX(loader->max_height, height);
+}
+
+static void add_block(FileLoader *loader, RopeTree *tree, LineIndex *index,
+                      LoadBlock *block) {
+    if (!block->root) {
+        return; // nothing but a byte order mark or half a pair
+    }
+    record_root(loader, block->root, block->height);
+
+    if (block->text) {
+        insert_text_to_index(index, tree->length, block->text, block->length);
+    } else {
+        index_leaves(index, block->root);
+    }
+    if (tree->root) {
+        tree->root = concat(tree->root, block->root);
+        tree->nodes_count += block->nodes_count + 1;
+        tree->height = MAX(tree->height, block->height) + 1;
+    } else {
+        tree->root = block->root;
+        tree->nodes_count = block->nodes_count;
+        tree->height = block->height;
+    }
+    tree->length += block->length;
+}
+
+// Blocks were chained one after another while loading, pair them up once
+// the last one is in
+static void balance_blocks(FileLoader *loader, RopeTree *tree) {
+    size_t count = loader->root_count;
+    if (count < 2 || loader->unbalanced) {
+        return;
+    }
+    Node *node = tree->root;
+    for (size_t i = 1; i < count; ++i) {
+        Node *left = node->left;
+        free_node(node);
+        node = left;
+    }
+    tree->root = build_balanced(loader->roots, 0, count - 1);
+
+    uint32_t levels = 0;
+    while ((size_t)1 << levels < count) {
+        levels++;
+    }
+    tree->height = loader->max_height + levels;
+}
+
+bool drain_file_loader(FileLoader *loader, RopeTree *tree, LineIndex *index) {
+    pthread_mutex_lock(&loader->lock);
+    LoadBlock *blocks = loader->first;
+    LoadBlock *last = nullptr;
+    LoadBlock *block = loader->first;
+    size_t taken = 0;
+    while (block && taken < LOAD_DRAIN_BYTES) {
+        taken += block->length;
+        last = block;
+        block = block->next;
+    }
+    if (last) {
+        last->next = nullptr;
+    }
+    loader->first = block;
+    if (!block) {
+        loader->last = nullptr;
+    }
+    loader->queued -= taken;
+    pthread_cond_signal(&loader->drained);
+    bool finished = loader->finished && !loader->first;
+    pthread_mutex_unlock(&loader->lock);
+
+    while (blocks) {
+        LoadBlock *next = blocks->next;
+        add_block(loader, tree, index, blocks);
+        free(blocks->text);
+        free(blocks);
+        blocks = next;
+    }
+    if (finished) {
+        balance_blocks(loader, tree);
+    }
+    return finished;
+}
+
+void cancel_file_loader(FileLoader *loader) {
+    pthread_mutex_lock(&loader->lock);
+    atomic_store(&loader->cancel, true);
+    pthread_cond_signal(&loader->drained);
+    pthread_mutex_unlock(&loader->lock);
+}
+
+float file_loader_progress(FileLoader *loader) {
+    if (loader->file_size == 0) {
+        return 1;
+    }
+    return (float)atomic_load(&loader->read) / loader->file_size;
+}
+
+void free_file_loader(FileLoader *loader) {
+    if (!loader) {
+        return;
+    }
+    cancel_file_loader(loader);
+    pthread_join(loader->thread, nullptr);
+    LoadBlock *block = loader->first;
+    while (block) {
+        LoadBlock *next = block->next;
+        free_tree(block->root);
+        free(block->text);
+        free(block);
+        block = next;
+    }
+    release_paged_file(loader->paged);
+    pthread_cond_destroy(&loader->drained);
+    pthread_mutex_destroy(&loader->lock);
+    fclose(loader->fp);
+    free(loader->roots);
+    free(loader);
+}
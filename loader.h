@@ -0,0 +1,86 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "cursor.h"
+#include "encoding.h"
+#include "file_hash.h"
+#include "paged_file.h"
+#include "rope.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bytes read and turned into a subtree at a time by the worker, the first
+// block is small so the first screen shows up quickly and later ones grow
+// up to the largest size
+#define LOAD_FIRST_BLOCK_BYTES (64 << 10)
+#define LOAD_BLOCK_BYTES (4 << 20)
+
+// Bytes added to the document per drain, bounds the time taken per frame
+#define LOAD_DRAIN_BYTES (8 << 20)
+
+// Bytes read ahead of the editor before the worker waits for a drain
+#define LOAD_QUEUE_BYTES (32 << 20)
+
+// Files from this size on are paged in while looked at instead of being
+// read into memory, only the new lines of every page are counted up front
+#define LAZY_FILE_BYTES (256 << 20)
+
+typedef struct LoadBlock LoadBlock;
+
+// Block read by the worker, waiting to be added to the document
+struct LoadBlock {
+    Node *root;
+    char *text; // decoded, kept until the block is indexed, nullptr for
+                // lazy blocks
+    size_t length; // of the decoded text
+    uint32_t height;
+    uint32_t nodes_count;
+    LoadBlock *next;
+};
+
+// Reads a file on a worker thread while the editor keeps drawing what has
+// arrived so far
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t drained; // signalled when the queue shrinks
+    FILE *fp;
+    size_t file_size;
+    TextFormat format; // blocks are decoded from it as they are read
+    PagedFile *paged; // lazy leaves point into it, nullptr for small files
+    atomic_size_t read; // bytes read by the worker
+    atomic_bool cancel;
+    FileHash hash; // of the bytes read, owned by the worker until finished
+    // guarded by lock
+    LoadBlock *first;
+    LoadBlock *last;
+    size_t queued; // bytes waiting in blocks
+    bool finished; // worker is done, no more blocks will arrive
+    // owned by the editor thread
+    Node **roots; // subtree of every block added to the document
+    size_t root_count;
+    size_t root_capacity;
+    uint32_t max_height;
+    bool unbalanced; // a root could not be recorded, the chain is kept
+} FileLoader;
+
+// Starts reading path into the background, nullptr if it cannot be opened
+[[nodiscard]]
+FileLoader *start_file_loader(const char *path);
+
+// Adds the blocks read so far to the end of tree and index, returns true
+// once the whole file (or everything before a cancel) is in
+bool drain_file_loader(FileLoader *loader, RopeTree *tree, LineIndex *index);
+
+// Stops reading, the part already read is still drained
+void cancel_file_loader(FileLoader *loader);
+
+// Share of the file read so far
+float file_loader_progress(FileLoader *loader);
+
+// Waits for the worker and frees blocks that were never drained
+void free_file_loader(FileLoader *loader);
+
+#endif
@@ -1,5 +1,5 @@
 #include "memento.h"
-#include <X11/X.h>
+#include "compress.h"
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -34,24 +34,42 @@ void buffer_append(Buffer *buf, const char *format, ...) {
     buf->length += written;
 }
 
+// Appends length raw bytes, text may hold spaces or be longer than what
+// buffer_append formats
+void buffer_write(Buffer *buf, const char *text, size_t length) {
+    if (buf->length + length + 1 >= buf->capacity) {
+        buf->capacity = (buf->length + length + 1) * 2;
+        buf->data = realloc(buf->data, buf->capacity);
+    }
+    memcpy(buf->data + buf->length, text, length);
+    buf->length += length;
+    buf->data[buf->length] = '\0';
+}
+
 void serialize(Node *root, Buffer *buffer) {
     if (!root) {
-        buffer_append(buffer, "#");
+        buffer_append(buffer, "# ");
         return;
     }
 
     // is leaf
-    if (root->data) {
-        buffer_append(buffer, "L %d %s ", root->rank, root->data);
+    if (root->lazy) {
+        // the text stays in the file, only the range is kept
+        buffer_append(buffer, "Z %zu %zu ", root->rank, root->lazy->offset);
+    } else if (root->data) {
+        // rank is the length of the text that follows
+        buffer_append(buffer, "L %zu ", root->rank);
+        buffer_write(buffer, root->data, root->rank);
+        buffer_append(buffer, " ");
     } else {
-        buffer_append(buffer, "I %d ", root->rank);
+        buffer_append(buffer, "I %zu ", root->rank);
         serialize(root->left, buffer);
         serialize(root->right, buffer);
     }
 }
 
 [[nodiscard]]
-Node *deserialize_heler(char **str) {
+Node *deserialize_heler(char **str, PagedFile *file) {
     if (**str == '#') {
         *str += 2;
         return nullptr;
@@ -60,63 +78,133 @@ Node *deserialize_heler(char **str) {
     char type = **str;
     *str += 2;
 
-    int rank;
-    sscanf(*str, "%d", &rank);
+    size_t rank;
+    sscanf(*str, "%zu", &rank);
     while (**str != ' ')
         (*str)++;
     (*str)++; // skip space
 
-    Node *node = malloc(sizeof(Node));
-    if (type == 'L') {
-        char *start = *str;
+    if (type == 'Z') {
+        size_t offset;
+        sscanf(*str, "%zu", &offset);
         while (**str != ' ')
             (*str)++;
-        ptrdiff_t len = (ptrdiff_t)(*str - start);
-        char *data = (char *)malloc(len + 1);
-        strncpy(data, start, len);
-        data[len] = '\0';
         (*str)++;
-        node->data = strdup(data);
-        free(data);
-        node->rank = rank;
-        node->left = nullptr;
-        node->right = nullptr;
-        return node;
+        return create_lazy_leaf(file, offset, rank);
+    }
+
+    Node *node;
+    if (type == 'L') {
+        // copied by its length, the text may hold NUL
+        node = create_leaf_from(*str, rank);
+        *str += rank + 1;
     } else {
-        node->rank = rank;
-        node->data = nullptr;
-        node->left = deserialize_heler(str);
-        node->right = deserialize_heler(str);
-        return node;
+        Node *left = deserialize_heler(str, file);
+        Node *right = deserialize_heler(str, file);
+        node = create_internal(left, right);
     }
+    node->rank = rank;
+    return node;
 }
 
 [[nodiscard]]
-RopeTree *deserialize(char *str) {
+RopeTree *deserialize(char *str, PagedFile *file) {
     RopeTree *rope = create_tree();
-    rope->root = deserialize_heler(&str);
+    rope->root = deserialize_heler(&str, file);
+    rope->file = file;
+    retain_paged_file(file);
     return rope;
 }
 
 [[nodiscard]]
 Memento *create_memento(RopeTree *tree, Line *head) {
     Memento *m = malloc(sizeof(Memento));
-    Buffer buffer;
-    buffer_init(&buffer);
-    serialize(tree->root, &buffer);
-    m->serialized_rope = buffer.data;
+    m->snapshot = share_tree(tree);
+    m->serialized_rope = nullptr;
+    m->bytes = 0;
+    m->length = 0;
+    m->is_packed = false;
+    m->file = tree->file;
+    retain_paged_file(m->file);
     return m;
 }
 
 [[nodiscard]]
 RopeTree *restore_from_memento(Memento *m, Line **head) {
-    RopeTree *restored = deserialize(m->serialized_rope);
+    if (m->snapshot) {
+        // m keeps its own share for redo
+        return share_tree(m->snapshot);
+    }
+    char *serialized = m->serialized_rope;
+    if (m->is_packed) {
+        // unpacked for this restore only, the memento stays small
+        serialized = malloc(m->length + 1);
+        if (!serialized) {
+            perror("Failed to allocate memento");
+            return nullptr;
+        }
+        if (!decompress_text(m->serialized_rope, m->bytes, serialized,
+                             m->length)) {
+            fprintf(stderr, "Packed memento is corrupt\n");
+            free(serialized);
+            return nullptr;
+        }
+        serialized[m->length] = '\0';
+    }
+    RopeTree *restored = deserialize(serialized, m->file);
+    if (serialized != m->serialized_rope) {
+        free(serialized);
+    }
     restored->nodes_count = count_nodes(restored->root);
     restored->height = calc_tree_height(restored->root);
     restored->length = calculate_length(restored->root);
     return restored;
 }
 
+char *compress_memento(const Memento *m, size_t *size, size_t *length) {
+    const char *serialized = m->serialized_rope;
+    *length = m->length;
+    Buffer buffer = {0};
+    if (m->snapshot) {
+        buffer_init(&buffer);
+        serialize(m->snapshot->root, &buffer);
+        serialized = buffer.data;
+        *length = buffer.length;
+    }
+    char *packed = malloc(compress_bound(*length));
+    if (!packed) {
+        perror("Failed to allocate packed memento");
+        free(buffer.data);
+        return nullptr;
+    }
+    *size = compress_text(serialized, *length, packed);
+    free(buffer.data);
+    if (!*size) {
+        free(packed);
+        return nullptr;
+    }
+    // give back what the bound reserved
+    char *shrunk = realloc(packed, *size);
+    return shrunk ? shrunk : packed;
+}
+
+void pack_memento(Memento *m, char *packed, size_t size, size_t length) {
+    free_rope(m->snapshot);
+    m->snapshot = nullptr;
+    free(m->serialized_rope);
+    m->serialized_rope = packed;
+    m->bytes = size;
+    m->length = length;
+    m->is_packed = true;
+}
+
+void free_memento(Memento *m) {
+    free_rope(m->snapshot);
+    free(m->serialized_rope);
+    release_paged_file(m->file);
+    free(m);
+}
+
 Caretaker *create_caretaker(size_t capacity) {
     Caretaker *c = malloc(sizeof(Caretaker));
     c->history = malloc(sizeof(Memento *) * capacity);
@@ -126,9 +214,18 @@ Caretaker *create_caretaker(size_t capacity) {
 }
 
 void save_memento(Caretaker *c, Memento *m) {
-    if (c->size < c->capacity) {
-        c->history[c->size++] = m;
+    if (!c->capacity) {
+        free_memento(m);
+        return;
+    }
+    if (c->size == c->capacity) {
+        // the oldest step goes, its file reference with it
+        free_memento(c->history[0]);
+        memmove(c->history, c->history + 1,
+                (c->size - 1) * sizeof(Memento *));
+        c->size--;
     }
+    c->history[c->size++] = m;
 }
 
 Memento *get_memento(Caretaker *c, size_t idx) {
@@ -145,6 +242,25 @@ Memento *pop_memento(Caretaker *c) {
 }
 
 void clear_caretaker(Caretaker *c) {
-    // free(c->history);
+    for (size_t i = 0; i < c->size; ++i) {
+        free_memento(c->history[i]);
+    }
     c->size = 0;
 }
+
+void free_caretaker(Caretaker *c) {
+    if (!c) {
+        return;
+    }
+    clear_caretaker(c);
+    free(c->history);
+    free(c);
+}
+
+size_t caretaker_bytes(const Caretaker *c) {
+    size_t bytes = sizeof(Caretaker) + c->capacity * sizeof(Memento *);
+    for (size_t i = 0; i < c->size; ++i) {
+        bytes += sizeof(Memento) + c->history[i]->bytes;
+    }
+    return bytes;
+}
@@ -3,12 +3,20 @@
 
 #include "cursor.h"
 #include "rope.h"
-#include <X11/X.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 typedef struct Memento {
-    char *serialized_rope;
+    // the tree as it was, its nodes shared with the document. Packing
+    // replaces it by the serialized rope
+    RopeTree *snapshot;
+    char *serialized_rope; // compressed once packed
+    size_t bytes; // allocated for serialized_rope, the shared nodes count
+                  // with the rope
+    size_t length; // of serialized_rope before it was packed
+    bool is_packed;
+    PagedFile *file; // backing of the lazy leaves in serialized_rope
     size_t cursor_line;
     size_t cursor_column;
     size_t cursor_desired_column;
@@ -28,22 +36,44 @@ typedef struct Buffer {
 
 void serialize(Node *root, Buffer *buffer);
 
-Node *deserialize_heler(char **str);
+Node *deserialize_heler(char **str, PagedFile *file);
 
-RopeTree *deserialize(char *str);
+RopeTree *deserialize(char *str, PagedFile *file);
 
+// Snapshot of tree in O(1), it shares the nodes of tree
 Memento *create_memento(RopeTree *tree, Line *head);
 
+// Tree m was taken of, nullptr if a packed m cannot be unpacked
 RopeTree *restore_from_memento(Memento *m, Line **head);
 
+// Compressed copy of the serialized rope of m for pack_memento, nullptr if
+// it fails. length is set to the bytes it serializes to. Only reads m and
+// the nodes of its snapshot, which are never changed in place, so it may
+// run off the thread owning it
+[[nodiscard]]
+char *compress_memento(const Memento *m, size_t *size, size_t *length);
+
+// Replaces the snapshot or serialized rope of m by size bytes from
+// compress_memento, length bytes once unpacked
+void pack_memento(Memento *m, char *packed, size_t size, size_t length);
+
+void free_memento(Memento *m);
+
 Caretaker *create_caretaker(size_t capacity);
 
+// Adds m on top of c, which takes it over. A full c drops its oldest
 void save_memento(Caretaker *c, Memento *m);
 
 Memento *get_memento(Caretaker *c, size_t idx);
 
 Memento *pop_memento(Caretaker *c);
 
+// Frees the mementos and empties c
 void clear_caretaker(Caretaker *c);
 
+void free_caretaker(Caretaker *c);
+
+// Bytes held by c and its mementos
+size_t caretaker_bytes(const Caretaker *c);
+
 #endif
@@ -0,0 +1,42 @@
+#include "memory_stats.h"
+
+static double megabytes(size_t bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+void format_memory_stats(const MemoryStats *stats,
+                         char lines[MEMORY_STAT_LINES][MEMORY_STAT_COLUMNS]) {
+    const RopeStats *rope = &stats->rope;
+    // leaves are the text and its nodes, the rest of the tree is overhead
+    size_t leaf_alloc = rope->leaf_capacity +
+                        (rope->leaves + rope->lazy_leaves) * sizeof(Node) +
+                        rope->lazy_leaves * sizeof(LazyRange);
+    double used = leaf_alloc ? 100.0 * rope->leaf_bytes / leaf_alloc : 100;
+
+    snprintf(lines[0], MEMORY_STAT_COLUMNS, "nodes      %9zu %7zu lazy",
+             rope->internal_nodes + rope->leaves, rope->lazy_leaves);
+    snprintf(lines[1], MEMORY_STAT_COLUMNS, "leaf text  %9.2f MB",
+             megabytes(rope->leaf_bytes));
+    snprintf(lines[2], MEMORY_STAT_COLUMNS, "leaf alloc %9.2f MB %3.0f%% used",
+             megabytes(leaf_alloc), used);
+    snprintf(lines[3], MEMORY_STAT_COLUMNS, "internal   %9.2f MB",
+             megabytes(rope->internal_nodes * sizeof(Node)));
+    snprintf(lines[4], MEMORY_STAT_COLUMNS, "line index %9.2f MB",
+             megabytes(stats->line_index));
+    snprintf(lines[5], MEMORY_STAT_COLUMNS, "history    %9.2f MB",
+             megabytes(stats->history));
+    snprintf(lines[6], MEMORY_STAT_COLUMNS, "fonts      %9.2f MB",
+             megabytes(stats->font_cache));
+    snprintf(lines[7], MEMORY_STAT_COLUMNS, "shapes     %9.2f MB",
+             megabytes(stats->shape_cache));
+    snprintf(lines[8], MEMORY_STAT_COLUMNS, "packed     %9.2f MB %7zu docs",
+             megabytes(stats->packed), stats->packed_documents);
+}
+
+void print_memory_stats(const MemoryStats *stats, FILE *fp) {
+    char lines[MEMORY_STAT_LINES][MEMORY_STAT_COLUMNS];
+    format_memory_stats(stats, lines);
+    for (size_t i = 0; i < MEMORY_STAT_LINES; ++i) {
+        fprintf(fp, "%s\n", lines[i]);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include "rope.h"
+#include <stddef.h>
+#include <stdio.h>
+
+// Lines format_memory_stats writes and the room each one gets
+#define MEMORY_STAT_LINES 9
+#define MEMORY_STAT_COLUMNS 40
+
+// Bytes held by each part of the editor, collected when shown
+typedef struct {
+    RopeStats rope;
+    size_t line_index;
+    size_t history; // undo and redo mementos of every document
+    size_t font_cache;
+    size_t shape_cache;
+    size_t packed; // compressed text of idle documents
+    size_t packed_documents;
+} MemoryStats;
+
+// One line per part, shared by the HUD and the dumps
+void format_memory_stats(const MemoryStats *stats,
+                         char lines[MEMORY_STAT_LINES][MEMORY_STAT_COLUMNS]);
+
+void print_memory_stats(const MemoryStats *stats, FILE *fp);
+
+#endif
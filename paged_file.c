@@ -0,0 +1,160 @@
+#include "paged_file.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static_assert(FILE_PAGE_SPAN >= 3 * FILE_PAGE_BYTES + 4);
+
+PagedFile *open_paged_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("Failed to open paged file");
+        return nullptr;
+    }
+    PagedFile *file = calloc(1, sizeof(PagedFile));
+    if (!file) {
+        perror("Failed to allocate paged file");
+        fclose(fp);
+        return nullptr;
+    }
+    fseek(fp, 0, SEEK_END);
+    file->fp = fp;
+    file->size = ftell(fp);
+    file->page_count = (file->size + FILE_PAGE_BYTES - 1) / FILE_PAGE_BYTES;
+    file->max_resident = PAGE_CACHE_BYTES / FILE_PAGE_BYTES;
+    file->pages = calloc(file->page_count, sizeof(char *));
+    file->last_used = calloc(file->page_count, sizeof(uint64_t));
+    file->resident = malloc(file->max_resident * sizeof(size_t));
+    file->page_lines = calloc(file->page_count, sizeof(PageLines));
+    if ((file->page_count &&
+         (!file->pages || !file->last_used || !file->page_lines)) ||
+        !file->resident) {
+        perror("Failed to allocate page table");
+        file->refs = 1;
+        release_paged_file(file);
+        return nullptr;
+    }
+    file->refs = 1;
+    return file;
+}
+
+void retain_paged_file(PagedFile *file) {
+    if (file) {
+        file->refs++;
+    }
+}
+
+void release_paged_file(PagedFile *file) {
+    if (!file || --file->refs) {
+        return;
+    }
+    for (size_t i = 0; i < file->resident_count; ++i) {
+        free(file->pages[file->resident[i]]);
+    }
+    free(file->pages);
+    free(file->last_used);
+    free(file->resident);
+    free(file->page_lines);
+    fclose(file->fp);
+    free(file);
+}
+
+void evict_pages(PagedFile *file) {
+    for (size_t i = 0; i < file->resident_count; ++i) {
+        free(file->pages[file->resident[i]]);
+        file->pages[file->resident[i]] = nullptr;
+    }
+    file->resident_count = 0;
+}
+
+// Slot in resident for a new page, dropping the least recently used page
+// once the cache is full
+static size_t free_slot(PagedFile *file) {
+    if (file->resident_count < file->max_resident) {
+        return file->resident_count++;
+    }
+    size_t oldest = 0;
+    for (size_t i = 1; i < file->resident_count; ++i) {
+        if (file->last_used[file->resident[i]] <
+            file->last_used[file->resident[oldest]]) {
+            oldest = i;
+        }
+    }
+    size_t page = file->resident[oldest];
+    free(file->pages[page]);
+    file->pages[page] = nullptr;
+    return oldest;
+}
+
+const char *page_in(PagedFile *file, size_t page) {
+    if (page >= file->page_count) {
+        return nullptr;
+    }
+    file->last_used[page] = ++file->clock;
+    if (file->pages[page]) {
+        return file->pages[page];
+    }
+
+    size_t offset = page * FILE_PAGE_BYTES;
+    size_t length = file->size - offset < FILE_PAGE_BYTES
+                        ? file->size - offset
+                        : FILE_PAGE_BYTES;
+    // The unit before the page completes pairs split by the page start
+    size_t before = page ? unit_bytes(file->format) : 0;
+    char *raw = malloc(before + length);
+    if (!raw) {
+        perror("Failed to allocate page");
+        return nullptr;
+    }
+    if (fseek(file->fp, offset - before, SEEK_SET) ||
+        fread(raw, 1, before + length, file->fp) != before + length) {
+        perror("Failed to read page");
+        free(raw);
+        return nullptr;
+    }
+
+    uint32_t prev = last_unit(file->format, raw, before);
+    size_t skip = page ? before : bom_length(file->format);
+    bool last = page + 1 == file->page_count;
+    char *text = raw;
+    if (decodes_to_itself(file->format, prev, raw + skip,
+                          before + length - skip, last)) {
+        memmove(raw, raw + skip, before + length - skip);
+    } else {
+        text = malloc(decoded_capacity(length));
+        if (!text) {
+            perror("Failed to allocate page");
+            free(raw);
+            return nullptr;
+        }
+        decode_text(file->format, prev, raw + skip, before + length - skip,
+                    last, text);
+        free(raw);
+    }
+
+    file->resident[free_slot(file)] = page;
+    file->pages[page] = text;
+    return text;
+}
+
+bool count_page_newlines(PagedFile *file, size_t offset, size_t length,
+                         size_t *newlines) {
+    size_t page = offset / FILE_PAGE_SPAN;
+    if (offset % FILE_PAGE_SPAN == 0 && page < file->page_count &&
+        file->page_lines[page].length == length) {
+        *newlines = file->page_lines[page].newlines;
+        return true;
+    }
+    const char *text = page_in(file, page);
+    if (!text) {
+        return false;
+    }
+    text += offset % FILE_PAGE_SPAN;
+    const char *end = text + length;
+    *newlines = 0;
+    while ((text = memchr(text, '\n', end - text))) {
+        (*newlines)++;
+        text++;
+    }
+    return true;
+}
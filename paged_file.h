@@ -0,0 +1,68 @@
+#ifndef PAGED_FILE_H
+#define PAGED_FILE_H
+
+#include "encoding.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Unit files are read and cached in, lazy leaves never cross a page
+#define FILE_PAGE_BYTES (64 << 10)
+
+// Distance between pages in lazy leaf offsets, a decoded page can be longer
+// than the bytes it was decoded from
+#define FILE_PAGE_SPAN (4 * FILE_PAGE_BYTES)
+
+// Pages kept in memory at once for every paged file, the least recently
+// used one is dropped when another has to come in
+#define PAGE_CACHE_BYTES (64 << 20)
+
+// What decoding a page showed of it, kept so its lines can be counted
+// without reading it again
+typedef struct {
+    uint32_t length; // decoded, 0 while the page was never decoded
+    uint32_t newlines;
+} PageLines;
+
+// File whose text stays on disk and is read page by page while it is
+// looked at. Pages only ever hold file text, so they are always clean.
+// They are decoded from format as they come in
+typedef struct {
+    FILE *fp;
+    TextFormat format;
+    size_t size;
+    size_t page_count;
+    char **pages;        // text of resident pages by page number
+    uint64_t *last_used; // by page number
+    size_t *resident;    // numbers of the resident pages
+    size_t resident_count;
+    size_t max_resident;
+    uint64_t clock;
+    PageLines *page_lines; // by page number, filled in by the loader
+    size_t refs; // trees and undo states using the file
+} PagedFile;
+
+// Opens path with one reference held by the caller
+[[nodiscard]]
+PagedFile *open_paged_file(const char *path);
+
+void retain_paged_file(PagedFile *file);
+
+// Closes the file once the last reference is gone
+void release_paged_file(PagedFile *file);
+
+// Drops every resident page, they are read again when next looked at
+void evict_pages(PagedFile *file);
+
+// Decoded text of page, valid until the next call, nullptr if it cannot be
+// read
+const char *page_in(PagedFile *file, size_t page);
+
+// New lines in the length bytes at offset, given as in a lazy leaf. Whole
+// pages are counted from page_lines, others are read. false if the page
+// cannot be read
+bool count_page_newlines(PagedFile *file, size_t offset, size_t length,
+                         size_t *newlines);
+
+#endif
@@ -0,0 +1,175 @@
+// clock_gettime is POSIX
+#define _XOPEN_SOURCE 700
+
+#include "profiler.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Fields are atomic since the render thread and the input thread record
+// at once and the trace is written while they do. sequence is the event
+// number plus one once the slot is written, 0 while it is rewritten
+typedef struct {
+    atomic_size_t sequence;
+    atomic_int phase;
+    atomic_int_least64_t start_ns;
+    atomic_int_least64_t duration_ns;
+} EventSlot;
+
+static EventSlot events[PROFILE_EVENT_CAPACITY];
+static atomic_size_t event_head;
+
+static atomic_int_least64_t frame_total[PHASE_COUNT];
+static int64_t frame_history[PHASE_COUNT][PROFILE_FRAME_HISTORY];
+static size_t frame_count;
+
+static atomic_int_least64_t pending_input;
+static atomic_int_least64_t latency_history[PROFILE_LATENCY_HISTORY];
+static atomic_size_t latency_count;
+
+static const char *phase_names[PHASE_COUNT] = {
+    [PHASE_EVENTS] = "events",
+    [PHASE_ROPE_EDIT] = "rope edit",
+    [PHASE_LINE_INDEX] = "line index",
+    [PHASE_LEAF_COLLECT] = "leaves",
+    [PHASE_SHAPING] = "shaping",
+    [PHASE_GLYPHS] = "glyphs",
+    [PHASE_SWAP] = "swap",
+    [PHASE_FRAME] = "frame",
+};
+
+// Monotonic, so a clock step does not show up as a slow or negative frame
+int64_t profile_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void profile_record(ProfilePhase phase, int64_t start_ns, int64_t end_ns) {
+    size_t number =
+        atomic_fetch_add_explicit(&event_head, 1, memory_order_relaxed);
+    EventSlot *slot = &events[number & (PROFILE_EVENT_CAPACITY - 1)];
+    atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->phase, phase, memory_order_relaxed);
+    atomic_store_explicit(&slot->start_ns, start_ns, memory_order_relaxed);
+    atomic_store_explicit(&slot->duration_ns, end_ns - start_ns,
+                          memory_order_relaxed);
+    atomic_store_explicit(&slot->sequence, number + 1, memory_order_release);
+    atomic_fetch_add_explicit(&frame_total[phase], end_ns - start_ns,
+                              memory_order_relaxed);
+}
+
+void profile_frame_end() {
+    size_t slot = frame_count++ % PROFILE_FRAME_HISTORY;
+    for (size_t phase = 0; phase < PHASE_COUNT; ++phase) {
+        frame_history[phase][slot] = atomic_exchange_explicit(
+            &frame_total[phase], 0, memory_order_relaxed);
+    }
+}
+
+static int compare_ns(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static ProfileStats percentiles(int64_t *sorted, size_t count) {
+    if (count == 0) {
+        return (ProfileStats){0, 0};
+    }
+    qsort(sorted, count, sizeof(int64_t), compare_ns);
+    return (ProfileStats){.p50_ns = sorted[count / 2],
+                          .p99_ns = sorted[count * 99 / 100]};
+}
+
+ProfileStats profile_stats(ProfilePhase phase) {
+    size_t count = frame_count < PROFILE_FRAME_HISTORY ? frame_count
+                                                       : PROFILE_FRAME_HISTORY;
+    int64_t sorted[PROFILE_FRAME_HISTORY];
+    for (size_t i = 0; i < count; ++i) {
+        sorted[i] = frame_history[phase][i];
+    }
+    return percentiles(sorted, count);
+}
+
+void profile_input(int64_t event_ns) {
+    int64_t pending = 0;
+    // keeps an earlier time another event already left
+    atomic_compare_exchange_strong(&pending_input, &pending, event_ns);
+}
+
+int64_t profile_take_input() { return atomic_exchange(&pending_input, 0); }
+
+void profile_latency(int64_t input_ns, int64_t present_ns) {
+    size_t slot = atomic_fetch_add_explicit(&latency_count, 1,
+                                            memory_order_relaxed) %
+                  PROFILE_LATENCY_HISTORY;
+    atomic_store_explicit(&latency_history[slot], present_ns - input_ns,
+                          memory_order_relaxed);
+}
+
+ProfileStats profile_latency_stats() {
+    size_t count = atomic_load_explicit(&latency_count, memory_order_relaxed);
+    if (count > PROFILE_LATENCY_HISTORY) {
+        count = PROFILE_LATENCY_HISTORY;
+    }
+    int64_t sorted[PROFILE_LATENCY_HISTORY];
+    for (size_t i = 0; i < count; ++i) {
+        sorted[i] =
+            atomic_load_explicit(&latency_history[i], memory_order_relaxed);
+    }
+    return percentiles(sorted, count);
+}
+
+// Copies event number out of its slot, false if the slot was rewritten or
+// is being written
+static bool read_event(size_t number, ProfileEvent *event) {
+    EventSlot *slot = &events[number & (PROFILE_EVENT_CAPACITY - 1)];
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) !=
+        number + 1) {
+        return false;
+    }
+    *event = (ProfileEvent){
+        .phase = atomic_load_explicit(&slot->phase, memory_order_relaxed),
+        .start_ns =
+            atomic_load_explicit(&slot->start_ns, memory_order_relaxed),
+        .duration_ns =
+            atomic_load_explicit(&slot->duration_ns, memory_order_relaxed)};
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->sequence, memory_order_relaxed) ==
+           number + 1;
+}
+
+const char *profile_phase_name(ProfilePhase phase) {
+    return phase < PHASE_COUNT ? phase_names[phase] : "unknown";
+}
+
+bool profile_write_chrome_trace(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        perror("Failed to open trace file");
+        return false;
+    }
+    size_t head = atomic_load(&event_head);
+    size_t count =
+        head < PROFILE_EVENT_CAPACITY ? head : PROFILE_EVENT_CAPACITY;
+
+    fputs("{\"traceEvents\":[\n", fp);
+    bool first = true;
+    for (size_t i = head - count; i < head; ++i) {
+        ProfileEvent e;
+        if (!read_event(i, &e)) {
+            continue;
+        }
+        fprintf(fp,
+                "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":1,\"tid\":1}\n",
+                first ? "" : ",", profile_phase_name(e.phase),
+                e.start_ns / 1000.0, e.duration_ns / 1000.0);
+        first = false;
+    }
+    fputs("],\"displayTimeUnit\":\"ms\"}\n", fp);
+    return fclose(fp) == 0;
+}
@@ -0,0 +1,67 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Raw events kept for the trace, power of two
+#define PROFILE_EVENT_CAPACITY 65536
+// Frames kept for the percentiles
+#define PROFILE_FRAME_HISTORY 256
+// Input to screen latencies kept for the percentiles
+#define PROFILE_LATENCY_HISTORY 256
+
+typedef enum {
+    PHASE_EVENTS,
+    PHASE_ROPE_EDIT,
+    PHASE_LINE_INDEX,
+    PHASE_LEAF_COLLECT,
+    PHASE_SHAPING,
+    PHASE_GLYPHS,
+    PHASE_SWAP,
+    PHASE_FRAME,
+    PHASE_COUNT
+} ProfilePhase;
+
+typedef struct {
+    ProfilePhase phase;
+    int64_t start_ns;
+    int64_t duration_ns;
+} ProfileEvent;
+
+typedef struct {
+    int64_t p50_ns;
+    int64_t p99_ns;
+} ProfileStats;
+
+int64_t profile_now();
+
+// Safe to call from any thread, never blocks
+void profile_record(ProfilePhase phase, int64_t start_ns, int64_t end_ns);
+
+// Closes the per frame totals of every phase
+void profile_frame_end();
+
+ProfileStats profile_stats(ProfilePhase phase);
+
+// Notes input that the next frame will show, the earliest time is kept
+// until the frame is recorded
+void profile_input(int64_t event_ns);
+
+// Earliest input noted since the last call, 0 if there was none
+int64_t profile_take_input();
+
+// Time from input_ns until the frame showing it was on screen, safe to call
+// from any thread
+void profile_latency(int64_t input_ns, int64_t present_ns);
+
+// Percentiles of the recent key to photon latencies
+ProfileStats profile_latency_stats();
+
+const char *profile_phase_name(ProfilePhase phase);
+
+// Writes the buffered events in Chrome trace event format
+bool profile_write_chrome_trace(const char *path);
+
+#endif
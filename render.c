@@ -0,0 +1,786 @@
+#include "render.h"
+#include "profiler.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+RnFont *set_render_font_size(RenderContext *ctx, uint32_t size) {
+    FontInstance *instance = get_font(ctx->fonts, size);
+    if (instance) {
+        ctx->font = instance->font;
+        ctx->glyph_cache = instance->glyph_cache;
+    }
+    return ctx->font;
+}
+
+vec2s get_cursor_pos(RenderContext *ctx, struct Cursor cursor) {
+    return (vec2s){.x = cursor.column * ctx->font->space_w,
+                   .y = (cursor.line) * ctx->font->size * 1.5f};
+}
+
+// Characters the font may join into ligatures when they are adjacent
+bool is_ligature_char(char c) { return c && strchr("<>=-!|&+*/:.~#", c); }
+
+// True if the line can be laid out by column without harfbuzz
+bool is_plain_ascii(const char *text, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = text[i];
+        if ((c < 0x20 && c != '\t') || c >= 0x7F) {
+            return false;
+        }
+        if (i && is_ligature_char(c) && is_ligature_char(text[i - 1])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+vec2s render_ascii_text(RenderContext *ctx, const char *text, size_t length,
+                        vec2s pos, RnColor color, bool render) {
+    RnFont *font = ctx->font;
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = text[i];
+        if (c == '\t') {
+            pos.x += font->tab_w * font->space_w;
+            continue;
+        }
+        if (render && c != ' ') {
+            ctx->renderer->glyph(ctx->renderer, ctx->glyph_cache, font,
+                                 ctx->glyph_cache->ascii_index[c], c, pos,
+                                 color);
+        }
+        pos.x += font->space_w;
+    }
+    return pos;
+}
+
+vec2s render_text(RenderContext *ctx, const char *text, size_t length,
+                  size_t line, vec2s pos, RnColor color, bool render) {
+    RnFont *font = ctx->font;
+
+    // Monospace ASCII lines advance one column per byte, skip shaping
+    if (ctx->glyph_cache->monospace && is_plain_ascii(text, length)) {
+        int64_t glyph_start = profile_now();
+        pos = render_ascii_text(ctx, text, length, pos, color, render);
+        profile_record(PHASE_GLYPHS, glyph_start, profile_now());
+        return pos;
+    }
+
+    // Get the (cached) harfbuzz shaping for the line
+    int64_t shape_start = profile_now();
+    ShapedLine *hb_text =
+        shape_line(ctx->shape_cache, font, text, length, line);
+    int64_t glyph_start = profile_now();
+    profile_record(PHASE_SHAPING, shape_start, glyph_start);
+
+    vec2s start_pos = (vec2s){.x = pos.x, .y = pos.y};
+
+    // New line characters
+    const int32_t line_feed = 0x000A;
+    const int32_t carriage_return = 0x000D;
+    const int32_t line_seperator = 0x2028;
+    const int32_t paragraph_seperator = 0x2029;
+
+    float scale = 1.0f;
+    if (font->selected_strike_size)
+        scale = ((float)font->size / (float)font->selected_strike_size);
+
+    for (unsigned int i = 0; i < hb_text->glyph_count; i++) {
+        // Clusters are byte offsets, decode the source character in place
+        uint32_t cluster = hb_text->glyph_info[i].cluster;
+        size_t bytes;
+        uint32_t codepoint =
+            utf8_decode(text + cluster, length - cluster, &bytes);
+        // Check if the unicode codepoint is a new line and advance
+        // to the next line if so
+        if (codepoint == line_feed || codepoint == carriage_return ||
+            codepoint == line_seperator || codepoint == paragraph_seperator) {
+            pos.x = start_pos.x;
+            pos.y += font->size * 1.5f;
+            continue;
+        }
+
+        // Advance the x position by the tab width if
+        // we iterate a tab character
+        if (codepoint == '\t') {
+            pos.x += font->tab_w * font->space_w;
+            continue;
+        }
+
+        // If the glyph is not with
+        if (!hb_text->glyph_info[i].codepoint) {
+            continue;
+        }
+
+        float x_advance = (hb_text->glyph_pos[i].x_advance / 64.0f) * scale;
+        float y_advance = (hb_text->glyph_pos[i].y_advance / 64.0f) * scale;
+        float x_offset = (hb_text->glyph_pos[i].x_offset / 64.0f) * scale;
+        float y_offset = (hb_text->glyph_pos[i].y_offset / 64.0f) * scale;
+
+        // Render the glyph
+        if (render) {
+            ctx->renderer->glyph(ctx->renderer, ctx->glyph_cache, font,
+                                 hb_text->glyph_info[i].codepoint, codepoint,
+                                 (vec2s){pos.x + x_offset, pos.y - y_offset},
+                                 color);
+        }
+
+        // Advance to the next glyph
+        pos.x += x_advance;
+        pos.y += y_advance;
+    }
+    profile_record(PHASE_GLYPHS, glyph_start, profile_now());
+
+    return (vec2s){.x = pos.x, .y = pos.y};
+}
+
+void render_hud(RenderContext *ctx, uint32_t render_w) {
+    RnFont *font = ctx->font;
+    const float line_height = font->size * 1.5f;
+    const size_t columns = 34;
+    vec2s pos = {render_w - columns * font->space_w - 20, 20};
+
+    ctx->renderer->rect(
+        ctx->renderer, (vec2s){pos.x - 10, pos.y - 10},
+        (vec2s){columns * font->space_w + 20,
+                (PHASE_COUNT + 1 + MEMORY_STAT_LINES) * line_height + 20},
+        (RnColor){0, 0, 0, 200});
+
+    char buff[64];
+    for (ProfilePhase phase = 0; phase < PHASE_COUNT; ++phase) {
+        ProfileStats stats = profile_stats(phase);
+        int length = snprintf(buff, sizeof(buff), "%-10s %7.3f ms %7.3f ms",
+                              profile_phase_name(phase), stats.p50_ns / 1e6,
+                              stats.p99_ns / 1e6);
+        render_text(ctx, buff, length, SHAPE_NO_LINE, pos,
+                    (RnColor){250, 189, 47, 255}, true);
+        pos.y += line_height;
+    }
+    // from reading the input to the frame showing it on screen
+    ProfileStats latency = profile_latency_stats();
+    int length = snprintf(buff, sizeof(buff), "%-10s %7.3f ms %7.3f ms",
+                          "latency", latency.p50_ns / 1e6,
+                          latency.p99_ns / 1e6);
+    render_text(ctx, buff, length, SHAPE_NO_LINE, pos,
+                (RnColor){250, 189, 47, 255}, true);
+    pos.y += line_height;
+
+    char lines[MEMORY_STAT_LINES][MEMORY_STAT_COLUMNS];
+    format_memory_stats(&ctx->memory, lines);
+    for (size_t i = 0; i < MEMORY_STAT_LINES; ++i) {
+        render_text(ctx, lines[i], strlen(lines[i]), SHAPE_NO_LINE, pos,
+                    (RnColor){131, 165, 152, 255}, true);
+        pos.y += line_height;
+    }
+}
+
+void render_load_progress(RenderContext *ctx, uint32_t render_w,
+                          uint32_t render_h) {
+    RnFont *font = ctx->font;
+    const float line_height = font->size * 1.5f;
+    vec2s pos = {20, render_h - line_height - 10};
+
+    ctx->renderer->rect(ctx->renderer, (vec2s){0, pos.y - 10},
+                        (vec2s){render_w, line_height + 20},
+                        (RnColor){29, 32, 33, 255});
+    ctx->renderer->rect(ctx->renderer, (vec2s){0, pos.y - 10},
+                        (vec2s){render_w * ctx->load_progress, 4},
+                        (RnColor){250, 189, 47, 255});
+
+    char buff[64];
+    int length = snprintf(buff, sizeof(buff), "Loading %.0f%%, Esc cancels",
+                          ctx->load_progress * 100);
+    render_text(ctx, buff, length, SHAPE_NO_LINE, pos, RN_WHITE, true);
+}
+
+static const RnColor token_colors[TOKEN_COUNT] = {
+    [TOKEN_TEXT] = {255, 255, 255, 255},
+    [TOKEN_KEYWORD] = {251, 73, 52, 255},
+    [TOKEN_TYPE] = {250, 189, 47, 255},
+    [TOKEN_NUMBER] = {211, 134, 155, 255},
+    [TOKEN_STRING] = {184, 187, 38, 255},
+    [TOKEN_COMMENT] = {146, 131, 116, 255},
+    [TOKEN_PREPROCESSOR] = {142, 192, 124, 255},
+};
+
+static bool is_highlighting(RenderContext *ctx) {
+    return ctx->highlight && ctx->highlight->enabled;
+}
+
+// State first_line starts in. Lines above it are lexed first unless they
+// are too far below the lexed part, then the viewport starts from a guess
+// until the idle lexer catches up
+static LexState prepare_highlight(RenderContext *ctx, RopeTree *tree,
+                                  LineIndex *index, size_t first_line) {
+    HighlightIndex *hl = ctx->highlight;
+    if (hl->line_num != index->line_num) {
+        reset_highlight_lines(hl, index->line_num);
+    }
+    if (first_line <= hl->valid + HIGHLIGHT_EAGER_LINES) {
+        lex_until(hl, tree, index, first_line, SIZE_MAX);
+    }
+    return line_start_state(hl, first_line);
+}
+
+// Draws text[start, end) of the line last passed to tokenize_line
+static vec2s render_spans(RenderContext *ctx, const char *text, size_t start,
+                          size_t end, size_t line, vec2s pos) {
+    HighlightIndex *hl = ctx->highlight;
+    for (size_t i = 0; i < hl->span_count; ++i) {
+        TokenSpan span = hl->spans[i];
+        size_t span_start = MAX(span.start, start);
+        size_t span_end = MIN(span.start + span.length, end);
+        if (span_start < span_end) {
+            pos = render_text(ctx, text + span_start, span_end - span_start,
+                              line, pos, token_colors[span.kind], true);
+        }
+    }
+    return pos;
+}
+
+// Scratch buffer for one line, kept between frames
+static char *reserve_line_text(RenderContext *ctx, size_t length) {
+    if (length > ctx->line_capacity) {
+        char *grown = realloc(ctx->line_text, length);
+        if (!grown) {
+            return nullptr;
+        }
+        ctx->line_text = grown;
+        ctx->line_capacity = length;
+    }
+    return ctx->line_text;
+}
+
+// Copies line without its new line into ctx->line_text
+static size_t copy_line(RenderContext *ctx, RopeTree *tree, LineIndex *index,
+                        size_t line) {
+    size_t start = get_line_offset(index, line);
+    size_t length = get_line_length(index, line);
+    char *text = reserve_line_text(ctx, length);
+    if (!text) {
+        return 0;
+    }
+    // what cannot be read is left off
+    length = copy_range(tree->root, start, length, text);
+    if (length && text[length - 1] == '\n') {
+        length--;
+    }
+    return length;
+}
+
+static bool is_wrapping(RenderContext *ctx) {
+    return ctx->wrap && ctx->wrap->enabled;
+}
+
+// Bytes of line without its new line
+static size_t line_text_length(LineIndex *index, size_t line) {
+    return get_line_length(index, line) - (line + 1 < index->line_num);
+}
+
+// Wraps line from pieces read off the rope, so a long line is never copied
+// whole
+static void ensure_wrapped(RenderContext *ctx, RopeTree *tree,
+                           LineIndex *index, size_t line) {
+    if (is_line_wrapped(ctx->wrap, line)) {
+        return;
+    }
+    size_t start = get_line_offset(index, line);
+    size_t length = line_text_length(index, line);
+    char piece[COLUMN_SCAN_BYTES];
+    LineWrapper wrapper;
+    start_wrap_line(ctx->wrap, line, ctx->font->tab_w, &wrapper);
+    for (size_t done = 0; done < length;) {
+        size_t wanted = MIN(sizeof(piece), length - done);
+        size_t read = copy_range(tree->root, start + done, wanted, piece);
+        feed_wrap_line(ctx->wrap, &wrapper, piece, read);
+        // what cannot be read is left off
+        if (read < wanted) {
+            break;
+        }
+        done += read;
+    }
+    finish_wrap_line(ctx->wrap, &wrapper);
+}
+
+// Visual rows of line, always one without wrapping
+static size_t row_count(RenderContext *ctx, RopeTree *tree, LineIndex *index,
+                        size_t line) {
+    if (!is_wrapping(ctx)) {
+        return 1;
+    }
+    ensure_wrapped(ctx, tree, index, line);
+    return wrapped_line(ctx->wrap, line)->row_count;
+}
+
+// Moves the top of the view by one row, false at either end
+static bool step_scroll(RenderContext *ctx, RopeTree *tree, LineIndex *index,
+                        bool down) {
+    Scroll *scroll = &ctx->scroll;
+    if (down) {
+        if (scroll->row + 1 < row_count(ctx, tree, index, scroll->line)) {
+            scroll->row++;
+        } else if (scroll->line + 1 < index->line_num) {
+            scroll->line++;
+            scroll->row = 0;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    if (scroll->row > 0) {
+        scroll->row--;
+    } else if (scroll->line > 0) {
+        scroll->line--;
+        scroll->row = row_count(ctx, tree, index, scroll->line) - 1;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void scroll_pixels(RenderContext *ctx, RopeTree *tree, LineIndex *index,
+                          float pixels) {
+    Scroll *scroll = &ctx->scroll;
+    const float line_height = ctx->font->size * 1.5f;
+    scroll->pixel += pixels;
+    if (!is_wrapping(ctx)) {
+        // Every line is one row, so jump straight to the line
+        double lines = floorf(scroll->pixel / line_height);
+        double top = scroll->line + lines;
+        if (top < 0) {
+            scroll->line = 0;
+            scroll->pixel = 0;
+        } else if (top >= index->line_num) {
+            scroll->line = index->line_num - 1;
+            scroll->pixel = 0;
+        } else {
+            scroll->line = top;
+            scroll->pixel -= lines * line_height;
+        }
+        return;
+    }
+    double rows = floorf(scroll->pixel / line_height);
+    if (fabs(rows) > SCROLL_STEP_ROWS) {
+        WrapIndex *wrap = ctx->wrap;
+        double top = (double)row_of_line(wrap, scroll->line) + scroll->row +
+                     rows;
+        size_t total = total_rows(wrap);
+        scroll->pixel -= rows * line_height;
+        if (top < 0) {
+            top = 0;
+            scroll->pixel = 0;
+        } else if (top >= total) {
+            top = total - 1;
+            scroll->pixel = 0;
+        }
+        scroll->line = line_of_row(wrap, top, &scroll->row);
+        return;
+    }
+    while (scroll->pixel < 0) {
+        if (!step_scroll(ctx, tree, index, false)) {
+            scroll->pixel = 0;
+            break;
+        }
+        scroll->pixel += line_height;
+    }
+    while (scroll->pixel >= line_height) {
+        if (!step_scroll(ctx, tree, index, true)) {
+            scroll->pixel = 0;
+            break;
+        }
+        scroll->pixel -= line_height;
+    }
+}
+
+static bool is_above_top(Scroll *scroll, size_t line, size_t row) {
+    return line < scroll->line || (line == scroll->line && row < scroll->row);
+}
+
+// Rows between the top of the view and line/row, SIZE_MAX once more than
+// limit rows are in between. Only the lines in between are looked at
+static size_t rows_from_top(RenderContext *ctx, RopeTree *tree,
+                            LineIndex *index, size_t line, size_t row,
+                            size_t limit) {
+    Scroll *scroll = &ctx->scroll;
+    if (!is_wrapping(ctx)) {
+        return line - scroll->line > limit ? SIZE_MAX : line - scroll->line;
+    }
+    if (line == scroll->line) {
+        return row - scroll->row;
+    }
+    size_t rows = row_count(ctx, tree, index, scroll->line) - scroll->row;
+    for (size_t i = scroll->line + 1; i < line; ++i) {
+        if (rows > limit) {
+            return SIZE_MAX;
+        }
+        rows += row_count(ctx, tree, index, i);
+    }
+    return rows + row > limit ? SIZE_MAX : rows + row;
+}
+
+// Applies pending scrolling, then brings the cursor row into view if the
+// cursor moved
+static void update_scroll(RenderContext *ctx, RopeTree *tree,
+                          LineIndex *index, size_t cursor_line,
+                          size_t cursor_row, uint32_t render_h) {
+    Scroll *scroll = &ctx->scroll;
+    const float line_height = ctx->font->size * 1.5f;
+
+    // Lines may have been deleted or wrapped differently since last frame
+    if (scroll->line >= index->line_num) {
+        scroll->line = index->line_num - 1;
+        scroll->row = 0;
+    }
+    size_t rows = row_count(ctx, tree, index, scroll->line);
+    scroll->row = MIN(scroll->row, rows - 1);
+
+    scroll_pixels(ctx, tree, index, scroll->pending);
+    scroll->pending = 0;
+
+    if (!scroll->follow_cursor) {
+        return;
+    }
+    scroll->follow_cursor = false;
+    if (is_above_top(scroll, cursor_line, cursor_row) ||
+        (cursor_line == scroll->line && cursor_row == scroll->row)) {
+        scroll->line = cursor_line;
+        scroll->row = cursor_row;
+        scroll->pixel = 0;
+        return;
+    }
+
+    size_t rows_above = rows_from_top(ctx, tree, index, cursor_line,
+                                      cursor_row, render_h / line_height);
+    float bottom = 20 - scroll->pixel + (rows_above + 1.0f) * line_height;
+    if (rows_above == SIZE_MAX) {
+        // Too far to walk to, start from the cursor row and back up
+        scroll->line = cursor_line;
+        scroll->row = cursor_row;
+        scroll->pixel = 0;
+        bottom = 20 + line_height;
+    } else if (bottom <= render_h) {
+        return;
+    }
+    // Leave the cursor row at the bottom of the window
+    scroll_pixels(ctx, tree, index, bottom - render_h);
+}
+
+// Draws cursor if its row is in the window
+static void render_wrapped_cursor(RenderContext *ctx, RopeTree *tree,
+                                  LineIndex *index, struct Cursor cursor,
+                                  float text_x, size_t visible_rows) {
+    RnFont *font = ctx->font;
+    Scroll *scroll = &ctx->scroll;
+    size_t row_start;
+    ensure_wrapped(ctx, tree, index, cursor.line);
+    size_t row = row_of_column(ctx->wrap, cursor.line, cursor.column,
+                               &row_start);
+    if (is_above_top(scroll, cursor.line, row)) {
+        return;
+    }
+    size_t rows_above =
+        rows_from_top(ctx, tree, index, cursor.line, row, visible_rows);
+    if (rows_above != SIZE_MAX) {
+        ctx->renderer->rect(
+            ctx->renderer,
+            (vec2s){text_x + (cursor.column - row_start) * font->space_w,
+                    20 - scroll->pixel + rows_above * font->size * 1.5f},
+            (vec2s){1, 1.5f * font->size}, RN_WHITE);
+    }
+}
+
+// Highlights the selected columns of line between start and end, pos is
+// where start is drawn. The line break is one column past the last row
+static void render_selection(RenderContext *ctx, size_t line, size_t start,
+                             size_t end, bool last_row, vec2s pos) {
+    struct Cursor first = ctx->selection_start;
+    struct Cursor last = ctx->selection_end;
+    if (!ctx->has_selection || line < first.line || line > last.line) {
+        return;
+    }
+    size_t from = line == first.line ? MAX(first.column, start) : start;
+    size_t to = end + (last_row && line < last.line);
+    if (line == last.line) {
+        to = MIN(to, last.column);
+    }
+    if (to <= from) {
+        return;
+    }
+    RnFont *font = ctx->font;
+    ctx->renderer->rect(
+        ctx->renderer,
+        (vec2s){pos.x + (from - start) * font->space_w, pos.y},
+        (vec2s){(to - from) * font->space_w, 1.5f * font->size},
+        (RnColor){69, 133, 136, 160});
+}
+
+// Soft wrapped layout, scrolls by visual rows instead of lines
+static void render_wrapped(RenderContext *ctx, RopeTree *tree,
+                           LineIndex *index, struct Cursor cursor,
+                           uint32_t render_w, uint32_t render_h,
+                           float max_width) {
+    RnFont *font = ctx->font;
+    WrapIndex *wrap = ctx->wrap;
+    Scroll *scroll = &ctx->scroll;
+    const float line_height = font->size * 1.5f;
+    const float text_x = 20 + max_width + 10;
+
+    float text_w = render_w - text_x - 20;
+    configure_wrap(wrap, text_w > 0 ? text_w / font->space_w : 1, font->size);
+    if (wrap->line_num != index->line_num) {
+        reset_wrap_lines(wrap, index->line_num);
+    }
+
+    size_t visible_rows = render_h / line_height + 1;
+    size_t row_start;
+    ensure_wrapped(ctx, tree, index, cursor.line);
+    size_t cursor_row =
+        row_of_column(wrap, cursor.line, cursor.column, &row_start);
+    update_scroll(ctx, tree, index, cursor.line, cursor_row, render_h);
+
+    render_wrapped_cursor(ctx, tree, index, cursor, text_x, visible_rows);
+    // every line takes a row at least, so only these can be on screen
+    for (size_t i = 0; ctx->extra_cursors && i < ctx->extra_cursors->count;
+         ++i) {
+        struct Cursor extra = ctx->extra_cursors->cursors[i];
+        if (extra.line >= scroll->line &&
+            extra.line <= scroll->line + visible_rows) {
+            render_wrapped_cursor(ctx, tree, index, extra, text_x,
+                                  visible_rows);
+        }
+    }
+
+    size_t line = scroll->line;
+    size_t row_in_line = scroll->row;
+    size_t last_row = visible_rows + OVERSCAN_LINES;
+    ctx->first_line = line;
+    LexState state = LEX_NORMAL;
+    if (is_highlighting(ctx)) {
+        state = prepare_highlight(ctx, tree, index, line);
+    }
+
+    float y = 20 - scroll->pixel;
+    char gutter[24];
+    for (size_t row = 0; row < last_row && line < index->line_num; ++line) {
+        int64_t collect_start = profile_now();
+        // line_text holds the bytes text_start to text_end of the line
+        size_t text_start = 0;
+        size_t text_end;
+        bool long_line = get_line_length(index, line) > LONG_LINE_BYTES;
+        WrappedLine *wrapped;
+        if (long_line) {
+            // Only the rows on screen are copied
+            ensure_wrapped(ctx, tree, index, line);
+            wrapped = wrapped_line(wrap, line);
+            size_t last = MIN(wrapped->row_count, row_in_line + last_row - row);
+            text_start = row_in_line ? wrapped->breaks[row_in_line - 1] : 0;
+            text_end = last < wrapped->row_count
+                           ? wrapped->breaks[last - 1]
+                           : line_text_length(index, line);
+            char *window = reserve_line_text(ctx, text_end - text_start);
+            // what cannot be read is left off
+            text_end = text_start +
+                       (window ? copy_range(tree->root,
+                                            get_line_offset(index, line) +
+                                                text_start,
+                                            text_end - text_start, window)
+                               : 0);
+        } else {
+            text_end = copy_line(ctx, tree, index, line);
+            if (!is_line_wrapped(wrap, line)) {
+                wrap_line(wrap, line, ctx->line_text, text_end, font->tab_w);
+            }
+            wrapped = wrapped_line(wrap, line);
+        }
+        const char *text = ctx->line_text;
+        profile_record(PHASE_LEAF_COLLECT, collect_start, profile_now());
+        // Long lines are not lexed, see lex_until
+        bool lexed = is_highlighting(ctx) && !long_line;
+        if (lexed) {
+            state = tokenize_line(ctx->highlight, state, text, text_end);
+        }
+
+        if (row_in_line == 0) {
+            sprintf(gutter, "%zu", line + 1);
+            render_text(ctx, gutter, strlen(gutter), SHAPE_NO_LINE,
+                        (vec2s){20, y}, (RnColor){150, 150, 150, 255}, true);
+        }
+        for (size_t r = row_in_line; r < wrapped->row_count && row < last_row;
+             ++r, ++row) {
+            size_t start = r ? wrapped->breaks[r - 1] : 0;
+            size_t end = r + 1 < wrapped->row_count ? wrapped->breaks[r]
+                                                    : text_end;
+            // a page that could not be read cuts the line short
+            end = MIN(end, text_end);
+            start = MIN(start, end);
+            render_selection(ctx, line, start, end, r + 1 == wrapped->row_count,
+                             (vec2s){text_x, y});
+            if (lexed) {
+                render_spans(ctx, text, start, end, line, (vec2s){text_x, y});
+            } else {
+                render_text(ctx, text + start - text_start, end - start, line,
+                            (vec2s){text_x, y}, RN_WHITE, true);
+            }
+            y += line_height;
+        }
+        row_in_line = 0;
+    }
+    ctx->last_line = line;
+
+    // Spread wrapping the rest of the document over the following frames
+    for (size_t n = 0;
+         n < WRAP_IDLE_LINES && wrap->idle_line < index->line_num;
+         ++wrap->idle_line) {
+        if (!is_line_wrapped(wrap, wrap->idle_line)) {
+            ensure_wrapped(ctx, tree, index, wrap->idle_line);
+            n++;
+        }
+    }
+}
+
+// Taken relative to the top line so positions stay exact in huge documents
+static float line_y(RenderContext *ctx, size_t line) {
+    const float line_height = ctx->font->size * 1.5f;
+    int64_t rows = (int64_t)line - (int64_t)ctx->scroll.line;
+    return 20 - ctx->scroll.pixel + rows * line_height;
+}
+
+// Unwrapped layout, long lines scroll horizontally with the cursor
+static void render_unwrapped(RenderContext *ctx, RopeTree *tree,
+                             LineIndex *index, struct Cursor cursor,
+                             uint32_t render_w, uint32_t render_h,
+                             float max_width) {
+    RnFont *font = ctx->font;
+    Renderer *renderer = ctx->renderer;
+    Scroll *scroll = &ctx->scroll;
+    vec2s cursor_pos = get_cursor_pos(ctx, cursor);
+
+    float x_offset = 0;
+    if (cursor_pos.x >= render_w) {
+        x_offset = cursor_pos.x - render_w + font->size;
+    }
+
+    update_scroll(ctx, tree, index, cursor.line, 0, render_h);
+    const float line_height = font->size * 1.5f;
+
+    // Only the lines intersecting the window (plus overscan) are rendered
+    size_t first_line = scroll->line;
+    size_t last_line = first_line + render_h / line_height + 1 + OVERSCAN_LINES;
+    first_line = first_line > OVERSCAN_LINES ? first_line - OVERSCAN_LINES : 0;
+    last_line = MIN(last_line, index->line_num);
+    ctx->first_line = first_line;
+    ctx->last_line = last_line;
+
+    float x = 20;
+    char buff[24];
+    for (size_t i = first_line; i < last_line; i++) {
+        sprintf(buff, "%zu", i + 1);
+        render_text(ctx, buff, strlen(buff), SHAPE_NO_LINE,
+                    (vec2s){20 - x_offset, line_y(ctx, i)},
+                    (RnColor){150, 150, 150, 255}, true);
+    }
+
+    renderer->rect(renderer,
+                   (vec2s){x + cursor_pos.x - x_offset + max_width + 10,
+                           line_y(ctx, cursor.line)},
+                   (vec2s){1, 1.5f * font->size}, RN_WHITE);
+    for (size_t i = 0; ctx->extra_cursors && i < ctx->extra_cursors->count;
+         ++i) {
+        struct Cursor extra = ctx->extra_cursors->cursors[i];
+        if (extra.line < first_line || extra.line >= last_line) {
+            continue;
+        }
+        renderer->rect(renderer,
+                       (vec2s){x + get_cursor_pos(ctx, extra).x - x_offset +
+                                   max_width + 10,
+                               line_y(ctx, extra.line)},
+                       (vec2s){1, 1.5f * font->size}, RN_WHITE);
+    }
+
+    // Lines are shaped one at a time so unchanged ones hit the cache
+    const float text_x = x + max_width + 10;
+    LexState state = LEX_NORMAL;
+    if (is_highlighting(ctx)) {
+        state = prepare_highlight(ctx, tree, index, first_line);
+    }
+    for (size_t i = first_line; i < last_line; i++) {
+        int64_t collect_start = profile_now();
+        vec2s pos = {text_x - x_offset, line_y(ctx, i)};
+        size_t line_length = get_line_length(index, i);
+        render_selection(ctx, i, 0, line_length - (i + 1 < index->line_num),
+                         true, pos);
+        size_t length;
+        bool long_line = line_length > LONG_LINE_BYTES;
+        if (long_line) {
+            // Only copy the columns between the window edges
+            size_t first_column = x_offset / font->space_w;
+            size_t last_column = first_column + render_w / font->space_w + 1;
+            size_t start_column, end_column;
+            size_t start =
+                seek_column(ctx->column_cache, tree, index, i, first_column,
+                            font->tab_w, &start_column);
+            size_t end = seek_column(ctx->column_cache, tree, index, i,
+                                     last_column, font->tab_w, &end_column);
+            length = end - start;
+            if (!reserve_line_text(ctx, length)) {
+                break;
+            }
+            length = copy_range(tree->root,
+                                get_line_offset(index, i) + start, length,
+                                ctx->line_text);
+            pos.x += start_column * font->space_w;
+        } else {
+            length = copy_line(ctx, tree, index, i);
+        }
+        profile_record(PHASE_LEAF_COLLECT, collect_start, profile_now());
+        // Long lines are not lexed, see lex_until
+        if (is_highlighting(ctx) && !long_line) {
+            state =
+                tokenize_line(ctx->highlight, state, ctx->line_text, length);
+            render_spans(ctx, ctx->line_text, 0, length, i, pos);
+        } else {
+            render_text(ctx, ctx->line_text, length, i, pos, RN_WHITE, true);
+        }
+    }
+}
+
+void scroll_rows(RenderContext *ctx, float rows) {
+    ctx->scroll.pending += rows * ctx->font->size * 1.5f;
+}
+
+void render_document(RenderContext *ctx, RopeTree *tree, LineIndex *index,
+                     struct Cursor cursor, uint32_t render_w,
+                     uint32_t render_h) {
+    Renderer *renderer = ctx->renderer;
+    int64_t frame_start = profile_now();
+
+    renderer->begin(renderer, render_w, render_h,
+                    (RnColor){0x28, 0x28, 0x28, 0xff});
+
+    char buff[24];
+    sprintf(buff, "%zu", index->line_num);
+    float max_width =
+        render_text(ctx, buff, strlen(buff), SHAPE_NO_LINE, (vec2s){0, 0},
+                    RN_WHITE, false)
+            .x;
+
+    if (is_wrapping(ctx)) {
+        render_wrapped(ctx, tree, index, cursor, render_w, render_h,
+                       max_width);
+    } else {
+        render_unwrapped(ctx, tree, index, cursor, render_w, render_h,
+                         max_width);
+    }
+
+    if (ctx->show_hud) {
+        render_hud(ctx, render_w);
+    }
+    if (ctx->loading) {
+        render_load_progress(ctx, render_w, render_h);
+    }
+
+    renderer->end(renderer);
+    profile_record(PHASE_FRAME, frame_start, profile_now());
+    profile_frame_end();
+}
@@ -0,0 +1,98 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "column_cache.h"
+#include "cursor.h"
+#include "font_cache.h"
+#include "glyph_cache.h"
+#include "highlight.h"
+#include "memory_stats.h"
+#include "renderer.h"
+#include "rope.h"
+#include "shape_cache.h"
+#include "wrap.h"
+#include <cglm/types-struct.h>
+#include <runara/runara.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Extra lines laid out above and below the window
+#define OVERSCAN_LINES 2
+
+// Shaped lines are reused between frames until edited or evicted
+#define SHAPE_CACHE_CAPACITY 1024
+
+// Rows moved per mouse wheel step
+#define SCROLL_WHEEL_ROWS 3
+
+// Scrolling further than this while wrapping jumps through the wrap index
+// instead of stepping row by row, lines not wrapped yet count as one row
+#define SCROLL_STEP_ROWS 64
+
+// Top of the view, kept apart from the cursor so the document can be
+// scrolled without moving it
+typedef struct {
+    size_t line;        // line at the top of the window
+    size_t row;         // row of line at the top while wrapping
+    float pixel;        // part of the top row scrolled above the window
+    float pending;      // pixels to scroll by on the next frame
+    bool follow_cursor; // bring the cursor into view on the next frame
+} Scroll;
+
+// Everything layout needs besides the document itself
+typedef struct {
+    Renderer *renderer;
+    FontCache *fonts;
+    RnFont *font; // current size, owned by fonts
+    ShapeCache *shape_cache;
+    GlyphCache *glyph_cache;   // glyphs of font, owned by fonts
+    WrapIndex *wrap;           // soft wrap rows, used while enabled
+    ColumnCache *column_cache; // column checkpoints of long lines
+    HighlightIndex *highlight; // lexer states, plain text if null
+    Scroll scroll;
+    const CursorList *extra_cursors; // drawn besides the cursor, may be null
+    // text from selection_start up to selection_end is highlighted while set
+    bool has_selection;
+    struct Cursor selection_start;
+    struct Cursor selection_end;
+    char *line_text; // line copied out of the rope while drawing
+    size_t line_capacity;
+    // lines drawn by the last frame
+    size_t first_line;
+    size_t last_line;
+    bool show_hud;      // frame time and memory overlay
+    MemoryStats memory; // filled in by the editor while the HUD shows
+    // a file streaming in, shown as a bar along the bottom
+    bool loading;
+    float load_progress;
+} RenderContext;
+
+// Switches to size and returns its font, keeps the current one if loading
+// fails
+RnFont *set_render_font_size(RenderContext *ctx, uint32_t size);
+
+vec2s get_cursor_pos(RenderContext *ctx, struct Cursor cursor);
+
+// Lays out one line without new lines, draws it if render is set and
+// returns the pen position after the last glyph
+vec2s render_text(RenderContext *ctx, const char *text, size_t length,
+                  size_t line, vec2s pos, RnColor color, bool render);
+
+// Scrolls the view by rows on the next frame, negative rows scroll up
+void scroll_rows(RenderContext *ctx, float rows);
+
+// Draws p50/p99 of every profiled phase and the memory held in the top
+// right corner
+void render_hud(RenderContext *ctx, uint32_t render_w);
+
+// Draws how much of the loading file was read along the bottom edge
+void render_load_progress(RenderContext *ctx, uint32_t render_w,
+                          uint32_t render_h);
+
+// Draws the visible part of the document with gutter and cursor
+void render_document(RenderContext *ctx, RopeTree *tree, LineIndex *index,
+                     struct Cursor cursor, uint32_t render_w,
+                     uint32_t render_h);
+
+#endif
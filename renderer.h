@@ -0,0 +1,54 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "glyph_cache.h"
+#include <X11/Xlib.h>
+#include <cglm/types-struct.h>
+#include <runara/runara.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct Renderer Renderer;
+
+// Drawing backend used by the layout code in render.c
+struct Renderer {
+    void (*begin)(Renderer *renderer, uint32_t width, uint32_t height,
+                  RnColor clear_color);
+    void (*rect)(Renderer *renderer, vec2s pos, vec2s size, RnColor color);
+    // pos is the top left of the line box, the baseline is font->size below
+    void (*glyph)(Renderer *renderer, GlyphCache *cache, RnFont *font,
+                  uint32_t glyph_index, uint32_t codepoint, vec2s pos,
+                  RnColor color);
+    void (*end)(Renderer *renderer);
+    // fonts are owned by the backend that rasterizes them
+    RnFont *(*load_font)(Renderer *renderer, const char *path, uint32_t size);
+    void (*free_font)(Renderer *renderer, RnFont *font);
+    void (*destroy)(Renderer *renderer);
+    void *data;
+};
+
+// runara / GLX backend drawing into a window
+[[nodiscard]]
+Renderer *create_gl_renderer(RnState *state, Display *dsp, Window win);
+
+// Records frames on the calling thread and draws them into target on a
+// thread of its own, which runs attach first to take over the GL context.
+// A frame not drawn yet when the next one ends is skipped. Fonts are loaded
+// and freed on the render thread too
+[[nodiscard]]
+Renderer *create_threaded_renderer(Renderer *target, void (*attach)(void *),
+                                   void *attach_data);
+
+// CPU backend rasterizing with FreeType into an RGB framebuffer
+[[nodiscard]]
+Renderer *create_soft_renderer();
+
+bool soft_renderer_write_ppm(Renderer *renderer, const char *path);
+
+// Font for the CPU backend, loaded without a GL context
+[[nodiscard]]
+RnFont *soft_load_font(const char *path, uint32_t size);
+
+void soft_free_font(RnFont *font);
+
+#endif
@@ -0,0 +1,151 @@
+#include "renderer.h"
+#include "profiler.h"
+#include <GL/gl.h>
+#include <GL/glx.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    RnState *state;
+    Display *dsp;
+    Window win;
+} GLRenderer;
+
+static GlyphSlot *find_slot(GlyphSlot *slots, size_t slot_count,
+                            uint32_t glyph_index) {
+    size_t i = (glyph_index * 2654435761u) & (slot_count - 1);
+    while (slots[i].used && slots[i].glyph_index != glyph_index) {
+        i = (i + 1) & (slot_count - 1);
+    }
+    return &slots[i];
+}
+
+static void grow_slots(GlyphCache *cache) {
+    size_t new_count = cache->slot_count * 2;
+    GlyphSlot *new_slots = calloc(new_count, sizeof(GlyphSlot));
+    for (size_t i = 0; i < cache->slot_count; ++i) {
+        if (cache->slots[i].used) {
+            *find_slot(new_slots, new_count, cache->slots[i].glyph_index) =
+                cache->slots[i];
+        }
+    }
+    free(cache->slots);
+    cache->slots = new_slots;
+    cache->slot_count = new_count;
+}
+
+// Glyph for an ASCII character without shaping
+static RnGlyph get_ascii_glyph(GlyphCache *cache, RnState *state,
+                               RnFont *font, unsigned char c) {
+    if (!cache->ascii_loaded[c]) {
+        cache->ascii[c] =
+            rn_glyph_from_codepoint(state, font, cache->ascii_index[c]);
+        cache->ascii_loaded[c] = true;
+    }
+    return cache->ascii[c];
+}
+
+// Glyph for a shaped glyph index, codepoint is the source character
+static RnGlyph get_cached_glyph(GlyphCache *cache, RnState *state,
+                                RnFont *font, uint32_t glyph_index,
+                                uint32_t codepoint) {
+    if (codepoint < GLYPH_ASCII_COUNT &&
+        cache->ascii_index[codepoint] == glyph_index) {
+        return get_ascii_glyph(cache, state, font, codepoint);
+    }
+
+    GlyphSlot *slot = find_slot(cache->slots, cache->slot_count, glyph_index);
+    if (slot->used) {
+        return slot->glyph;
+    }
+
+    // keep load factor under 3/4
+    if ((cache->used + 1) * 4 > cache->slot_count * 3) {
+        grow_slots(cache);
+        slot = find_slot(cache->slots, cache->slot_count, glyph_index);
+    }
+    slot->used = true;
+    slot->glyph_index = glyph_index;
+    slot->glyph = rn_glyph_from_codepoint(state, font, glyph_index);
+    cache->used++;
+    return slot->glyph;
+}
+
+static void gl_begin(Renderer *renderer, uint32_t width, uint32_t height,
+                     RnColor clear_color) {
+    GLRenderer *gl = renderer->data;
+    vec4s color = rn_color_to_zto(clear_color);
+    glClearColor(color.r, color.g, color.b, color.a);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    rn_resize_display(gl->state, width, height);
+    rn_begin(gl->state);
+}
+
+static void gl_rect(Renderer *renderer, vec2s pos, vec2s size, RnColor color) {
+    GLRenderer *gl = renderer->data;
+    rn_rect_render(gl->state, pos, size, color);
+}
+
+static void gl_glyph(Renderer *renderer, GlyphCache *cache, RnFont *font,
+                     uint32_t glyph_index, uint32_t codepoint, vec2s pos,
+                     RnColor color) {
+    GLRenderer *gl = renderer->data;
+    RnGlyph glyph =
+        get_cached_glyph(cache, gl->state, font, glyph_index, codepoint);
+    rn_glyph_render(gl->state, glyph, *font,
+                    (vec2s){pos.x, pos.y + font->size}, color);
+}
+
+static void gl_end(Renderer *renderer) {
+    GLRenderer *gl = renderer->data;
+    // flushing the batch is where glyphs reach the GPU
+    int64_t flush_start = profile_now();
+    rn_end(gl->state);
+    int64_t swap_start = profile_now();
+    glXSwapBuffers(gl->dsp, gl->win);
+    // the frame is on screen once the swap finished
+    glFinish();
+    profile_record(PHASE_GLYPHS, flush_start, swap_start);
+    profile_record(PHASE_SWAP, swap_start, profile_now());
+}
+
+static RnFont *gl_load_font(Renderer *renderer, const char *path,
+                            uint32_t size) {
+    GLRenderer *gl = renderer->data;
+    return rn_load_font(gl->state, path, size);
+}
+
+static void gl_free_font(Renderer *renderer, RnFont *font) {
+    GLRenderer *gl = renderer->data;
+    rn_free_font(gl->state, font);
+}
+
+static void gl_destroy(Renderer *renderer) {
+    free(renderer->data);
+    free(renderer);
+}
+
+Renderer *create_gl_renderer(RnState *state, Display *dsp, Window win) {
+    Renderer *renderer = malloc(sizeof(Renderer));
+    GLRenderer *gl = malloc(sizeof(GLRenderer));
+    if (!renderer || !gl) {
+        perror("Failed to allocate renderer");
+        free(renderer);
+        free(gl);
+        return nullptr;
+    }
+    gl->state = state;
+    gl->dsp = dsp;
+    gl->win = win;
+
+    renderer->begin = gl_begin;
+    renderer->rect = gl_rect;
+    renderer->glyph = gl_glyph;
+    renderer->end = gl_end;
+    renderer->load_font = gl_load_font;
+    renderer->free_font = gl_free_font;
+    renderer->destroy = gl_destroy;
+    renderer->data = gl;
+    return renderer;
+}
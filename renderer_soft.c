@@ -0,0 +1,245 @@
+#include "renderer.h"
+#include <harfbuzz/hb-ft.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SOFT_GLYPH_SLOTS_INITIAL 256
+
+// Rasterized coverage bitmap of one glyph
+typedef struct {
+    uint32_t glyph_index;
+    bool used;
+    int32_t left;
+    int32_t top;
+    uint32_t width;
+    uint32_t height;
+    uint8_t *coverage;
+} SoftGlyph;
+
+typedef struct {
+    uint8_t *pixels; // RGB, row major
+    uint32_t width;
+    uint32_t height;
+    uint64_t font_id; // font the cached bitmaps belong to
+    uint32_t font_size;
+    SoftGlyph *glyphs;
+    size_t glyph_slots;
+    size_t glyph_used;
+} SoftRenderer;
+
+static FT_Library ft_library;
+static uint64_t next_font_id = 1;
+
+static void clear_glyphs(SoftRenderer *soft) {
+    for (size_t i = 0; i < soft->glyph_slots; ++i) {
+        free(soft->glyphs[i].coverage);
+    }
+    memset(soft->glyphs, 0, soft->glyph_slots * sizeof(SoftGlyph));
+    soft->glyph_used = 0;
+}
+
+static SoftGlyph *find_glyph(SoftGlyph *glyphs, size_t slots,
+                             uint32_t glyph_index) {
+    size_t i = (glyph_index * 2654435761u) & (slots - 1);
+    while (glyphs[i].used && glyphs[i].glyph_index != glyph_index) {
+        i = (i + 1) & (slots - 1);
+    }
+    return &glyphs[i];
+}
+
+static SoftGlyph *load_glyph(SoftRenderer *soft, RnFont *font,
+                             uint32_t glyph_index) {
+    if (font->id != soft->font_id || font->size != soft->font_size) {
+        clear_glyphs(soft);
+        soft->font_id = font->id;
+        soft->font_size = font->size;
+    }
+
+    SoftGlyph *glyph = find_glyph(soft->glyphs, soft->glyph_slots, glyph_index);
+    if (glyph->used) {
+        return glyph;
+    }
+
+    if ((soft->glyph_used + 1) * 4 > soft->glyph_slots * 3) {
+        size_t new_slots = soft->glyph_slots * 2;
+        SoftGlyph *new_glyphs = calloc(new_slots, sizeof(SoftGlyph));
+        for (size_t i = 0; i < soft->glyph_slots; ++i) {
+            if (soft->glyphs[i].used) {
+                *find_glyph(new_glyphs, new_slots,
+                            soft->glyphs[i].glyph_index) = soft->glyphs[i];
+            }
+        }
+        free(soft->glyphs);
+        soft->glyphs = new_glyphs;
+        soft->glyph_slots = new_slots;
+        glyph = find_glyph(soft->glyphs, soft->glyph_slots, glyph_index);
+    }
+
+    glyph->used = true;
+    glyph->glyph_index = glyph_index;
+    glyph->coverage = nullptr;
+    glyph->width = glyph->height = 0;
+    glyph->left = glyph->top = 0;
+    soft->glyph_used++;
+
+    if (FT_Load_Glyph(font->face, glyph_index, FT_LOAD_RENDER)) {
+        return glyph;
+    }
+    FT_GlyphSlot slot = font->face->glyph;
+    glyph->left = slot->bitmap_left;
+    glyph->top = slot->bitmap_top;
+    glyph->width = slot->bitmap.width;
+    glyph->height = slot->bitmap.rows;
+    glyph->coverage = malloc(glyph->width * glyph->height);
+    for (uint32_t row = 0; row < glyph->height; ++row) {
+        memcpy(glyph->coverage + row * glyph->width,
+               slot->bitmap.buffer + row * slot->bitmap.pitch, glyph->width);
+    }
+    return glyph;
+}
+
+static void blend_pixel(SoftRenderer *soft, int32_t x, int32_t y,
+                        RnColor color, uint32_t alpha) {
+    if (x < 0 || y < 0 || (uint32_t)x >= soft->width ||
+        (uint32_t)y >= soft->height) {
+        return;
+    }
+    uint8_t *p = soft->pixels + ((size_t)y * soft->width + x) * 3;
+    p[0] += ((int32_t)color.r - p[0]) * (int32_t)alpha / 255;
+    p[1] += ((int32_t)color.g - p[1]) * (int32_t)alpha / 255;
+    p[2] += ((int32_t)color.b - p[2]) * (int32_t)alpha / 255;
+}
+
+static void soft_begin(Renderer *renderer, uint32_t width, uint32_t height,
+                       RnColor clear_color) {
+    SoftRenderer *soft = renderer->data;
+    if (width != soft->width || height != soft->height) {
+        free(soft->pixels);
+        soft->pixels = malloc((size_t)width * height * 3);
+        soft->width = width;
+        soft->height = height;
+    }
+    for (size_t i = 0; i < (size_t)width * height; ++i) {
+        soft->pixels[i * 3 + 0] = clear_color.r;
+        soft->pixels[i * 3 + 1] = clear_color.g;
+        soft->pixels[i * 3 + 2] = clear_color.b;
+    }
+}
+
+static void soft_rect(Renderer *renderer, vec2s pos, vec2s size,
+                      RnColor color) {
+    SoftRenderer *soft = renderer->data;
+    for (int32_t y = pos.y; y < (int32_t)(pos.y + size.y); ++y) {
+        for (int32_t x = pos.x; x < (int32_t)(pos.x + size.x); ++x) {
+            blend_pixel(soft, x, y, color, color.a);
+        }
+    }
+}
+
+static void soft_glyph(Renderer *renderer, GlyphCache *cache, RnFont *font,
+                       uint32_t glyph_index, uint32_t codepoint, vec2s pos,
+                       RnColor color) {
+    SoftRenderer *soft = renderer->data;
+    SoftGlyph *glyph = load_glyph(soft, font, glyph_index);
+
+    int32_t x0 = (int32_t)pos.x + glyph->left;
+    int32_t y0 = (int32_t)(pos.y + font->size) - glyph->top;
+    for (uint32_t row = 0; row < glyph->height; ++row) {
+        for (uint32_t col = 0; col < glyph->width; ++col) {
+            uint32_t coverage = glyph->coverage[row * glyph->width + col];
+            if (coverage) {
+                blend_pixel(soft, x0 + col, y0 + row, color,
+                            coverage * color.a / 255);
+            }
+        }
+    }
+}
+
+static void soft_end(Renderer *) {}
+
+static void soft_destroy(Renderer *renderer) {
+    SoftRenderer *soft = renderer->data;
+    clear_glyphs(soft);
+    free(soft->glyphs);
+    free(soft->pixels);
+    free(soft);
+    free(renderer);
+}
+
+static RnFont *soft_renderer_load_font(Renderer *, const char *path,
+                                       uint32_t size) {
+    return soft_load_font(path, size);
+}
+
+static void soft_renderer_free_font(Renderer *, RnFont *font) {
+    soft_free_font(font);
+}
+
+Renderer *create_soft_renderer() {
+    Renderer *renderer = malloc(sizeof(Renderer));
+    SoftRenderer *soft = calloc(1, sizeof(SoftRenderer));
+    if (!renderer || !soft) {
+        perror("Failed to allocate renderer");
+        free(renderer);
+        free(soft);
+        return nullptr;
+    }
+    soft->glyph_slots = SOFT_GLYPH_SLOTS_INITIAL;
+    soft->glyphs = calloc(soft->glyph_slots, sizeof(SoftGlyph));
+
+    renderer->begin = soft_begin;
+    renderer->rect = soft_rect;
+    renderer->glyph = soft_glyph;
+    renderer->end = soft_end;
+    renderer->load_font = soft_renderer_load_font;
+    renderer->free_font = soft_renderer_free_font;
+    renderer->destroy = soft_destroy;
+    renderer->data = soft;
+    return renderer;
+}
+
+bool soft_renderer_write_ppm(Renderer *renderer, const char *path) {
+    SoftRenderer *soft = renderer->data;
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        perror("Failed to open file");
+        return false;
+    }
+    fprintf(fp, "P6\n%u %u\n255\n", soft->width, soft->height);
+    size_t size = (size_t)soft->width * soft->height * 3;
+    bool ok = fwrite(soft->pixels, 1, size, fp) == size;
+    fclose(fp);
+    return ok;
+}
+
+RnFont *soft_load_font(const char *path, uint32_t size) {
+    if (!ft_library && FT_Init_FreeType(&ft_library)) {
+        fprintf(stderr, "Failed to initialize FreeType\n");
+        return nullptr;
+    }
+    RnFont *font = calloc(1, sizeof(RnFont));
+    if (FT_New_Face(ft_library, path, 0, &font->face)) {
+        fprintf(stderr, "Failed to load font %s\n", path);
+        free(font);
+        return nullptr;
+    }
+    FT_Set_Pixel_Sizes(font->face, 0, size);
+    font->hb_font = hb_ft_font_create_referenced(font->face);
+    font->size = size;
+    font->tab_w = 4;
+    if (!FT_Load_Char(font->face, ' ', FT_LOAD_DEFAULT)) {
+        font->space_w = font->face->glyph->advance.x >> 6;
+    }
+    font->id = next_font_id++;
+    return font;
+}
+
+void soft_free_font(RnFont *font) {
+    if (!font) {
+        return;
+    }
+    hb_font_destroy(font->hb_font);
+    FT_Done_Face(font->face);
+    free(font);
+}
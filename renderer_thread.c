@@ -0,0 +1,323 @@
+#include "profiler.h"
+#include "renderer.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DRAW_COMMANDS_INITIAL 4096
+
+typedef enum { DRAW_RECT, DRAW_GLYPH } DrawKind;
+
+typedef struct {
+    DrawKind kind;
+    vec2s pos;
+    RnColor color;
+    vec2s size; // of rects
+    // of glyphs
+    GlyphCache *cache;
+    RnFont *font;
+    uint32_t glyph_index;
+    uint32_t codepoint;
+} DrawCommand;
+
+// Everything one frame draws, replayed as a whole on the render thread
+typedef struct {
+    DrawCommand *commands;
+    size_t count;
+    size_t capacity;
+    uint32_t width;
+    uint32_t height;
+    RnColor clear_color;
+    int64_t input_ns; // earliest input the frame shows, 0 if none
+} DrawFrame;
+
+typedef enum {
+    REQUEST_NONE,
+    REQUEST_LOAD_FONT,
+    REQUEST_FREE_FONT,
+} FontRequest;
+
+typedef struct {
+    Renderer *target;
+    pthread_t thread;
+    void (*attach)(void *data);
+    void *attach_data;
+    // held while a frame is recorded or replayed and while fonts are loaded,
+    // shaping and rasterizing share FreeType faces, which are not thread
+    // safe
+    pthread_mutex_t fonts;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // a frame, a font request or quit is waiting
+    pthread_cond_t done; // the font request was carried out
+    // guarded by lock, exactly one of pending and spare is set
+    DrawFrame *pending; // published and not drawn yet
+    DrawFrame *spare;
+    FontRequest request;
+    const char *path;
+    uint32_t size;
+    RnFont *font;
+    bool quit;
+    // owned by the recording thread
+    DrawFrame *recording;
+    bool failed; // a command could not be stored, the frame is dropped
+    // owned by the render thread
+    DrawFrame *shown;
+} ThreadedRenderer;
+
+static void replay_frame(ThreadedRenderer *threaded, DrawFrame *frame) {
+    Renderer *target = threaded->target;
+    pthread_mutex_lock(&threaded->fonts);
+    target->begin(target, frame->width, frame->height, frame->clear_color);
+    for (size_t i = 0; i < frame->count; ++i) {
+        DrawCommand *command = &frame->commands[i];
+        if (command->kind == DRAW_RECT) {
+            target->rect(target, command->pos, command->size, command->color);
+        } else {
+            target->glyph(target, command->cache, command->font,
+                          command->glyph_index, command->codepoint,
+                          command->pos, command->color);
+        }
+    }
+    pthread_mutex_unlock(&threaded->fonts);
+    // swapping blocks until the display takes the frame, the recording
+    // thread goes on handling input meanwhile
+    target->end(target);
+    if (frame->input_ns) {
+        profile_latency(frame->input_ns, profile_now());
+    }
+}
+
+static void serve_font_request(ThreadedRenderer *threaded) {
+    Renderer *target = threaded->target;
+    pthread_mutex_lock(&threaded->fonts);
+    if (threaded->request == REQUEST_LOAD_FONT) {
+        threaded->font =
+            target->load_font(target, threaded->path, threaded->size);
+    } else {
+        target->free_font(target, threaded->font);
+    }
+    pthread_mutex_unlock(&threaded->fonts);
+}
+
+static void *draw_frames(void *arg) {
+    ThreadedRenderer *threaded = arg;
+    threaded->attach(threaded->attach_data);
+    pthread_mutex_lock(&threaded->lock);
+    while (!threaded->quit) {
+        if (threaded->pending) {
+            // frames published before a request are drawn first, they may
+            // use a font the request frees
+            threaded->spare = threaded->shown;
+            threaded->shown = threaded->pending;
+            threaded->pending = nullptr;
+            pthread_mutex_unlock(&threaded->lock);
+            replay_frame(threaded, threaded->shown);
+            pthread_mutex_lock(&threaded->lock);
+        } else if (threaded->request != REQUEST_NONE) {
+            serve_font_request(threaded);
+            threaded->request = REQUEST_NONE;
+            pthread_cond_signal(&threaded->done);
+        } else {
+            pthread_cond_wait(&threaded->wake, &threaded->lock);
+        }
+    }
+    pthread_mutex_unlock(&threaded->lock);
+    return nullptr;
+}
+
+// Runs a font request on the render thread, which has the GL context
+static void request_font(ThreadedRenderer *threaded, FontRequest request) {
+    pthread_mutex_lock(&threaded->lock);
+    threaded->request = request;
+    pthread_cond_signal(&threaded->wake);
+    while (threaded->request != REQUEST_NONE) {
+        pthread_cond_wait(&threaded->done, &threaded->lock);
+    }
+    pthread_mutex_unlock(&threaded->lock);
+}
+
+static void threaded_begin(Renderer *renderer, uint32_t width,
+                           uint32_t height, RnColor clear_color) {
+    ThreadedRenderer *threaded = renderer->data;
+    pthread_mutex_lock(&threaded->fonts);
+    DrawFrame *frame = threaded->recording;
+    frame->count = 0;
+    frame->width = width;
+    frame->height = height;
+    frame->clear_color = clear_color;
+    threaded->failed = false;
+}
+
+static DrawCommand *add_command(ThreadedRenderer *threaded) {
+    DrawFrame *frame = threaded->recording;
+    if (frame->count == frame->capacity) {
+        size_t new_cap =
+            frame->capacity ? frame->capacity * 2 : DRAW_COMMANDS_INITIAL;
+        DrawCommand *grown =
+            realloc(frame->commands, new_cap * sizeof(DrawCommand));
+        if (!grown) {
+            if (!threaded->failed) {
+                perror("Failed to allocate draw commands");
+            }
+            threaded->failed = true;
+            return nullptr;
+        }
+        frame->commands = grown;
+        frame->capacity = new_cap;
+    }
+    return &frame->commands[frame->count++];
+}
+
+static void threaded_rect(Renderer *renderer, vec2s pos, vec2s size,
+                          RnColor color) {
+    DrawCommand *command = add_command(renderer->data);
+    if (command) {
+        *command = (DrawCommand){
+            .kind = DRAW_RECT, .pos = pos, .color = color, .size = size};
+    }
+}
+
+static void threaded_glyph(Renderer *renderer, GlyphCache *cache,
+                           RnFont *font, uint32_t glyph_index,
+                           uint32_t codepoint, vec2s pos, RnColor color) {
+    DrawCommand *command = add_command(renderer->data);
+    if (command) {
+        *command = (DrawCommand){.kind = DRAW_GLYPH,
+                                 .pos = pos,
+                                 .color = color,
+                                 .cache = cache,
+                                 .font = font,
+                                 .glyph_index = glyph_index,
+                                 .codepoint = codepoint};
+    }
+}
+
+// Publishes the frame, one still waiting to be drawn is replaced by it
+static void threaded_end(Renderer *renderer) {
+    ThreadedRenderer *threaded = renderer->data;
+    pthread_mutex_unlock(&threaded->fonts);
+    DrawFrame *frame = threaded->recording;
+    frame->input_ns = profile_take_input();
+    if (threaded->failed) {
+        // the input is shown by the next frame instead
+        if (frame->input_ns) {
+            profile_input(frame->input_ns);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&threaded->lock);
+    DrawFrame *dropped = threaded->pending;
+    if (dropped) {
+        if (dropped->input_ns &&
+            (!frame->input_ns || dropped->input_ns < frame->input_ns)) {
+            frame->input_ns = dropped->input_ns;
+        }
+        threaded->recording = dropped;
+    } else {
+        threaded->recording = threaded->spare;
+        threaded->spare = nullptr;
+    }
+    threaded->pending = frame;
+    pthread_cond_signal(&threaded->wake);
+    pthread_mutex_unlock(&threaded->lock);
+}
+
+static RnFont *threaded_load_font(Renderer *renderer, const char *path,
+                                  uint32_t size) {
+    ThreadedRenderer *threaded = renderer->data;
+    threaded->path = path;
+    threaded->size = size;
+    request_font(threaded, REQUEST_LOAD_FONT);
+    return threaded->font;
+}
+
+static void threaded_free_font(Renderer *renderer, RnFont *font) {
+    ThreadedRenderer *threaded = renderer->data;
+    threaded->font = font;
+    request_font(threaded, REQUEST_FREE_FONT);
+}
+
+static void free_frame(DrawFrame *frame) {
+    if (frame) {
+        free(frame->commands);
+        free(frame);
+    }
+}
+
+static void threaded_destroy(Renderer *renderer) {
+    ThreadedRenderer *threaded = renderer->data;
+    pthread_mutex_lock(&threaded->lock);
+    threaded->quit = true;
+    pthread_cond_signal(&threaded->wake);
+    pthread_mutex_unlock(&threaded->lock);
+    pthread_join(threaded->thread, nullptr);
+
+    threaded->target->destroy(threaded->target);
+    free_frame(threaded->recording);
+    free_frame(threaded->pending);
+    free_frame(threaded->spare);
+    free_frame(threaded->shown);
+    pthread_cond_destroy(&threaded->done);
+    pthread_cond_destroy(&threaded->wake);
+    pthread_mutex_destroy(&threaded->lock);
+    pthread_mutex_destroy(&threaded->fonts);
+    free(threaded);
+    free(renderer);
+}
+
+Renderer *create_threaded_renderer(Renderer *target, void (*attach)(void *),
+                                   void *attach_data) {
+    Renderer *renderer = malloc(sizeof(Renderer));
+    ThreadedRenderer *threaded = calloc(1, sizeof(ThreadedRenderer));
+    DrawFrame *frames[3] = {calloc(1, sizeof(DrawFrame)),
+                            calloc(1, sizeof(DrawFrame)),
+                            calloc(1, sizeof(DrawFrame))};
+    if (!renderer || !threaded || !frames[0] || !frames[1] || !frames[2]) {
+        perror("Failed to allocate renderer");
+        free(renderer);
+        free(threaded);
+        for (size_t i = 0; i < 3; ++i) {
+            free(frames[i]);
+        }
+        return nullptr;
+    }
+    threaded->target = target;
+    threaded->attach = attach;
+    threaded->attach_data = attach_data;
+    threaded->recording = frames[0];
+    threaded->spare = frames[1];
+    threaded->shown = frames[2];
+    pthread_mutex_init(&threaded->fonts, nullptr);
+    pthread_mutex_init(&threaded->lock, nullptr);
+    pthread_cond_init(&threaded->wake, nullptr);
+    pthread_cond_init(&threaded->done, nullptr);
+
+    int error =
+        pthread_create(&threaded->thread, nullptr, draw_frames, threaded);
+    if (error) {
+        fprintf(stderr, "Failed to start render thread: %s\n",
+                strerror(error));
+        pthread_cond_destroy(&threaded->done);
+        pthread_cond_destroy(&threaded->wake);
+        pthread_mutex_destroy(&threaded->lock);
+        pthread_mutex_destroy(&threaded->fonts);
+        for (size_t i = 0; i < 3; ++i) {
+            free(frames[i]);
+        }
+        free(threaded);
+        free(renderer);
+        return nullptr;
+    }
+
+    renderer->begin = threaded_begin;
+    renderer->rect = threaded_rect;
+    renderer->glyph = threaded_glyph;
+    renderer->end = threaded_end;
+    renderer->load_font = threaded_load_font;
+    renderer->free_font = threaded_free_font;
+    renderer->destroy = threaded_destroy;
+    renderer->data = threaded;
+    return renderer;
+}
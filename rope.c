@@ -1,5 +1,6 @@
 #include "rope.h"
 #include <math.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -7,32 +8,139 @@
 #include <string.h>
 #include <unistd.h>
 
-Node *create_leaf(const char *data) {
+// Live counts of every rope, the loader builds nodes on its worker thread
+static atomic_size_t live_internal;
+static atomic_size_t live_leaves;
+static atomic_size_t live_lazy;
+static atomic_size_t live_leaf_bytes;
+static atomic_size_t live_leaf_capacity;
+
+static void count(atomic_size_t *counter, size_t amount) {
+    atomic_fetch_add_explicit(counter, amount, memory_order_relaxed);
+}
+
+static void uncount(atomic_size_t *counter, size_t amount) {
+    atomic_fetch_sub_explicit(counter, amount, memory_order_relaxed);
+}
+
+RopeStats rope_stats() {
+    return (RopeStats){
+        .internal_nodes = atomic_load(&live_internal),
+        .leaves = atomic_load(&live_leaves),
+        .lazy_leaves = atomic_load(&live_lazy),
+        .leaf_bytes = atomic_load(&live_leaf_bytes),
+        .leaf_capacity = atomic_load(&live_leaf_capacity),
+    };
+}
+
+Node *create_leaf_from(const char *text, size_t length) {
     Node *node = malloc(sizeof(Node));
     if (!node) {
         perror("Failed to allocate leaf node");
     }
 
-    node->rank = strlen(data);
-    node->data = strndup(data, node->rank + 1);
-    node->data[node->rank] = '\0';
+    node->rank = length;
+    node->data = malloc(length + 1);
+    memcpy(node->data, text, length);
+    node->data[length] = '\0';
+    count(&live_leaves, 1);
+    count(&live_leaf_bytes, node->rank);
+    count(&live_leaf_capacity, node->rank + 1);
+    node->lazy = nullptr;
     node->left = nullptr;
     node->right = nullptr;
+    node->height = 1;
+    node->refs = 0;
     return node;
 }
 
+Node *create_leaf(const char *data) {
+    return create_leaf_from(data, strlen(data));
+}
+
+static uint32_t node_height(const Node *node) {
+    return node ? node->height : 0;
+}
+
+// Sets the height of node after its children changed
+static void update_height(Node *node) {
+    node->height = MAX(node_height(node->left), node_height(node->right)) + 1;
+}
+
 Node *create_internal(Node *left, Node *right) {
     Node *node = malloc(sizeof(Node));
     if (!node) {
         perror("Failed to allocate internal node");
     }
     node->data = nullptr;
+    node->lazy = nullptr;
     node->left = left;
     node->right = right;
     node->rank = calculate_rank(node);
+    update_height(node);
+    node->refs = 0;
+    count(&live_internal, 1);
     return node;
 }
 
+Node *create_lazy_leaf(PagedFile *file, size_t offset, size_t length) {
+    Node *node = malloc(sizeof(Node));
+    LazyRange *lazy = malloc(sizeof(LazyRange));
+    if (!node || !lazy) {
+        perror("Failed to allocate lazy leaf");
+        free(node);
+        free(lazy);
+        return nullptr;
+    }
+    *lazy = (LazyRange){file, offset};
+    count(&live_lazy, 1);
+    node->rank = length;
+    node->data = nullptr;
+    node->lazy = lazy;
+    node->left = nullptr;
+    node->right = nullptr;
+    node->height = 1;
+    node->refs = 0;
+    return node;
+}
+
+static Node *share_node(Node *node) {
+    if (node) {
+        node->refs++;
+    }
+    return node;
+}
+
+// node itself if nothing else holds it, else a copy for the caller that
+// shares its children. Changes copy the path down to what they change so
+// the other owners keep seeing the old text
+static Node *own_node(Node *node) {
+    if (!node || !node->refs) {
+        return node;
+    }
+    Node *copy;
+    if (node->left || node->right) {
+        copy = create_internal(share_node(node->left),
+                               share_node(node->right));
+    } else if (node->lazy) {
+        copy = create_lazy_leaf(node->lazy->file, node->lazy->offset,
+                                node->rank);
+    } else {
+        copy = create_leaf_from(node->data, node->rank);
+    }
+    node->refs--;
+    return copy;
+}
+
+const char *leaf_text(Node *leaf) {
+    if (!leaf->lazy) {
+        return leaf->data;
+    }
+    LazyRange *lazy = leaf->lazy;
+    const char *page = page_in(lazy->file, lazy->offset / FILE_PAGE_SPAN);
+    return page ? page + lazy->offset % FILE_PAGE_SPAN : nullptr;
+}
+
 RopeTree *build_rope(char **chunks, size_t start, size_t end) {
     RopeTree *tree = malloc(sizeof(RopeTree));
     tree->root = _build_rope(chunks, start, end);
@@ -42,6 +150,51 @@ RopeTree *build_rope(char **chunks, size_t start, size_t end) {
     return tree;
 }
 
+RopeTree *build_rope_from_file(FILE *fp) {
+    fseek(fp, 0, SEEK_END);
+    size_t file_size = ftell(fp);
+    rewind(fp);
+    RopeTree *tree = create_tree();
+    if (file_size == 0) {
+        return tree;
+    }
+
+    char *text = malloc(file_size);
+    if (!text) {
+        perror("Failed to allocate file buffer");
+        return tree;
+    }
+    size_t read = fread(text, 1, file_size, fp);
+    tree->root = build_node_from_text(text, read);
+    free(text);
+    tree->height = calc_tree_height(tree->root);
+    tree->length = calculate_length(tree->root);
+    tree->nodes_count = count_nodes(tree->root);
+    return tree;
+}
+
+// Leaves for chunks start to end of text, CHUNK_BASE bytes each
+static Node *build_text_leaves(const char *text, size_t length, size_t start,
+                               size_t end) {
+    if (start == end) {
+        size_t offset = start * CHUNK_BASE;
+        return create_leaf_from(text + offset,
+                                MIN(CHUNK_BASE, length - offset));
+    }
+    size_t mid = (start + end) / 2;
+    Node *left = build_text_leaves(text, length, start, mid);
+    Node *right = build_text_leaves(text, length, mid + 1, end);
+    return create_internal(left, right);
+}
+
+Node *build_node_from_text(const char *text, size_t length) {
+    if (length == 0) {
+        return nullptr;
+    }
+    size_t chunk_num = (length + CHUNK_BASE - 1) / CHUNK_BASE;
+    return build_text_leaves(text, length, 0, chunk_num - 1);
+}
+
 Node *_build_rope(char **chunks, size_t start, size_t end) {
     if (start == end) {
         return create_leaf(chunks[start]);
@@ -58,9 +211,40 @@ RopeTree *create_tree() {
     tree->length = 0;
     tree->height = 0;
     tree->nodes_count = 0;
+    tree->file = nullptr;
     return tree;
 }
 
+// Last or first leaf of tree, the nodes down to it are owned by tree alone
+// afterwards so it can be changed in place
+static Node *own_edge_leaf(RopeTree *tree, bool last) {
+    Node **at = &tree->root;
+    *at = own_node(*at);
+    while (last ? (*at)->right : (*at)->left) {
+        at = last ? &(*at)->right : &(*at)->left;
+        *at = own_node(*at);
+    }
+    return *at;
+}
+
+// Adds data to the text of leaf, in front of it if front is set
+static void grow_leaf(Node *leaf, const char *data, bool front) {
+    size_t length = strlen(data);
+    char *text = malloc(leaf->rank + length + 1);
+    if (!text) {
+        perror("Failed to grow leaf");
+        return;
+    }
+    memcpy(text + (front ? length : 0), leaf->data, leaf->rank);
+    memcpy(text + (front ? 0 : leaf->rank), data, length);
+    text[leaf->rank + length] = '\0';
+    free(leaf->data);
+    leaf->data = text;
+    leaf->rank += length;
+    count(&live_leaf_bytes, length);
+    count(&live_leaf_capacity, length);
+}
+
 RopeTree *append(RopeTree *tree, char *data) {
     tree->nodes_count++;
     tree->length += strlen(data);
@@ -71,16 +255,15 @@ RopeTree *append(RopeTree *tree, char *data) {
     }
 
     Node *last = get_last_node(tree);
-    if (strlen(data) + strlen(last->data) < CHUNK_BASE) {
-        strcat(last->data, data);
-        last->rank = strlen(last->data);
+    if (!last->lazy && strlen(data) + last->rank < CHUNK_BASE) {
+        grow_leaf(own_edge_leaf(tree, true), data, false);
         return tree;
     }
 
     Node *new_node = create_leaf(data);
     tree->root = concat(tree->root, new_node);
     tree->nodes_count++;
-    tree->height++;
+    tree->height = tree->root->height;
     return tree;
 }
 
@@ -94,20 +277,36 @@ RopeTree *prepend(RopeTree *tree, char *data) {
     }
 
     Node *first = get_first_node(tree);
-    if (strlen(data) + strlen(first->data) < CHUNK_BASE) {
-        strcat(first->data, data);
-        first->rank = strlen(first->data);
+    if (!first->lazy && strlen(data) + first->rank < CHUNK_BASE) {
+        grow_leaf(own_edge_leaf(tree, false), data, true);
         return tree;
     }
 
     Node *new_node = create_leaf(data);
     tree->root = concat(new_node, tree->root);
     tree->nodes_count++;
-    tree->height++;
+    tree->height = tree->root->height;
     return tree;
 }
 
-RopeTree *insert(RopeTree *tree, uint32_t idx, char *data) {
+// Concat that leaves out missing sides instead of linking them in
+static Node *join(Node *left, Node *right) {
+    if (!left) {
+        return right;
+    }
+    return right ? concat(left, right) : left;
+}
+
+// Splits out length bytes at start and frees them, returns what is left
+static Node *remove_range(Node *root, size_t start, size_t length) {
+    Node *left, *rest, *removed, *right;
+    split(root, start, &left, &rest);
+    split(rest, length, &removed, &right);
+    free_tree(removed);
+    return join(left, right);
+}
+
+RopeTree *insert(RopeTree *tree, size_t idx, char *data) {
     strcat(data, "\0");
     if (idx == tree->length) {
         return append(tree, data);
@@ -116,7 +315,7 @@ RopeTree *insert(RopeTree *tree, uint32_t idx, char *data) {
     if (idx == 0) {
         return prepend(tree, data);
     }
-    int32_t length = tree->length + strlen(data);
+    size_t length = tree->length + strlen(data);
     Node *new_node = create_leaf(data);
     tree->length += strlen(data);
     Node *left_tree, *right_tree;
@@ -127,57 +326,658 @@ RopeTree *insert(RopeTree *tree, uint32_t idx, char *data) {
 
     tree->root = concat(left_tree, right_tree);
 
-    tree->nodes_count = count_nodes(tree->root);
-    tree->height = calc_tree_height(tree->root);
     tree->length = length;
+    return balance_rope(tree);
+}
 
-    if (is_tree_balanced(tree)) {
+RopeTree *rope_delete(RopeTree *tree, size_t start, size_t length) {
+    if (tree->root->left == nullptr && tree->root->right == nullptr &&
+        !tree->root->lazy) {
+        tree->root = own_node(tree->root);
+        char *data = tree->root->data;
+        memmove(data + start, data + start + length,
+                tree->root->rank - start - length + 1);
+        tree->root->rank -= length;
+        tree->length = tree->root->rank;
+        // trimmed so the capacity stays what free_node takes off again
+        char *trimmed = realloc(data, tree->root->rank + 1);
+        tree->root->data = trimmed ? trimmed : data;
+        uncount(&live_leaf_bytes, length);
+        uncount(&live_leaf_capacity, length);
         return tree;
     }
 
-    List *leaves = get_leaves(tree);
-    free_internal_nodes(tree->root);
-    RopeTree *balanced = rebalance(leaves);
-    free_list(leaves);
-    leaves = nullptr;
-    free(tree);
-    tree = nullptr;
+    tree->root = remove_range(tree->root, start, length);
+    tree->length -= length;
+    return balance_rope(tree);
+}
 
-    balanced->length = length;
-    balanced->height = calc_tree_height(balanced->root);
-    balanced->nodes_count = count_nodes(balanced->root);
 
-    return balanced;
+void replace_range(RopeTree *tree, size_t start, size_t length, Node *subtree,
+                   size_t subtree_length) {
+    Node *left, *rest, *removed, *right;
+    split(tree->root, start, &left, &rest);
+    split(rest, length, &removed, &right);
+    free_tree(removed);
+    tree->root = join(join(left, subtree), right);
+    tree->length = tree->length - length + subtree_length;
 }
 
-RopeTree *rope_delete(RopeTree *tree, uint32_t start, uint32_t length) {
-    uint32_t size = tree->length;
+typedef struct {
+    const RopeEdit *edits;
+    size_t count;
+    size_t next;          // first edit not applied yet
+    size_t skip_until;    // old text before this offset is deleted
+    size_t length;        // of the old text
+    uint32_t nodes_count; // of the old tree
+    int64_t nodes;        // created minus freed
+} EditPass;
+
+// Height of the tree build_node_from_text makes over leaves
+static uint32_t balanced_height(size_t leaves) {
+    uint32_t height = 1;
+    while (leaves > 1) {
+        leaves = (leaves + 1) / 2;
+        height++;
+    }
+    return height;
+}
 
-    if (tree->root->left == nullptr && tree->root->right == nullptr) {
-        free(tree->root);
-        tree->root = nullptr;
-        return tree;
+// Height of the tree build_node_from_text makes over length bytes
+static uint32_t balanced_text_height(size_t length) {
+    return balanced_height((length + CHUNK_BASE - 1) / CHUNK_BASE);
+}
+
+// Nodes a shared subtree holding length bytes of a tree is taken to have,
+// its share of the nodes of the tree, so it is not walked
+static size_t shared_nodes(uint32_t nodes_count, size_t tree_length,
+                           size_t length) {
+    return tree_length ? (uint64_t)nodes_count * length / tree_length : 0;
+}
+
+// Nodes of a subtree of the old tree holding length bytes
+static size_t old_nodes(EditPass *pass, Node *node, size_t length) {
+    if (!node) {
+        return 0;
+    }
+    if (node->refs) {
+        return MAX(shared_nodes(pass->nodes_count, pass->length, length), 1);
+    }
+    if (!node->left && !node->right) {
+        return 1;
+    }
+    return 1 + old_nodes(pass, node->left, node->rank) +
+           old_nodes(pass, node->right, length - node->rank);
+}
+
+// Subtrees in text order and where the text of each ends, to build a tree
+// over
+typedef struct {
+    Node **nodes;
+    size_t *ends;
+    size_t count;
+    size_t capacity;
+    bool failed;
+} NodeRun;
+
+// Adds node, holding length bytes, false if it cannot be stored
+static bool add_to_run(NodeRun *run, Node *node, size_t length) {
+    if (run->failed || !node) {
+        run->failed = true;
+        return false;
+    }
+    if (run->count == run->capacity) {
+        size_t capacity = run->capacity ? run->capacity * 2 : 16;
+        Node **nodes = realloc(run->nodes, capacity * sizeof(Node *));
+        if (nodes) {
+            run->nodes = nodes;
+        }
+        size_t *ends =
+            nodes ? realloc(run->ends, capacity * sizeof(size_t)) : nullptr;
+        if (!ends) {
+            perror("Failed to grow subtree run");
+            run->failed = true;
+            return false;
+        }
+        run->ends = ends;
+        run->capacity = capacity;
+    }
+    size_t start = run->count ? run->ends[run->count - 1] : 0;
+    run->nodes[run->count] = node;
+    run->ends[run->count++] = start + length;
+    return true;
+}
+
+static void free_run(NodeRun *run) {
+    free(run->nodes);
+    free(run->ends);
+}
+
+// Tree over nodes start..end of run, whose text begins at before. It is
+// split where the text halves instead of the count, so long subtrees stay
+// near the root and short ones do not add levels above them
+static Node *build_weighted(const NodeRun *run, size_t start, size_t end,
+                            size_t before) {
+    if (start == end) {
+        return run->nodes[start];
+    }
+    size_t half = before + (run->ends[end] - before) / 2;
+    size_t mid = start;
+    while (mid + 1 < end && run->ends[mid] < half) {
+        ++mid;
+    }
+    Node *left = build_weighted(run, start, mid, before);
+    Node *right = build_weighted(run, mid + 1, end, run->ends[mid]);
+    return create_internal(left, right);
+}
+
+static Node *text_node(EditPass *pass, const char *text, size_t length) {
+    if (length <= EDIT_LEAF_BYTES) {
+        pass->nodes++;
+        return create_leaf_from(text, length);
+    }
+    size_t leaves = (length + CHUNK_BASE - 1) / CHUNK_BASE;
+    pass->nodes += 2 * leaves - 1;
+    return build_node_from_text(text, length);
+}
+
+// Node for what edit puts in, its slice shared or its text
+static Node *inserted_node(EditPass *pass, const RopeEdit *edit) {
+    if (edit->slice) {
+        pass->nodes += edit->slice->nodes_count;
+        return share_node(edit->slice->root);
+    }
+    return text_node(pass, edit->text, edit->text_length);
+}
+
+// Whether the next edit is in the old text start..end, inserts at the end
+// of the text go into the last leaf
+static bool next_edit_before(EditPass *pass, size_t end) {
+    if (pass->next == pass->count) {
+        return false;
+    }
+    size_t offset = pass->edits[pass->next].offset;
+    return offset < end || (offset == end && end == pass->length);
+}
+
+// Text of leaf, at start of the old text, with the edits reaching into it
+// applied. Small results stay one leaf so typing at the same place does
+// not deepen the tree
+static Node *edit_text_leaf(EditPass *pass, Node *leaf, size_t start,
+                            size_t *length) {
+    size_t end = start + leaf->rank;
+    size_t capacity = leaf->rank;
+    for (size_t i = pass->next;
+         i < pass->count &&
+         (pass->edits[i].offset < end ||
+          (pass->edits[i].offset == end && end == pass->length));
+         ++i) {
+        capacity += pass->edits[i].text_length;
+    }
+    char *text = malloc(capacity + 1);
+    if (!text) {
+        perror("Failed to allocate edited leaf");
+        *length = leaf->rank;
+        return leaf;
+    }
+
+    size_t written = 0;
+    size_t at = MAX(start, pass->skip_until);
+    while (next_edit_before(pass, end)) {
+        const RopeEdit *edit = &pass->edits[pass->next++];
+        if (at < edit->offset) {
+            memcpy(text + written, leaf->data + at - start, edit->offset - at);
+            written += edit->offset - at;
+        }
+        memcpy(text + written, edit->text, edit->text_length);
+        written += edit->text_length;
+        pass->skip_until = edit->offset + edit->length;
+        at = MAX(at, pass->skip_until);
+    }
+    if (at < end) {
+        memcpy(text + written, leaf->data + at - start, end - at);
+        written += end - at;
+    }
+    pass->nodes--;
+    free_node(leaf);
+
+    *length = written;
+    Node *node = written ? text_node(pass, text, written) : nullptr;
+    free(text);
+    return node;
+}
+
+// Leaf split into the parts around the edits and what they put in, so
+// lazy leaves keep the parts on disk and slices are not copied into a
+// buffer first
+static Node *edit_leaf_parts(EditPass *pass, Node *leaf, size_t start,
+                             size_t *length) {
+    size_t end = start + leaf->rank;
+    // every edit adds its text and the part after it
+    size_t capacity = 1;
+    for (size_t i = pass->next;
+         i < pass->count &&
+         (pass->edits[i].offset < end ||
+          (pass->edits[i].offset == end && end == pass->length));
+         ++i) {
+        capacity += 2;
+    }
+    NodeRun parts = {.nodes = malloc(capacity * sizeof(Node *)),
+                     .ends = malloc(capacity * sizeof(size_t)),
+                     .capacity = capacity};
+    if (!parts.nodes || !parts.ends) {
+        perror("Failed to allocate edited leaf");
+        free_run(&parts);
+        *length = leaf->rank;
+        return leaf;
+    }
+
+    size_t at = MAX(start, pass->skip_until);
+    LazyRange *lazy = leaf->lazy;
+    while (true) {
+        bool edited = next_edit_before(pass, end);
+        size_t stop = edited ? pass->edits[pass->next].offset : end;
+        if (at < stop) {
+            pass->nodes++;
+            add_to_run(&parts,
+                       lazy ? create_lazy_leaf(lazy->file,
+                                               lazy->offset + at - start,
+                                               stop - at)
+                            : create_leaf_from(leaf->data + at - start,
+                                               stop - at),
+                       stop - at);
+        }
+        if (!edited) {
+            break;
+        }
+        const RopeEdit *edit = &pass->edits[pass->next++];
+        if (edit->text_length) {
+            add_to_run(&parts, inserted_node(pass, edit), edit->text_length);
+        }
+        pass->skip_until = edit->offset + edit->length;
+        at = MAX(at, pass->skip_until);
+    }
+    pass->nodes--;
+    free_node(leaf);
+
+    Node *node = nullptr;
+    *length = 0;
+    if (parts.count) {
+        node = build_weighted(&parts, 0, parts.count - 1, 0);
+        pass->nodes += parts.count - 1;
+        *length = parts.ends[parts.count - 1];
+    }
+    free_run(&parts);
+    return node;
+}
+
+// Whether an edit that splices a slice reaches into the old text up to end
+static bool slice_edit_before(EditPass *pass, size_t end) {
+    for (size_t i = pass->next;
+         i < pass->count &&
+         (pass->edits[i].offset < end ||
+          (pass->edits[i].offset == end && end == pass->length));
+         ++i) {
+        if (pass->edits[i].slice) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether node, holding length bytes, is at most half the slack deeper than
+// a balanced tree of its length. Rebuilds keep such subtrees whole
+static bool is_compact(const Node *node, size_t length) {
+    return node->height <= balanced_text_height(length) + EDIT_HEIGHT_SLACK / 2;
+}
+
+// Adds the highest compact subtrees below node, length bytes long, to run
+static void collect_compact(NodeRun *run, Node *node, size_t length) {
+    if (!node || run->failed) {
+        return;
+    }
+    if (is_compact(node, length)) {
+        add_to_run(run, node, length);
+        return;
     }
+    collect_compact(run, node->left, node->rank);
+    collect_compact(run, node->right, length - node->rank);
+}
+
+// Frees the nodes of node, length bytes long, above its compact subtrees
+static void free_above_compact(EditPass *pass, Node *node, size_t length) {
+    if (!node || is_compact(node, length)) {
+        return;
+    }
+    Node *left = node->left;
+    Node *right = node->right;
+    size_t rank = node->rank;
+    // a shared node hands its children over instead
+    pass->nodes--;
+    free_node(node);
+    free_above_compact(pass, left, rank);
+    free_above_compact(pass, right, length - rank);
+}
 
-    Node *first_split_left;
-    Node *first_split_right;
-    split(tree->root, start, &first_split_left, &first_split_right);
+// Rebuilds a subtree, length bytes long, that got too deep for its length.
+// Its compact subtrees are kept whole and the tree over them is split by
+// text length, so a long slice spliced in deep down is lifted without
+// walking it. Done on the lowest such subtree it stays cheap like in a
+// scapegoat tree
+static Node *rebuild_subtree(EditPass *pass, Node *node, size_t length) {
+    NodeRun run = {0};
+    collect_compact(&run, node, length);
+    if (run.failed) {
+        free_run(&run);
+        return node;
+    }
+    free_above_compact(pass, node, length);
+    Node *rebuilt = build_weighted(&run, 0, run.count - 1, 0);
+    pass->nodes += run.count - 1;
+    free_run(&run);
+    return rebuilt;
+}
+
+// Applies the edits reaching into node, which holds length bytes at start
+// of the old text. Nodes along the way are reused, so untouched subtrees
+// keep their place
+static Node *edit_node(EditPass *pass, Node *node, size_t start,
+                       size_t length, size_t *new_length) {
+    size_t end = start + length;
+    *new_length = length;
+    if (!node || (start >= pass->skip_until && !next_edit_before(pass, end))) {
+        return node;
+    }
+    if (end <= pass->skip_until && !next_edit_before(pass, end)) {
+        pass->nodes -= old_nodes(pass, node, length);
+        free_tree(node);
+        *new_length = 0;
+        return nullptr;
+    }
+    if (!node->left && !node->right) {
+        return node->lazy || slice_edit_before(pass, end)
+                   ? edit_leaf_parts(pass, node, start, new_length)
+                   : edit_text_leaf(pass, node, start, new_length);
+    }
 
-    Node *second_split__left;
-    Node *second_split_right;
-    split(tree->root, start + length, &second_split__left, &second_split_right);
+    // the old node stays with the slices sharing it
+    node = own_node(node);
+    size_t left_length, right_length;
+    Node *left = edit_node(pass, node->left, start, node->rank, &left_length);
+    Node *right = edit_node(pass, node->right, start + node->rank,
+                            length - node->rank, &right_length);
+    *new_length = left_length + right_length;
+    if (!left || !right) {
+        pass->nodes--;
+        free_node(node);
+        return left ? left : right;
+    }
+    node->left = left;
+    node->right = right;
+    node->rank = left_length;
+    update_height(node);
+    if (node->height > balanced_text_height(*new_length) + EDIT_HEIGHT_SLACK) {
+        return rebuild_subtree(pass, node, *new_length);
+    }
+    return node;
+}
 
-    tree->root = concat(first_split_left, second_split_right);
+RopeTree *apply_edits(RopeTree *tree, const RopeEdit *edits, size_t count) {
+    if (!count) {
+        return tree;
+    }
+    EditPass pass = {.edits = edits,
+                     .count = count,
+                     .length = tree->length,
+                     .nodes_count = tree->nodes_count};
+    size_t length;
+    Node *root = edit_node(&pass, tree->root, 0, tree->length, &length);
+    // an empty tree, or one whose end was deleted, has no leaf to take
+    // inserts at its end
+    for (; pass.next < count; ++pass.next) {
+        const RopeEdit *edit = &edits[pass.next];
+        if (!edit->text_length) {
+            continue;
+        }
+        Node *text = inserted_node(&pass, edit);
+        if (root) {
+            pass.nodes++;
+        }
+        root = join(root, text);
+        length += edit->text_length;
+    }
+
+    tree->root = root;
+    tree->length = length;
+    tree->height = node_height(root);
+    tree->nodes_count += pass.nodes;
+    if (!tree->root || is_tree_balanced(tree)) {
+        return tree;
+    }
+    return balance_rope(tree);
+}
+
+// Adds the bytes start..end of node, relative to it and length bytes long,
+// to the slice. Nodes inside the range are shared, so only the path down
+// to either end is visited
+static void slice_node(NodeRun *slice, Node *node, size_t length,
+                       size_t start, size_t end) {
+    if (!node || start >= end || slice->failed) {
+        return;
+    }
+    if (start == 0 && end >= length) {
+        if (add_to_run(slice, node, length)) {
+            share_node(node);
+        }
+        return;
+    }
+    if (node->left || node->right) {
+        if (start < node->rank) {
+            slice_node(slice, node->left, node->rank, start,
+                       MIN(end, node->rank));
+        }
+        if (end > node->rank) {
+            slice_node(slice, node->right, length - node->rank,
+                       start > node->rank ? start - node->rank : 0,
+                       end - node->rank);
+        }
+        return;
+    }
+    end = MIN(end, node->rank);
+    Node *part = node->lazy ? create_lazy_leaf(node->lazy->file,
+                                               node->lazy->offset + start,
+                                               end - start)
+                            : create_leaf_from(node->data + start, end - start);
+    if (!add_to_run(slice, part, end - start)) {
+        free_tree(part);
+    }
+}
 
-    if (tree->root == nullptr) {
+RopeTree *copy_slice(RopeTree *tree, size_t start, size_t length) {
+    NodeRun slice = {0};
+    slice_node(&slice, tree->root, tree->length, start, start + length);
+    if (slice.failed) {
+        for (size_t i = 0; i < slice.count; ++i) {
+            free_tree(slice.nodes[i]);
+        }
+        free_run(&slice);
         return nullptr;
     }
 
-    tree->length = size - length;
+    RopeTree *copy = create_tree();
+    if (slice.count) {
+        copy->root = build_weighted(&slice, 0, slice.count - 1, 0);
+        copy->height = copy->root->height;
+        copy->nodes_count =
+            MAX(shared_nodes(tree->nodes_count, tree->length, length),
+                2 * slice.count - 1);
+    }
+    copy->length = length;
+    // shared subtrees may hold lazy leaves, they are not looked through
+    copy->file = tree->file;
+    retain_paged_file(copy->file);
+    free_run(&slice);
+    return copy;
+}
+
+RopeTree *share_tree(RopeTree *tree) {
+    RopeTree *copy = create_tree();
+    copy->root = share_node(tree->root);
+    copy->length = tree->length;
+    copy->height = tree->height;
+    copy->nodes_count = tree->nodes_count;
+    copy->file = tree->file;
+    retain_paged_file(copy->file);
+    return copy;
+}
+
+// Matcher streamed over the leaves, a match may start in one leaf and end
+// in a later one
+typedef struct {
+    const char *search;
+    size_t search_length;
+    size_t *fallback; // KMP table, matched bytes to go back to on a mismatch
+    const char *replacement;
+    size_t replacement_length;
+    size_t offset;  // of the leaf being scanned
+    size_t matched; // bytes of search matched up to here
+    RopeEdit *edits;
+    size_t count;
+    size_t capacity;
+    bool failed;
+} MatchScan;
+
+static void add_match(MatchScan *scan, size_t offset) {
+    if (scan->count == scan->capacity) {
+        size_t new_cap = scan->capacity ? scan->capacity * 2 : 64;
+        RopeEdit *grown = realloc(scan->edits, new_cap * sizeof(RopeEdit));
+        if (!grown) {
+            perror("Failed to allocate matches");
+            scan->failed = true;
+            return;
+        }
+        scan->edits = grown;
+        scan->capacity = new_cap;
+    }
+    scan->edits[scan->count++] =
+        (RopeEdit){offset, scan->search_length, scan->replacement,
+                   scan->replacement_length, nullptr};
+}
+
+static void scan_text(MatchScan *scan, const char *text, size_t length) {
+    const char *search = scan->search;
+    for (size_t i = 0; i < length && !scan->failed; ++i) {
+        if (!scan->matched) {
+            // skip to where a match could start
+            const char *first = memchr(text + i, search[0], length - i);
+            if (!first) {
+                break;
+            }
+            i = first - text;
+        }
+        while (scan->matched && text[i] != search[scan->matched]) {
+            scan->matched = scan->fallback[scan->matched - 1];
+        }
+        if (text[i] == search[scan->matched]) {
+            scan->matched++;
+        }
+        if (scan->matched == scan->search_length) {
+            add_match(scan, scan->offset + i + 1 - scan->search_length);
+            // matches do not overlap
+            scan->matched = 0;
+        }
+    }
+    scan->offset += length;
+}
+
+static void scan_node(MatchScan *scan, Node *node) {
+    if (!node || scan->failed) {
+        return;
+    }
+    if (node->left || node->right) {
+        scan_node(scan, node->left);
+        scan_node(scan, node->right);
+        return;
+    }
+    const char *text = leaf_text(node);
+    if (!text) {
+        scan->failed = true;
+        return;
+    }
+    scan_text(scan, text, node->rank);
+}
+
+bool find_replace_edits(RopeTree *tree, const char *search,
+                        size_t search_length, const char *replacement,
+                        size_t replacement_length, RopeEdit **edits,
+                        size_t *count) {
+    *edits = nullptr;
+    *count = 0;
+    if (!search_length) {
+        return true;
+    }
+    MatchScan scan = {.search = search,
+                      .search_length = search_length,
+                      .fallback = malloc(search_length * sizeof(size_t)),
+                      .replacement = replacement,
+                      .replacement_length = replacement_length};
+    if (!scan.fallback) {
+        perror("Failed to allocate search table");
+        return false;
+    }
+    scan.fallback[0] = 0;
+    for (size_t i = 1, k = 0; i < search_length; ++i) {
+        while (k && search[i] != search[k]) {
+            k = scan.fallback[k - 1];
+        }
+        if (search[i] == search[k]) {
+            k++;
+        }
+        scan.fallback[i] = k;
+    }
+
+    scan_node(&scan, tree->root);
+    free(scan.fallback);
+    if (scan.failed) {
+        free(scan.edits);
+        return false;
+    }
+    *edits = scan.edits;
+    *count = scan.count;
+    return true;
+}
+
+// Hangs subtree off the right spine below the first node whose left side
+// is at least as long as everything right of it, so the spine halves at
+// every step and repeated appends stay logarithmic without a rebuild
+static Node *append_to_spine(Node *node, size_t node_length, Node *subtree,
+                             size_t length) {
+    if (!node) {
+        return subtree;
+    }
+    size_t right_length = node_length - node->rank;
+    if ((node->left || node->right) && node->rank >= right_length + length) {
+        node = own_node(node);
+        node->right =
+            append_to_spine(node->right, right_length, subtree, length);
+        update_height(node);
+        return node;
+    }
+    return concat(node, subtree);
+}
+
+void append_subtree(RopeTree *tree, Node *subtree, size_t length,
+                    uint32_t nodes_count) {
+    tree->root = append_to_spine(tree->root, tree->length, subtree, length);
+    tree->length += length;
+    tree->nodes_count += nodes_count + 1;
+    tree->height = tree->root->height;
+}
+
+RopeTree *balance_rope(RopeTree *tree) {
     tree->height = calc_tree_height(tree->root);
     tree->nodes_count = count_nodes(tree->root);
-
-    if (is_tree_balanced(tree)) {
+    if (!tree->root || is_tree_balanced(tree)) {
         return tree;
     }
 
@@ -186,10 +986,11 @@ RopeTree *rope_delete(RopeTree *tree, uint32_t start, uint32_t length) {
     RopeTree *balanced = rebalance(leaves);
     free_list(leaves);
     leaves = nullptr;
+    balanced->file = tree->file;
+    balanced->length = tree->length;
     free(tree);
     tree = nullptr;
 
-    balanced->length = size - length;
     balanced->height = calc_tree_height(balanced->root);
     balanced->nodes_count = count_nodes(balanced->root);
 
@@ -217,7 +1018,7 @@ Node *get_first_node(RopeTree *tree) {
     return current;
 }
 
-Node *get_index_node(RopeTree *tree, uint32_t *idx) {
+Node *get_index_node(RopeTree *tree, size_t *idx) {
     Node *current = tree->root;
     while (current) {
         if (current->rank == *idx) {
@@ -287,18 +1088,48 @@ List *get_leaves(RopeTree *tree) {
     return leaves_start;
 }
 
-uint32_t calculate_length(Node *root) {
+size_t copy_range(Node *root, size_t start, size_t length, char *dst) {
+    if (!root || !length)
+        return 0;
+    if (!root->left && !root->right) {
+        if (start >= root->rank)
+            return 0;
+        const char *text = leaf_text(root);
+        if (!text) {
+            return 0; // page could not be read
+        }
+        size_t count = MIN(length, root->rank - start);
+        memcpy(dst, text + start, count);
+        return count;
+    }
+
+    size_t copied = 0;
+    if (start < root->rank) {
+        size_t wanted = MIN(length, root->rank - start);
+        copied = copy_range(root->left, start, wanted, dst);
+        if (copied < wanted) {
+            return copied;
+        }
+        start = 0;
+    } else {
+        start -= root->rank;
+    }
+    return copied + copy_range(root->right, start, length - copied, dst + copied);
+}
+
+size_t calculate_length(Node *root) {
     if (!root)
         return 0;
     if (!root->left && !root->right) {
-        return strlen(root->data);
+        // the text of a leaf may hold NUL, its rank is its length
+        return root->rank;
     }
     return calculate_length(root->left) + calculate_length(root->right);
 }
 
-uint32_t calculate_rank(Node *node) {
+size_t calculate_rank(Node *node) {
     Node *current = node->left;
-    uint32_t rank = 0;
+    size_t rank = 0;
     while (current) {
         rank += current->rank;
         current = current->right;
@@ -327,28 +1158,47 @@ bool is_tree_balanced(RopeTree *tree) {
     return fibonacci(tree->height + 2) <= tree->root->rank ? true : false;
 }
 
+Node *build_balanced(Node **nodes, size_t start, size_t end) {
+    if (start == end) {
+        return nodes[start];
+    }
+    size_t mid = (start + end) / 2;
+    Node *left = build_balanced(nodes, start, mid);
+    Node *right = build_balanced(nodes, mid + 1, end);
+    return create_internal(left, right);
+}
+
 RopeTree *rebalance(List *leaves) {
     RopeTree *rebalanced_tree = create_tree();
-    if (!leaves || !leaves->leaf)
+    size_t count = 0;
+    for (List *current = leaves; current; current = current->next) {
+        if (current->leaf) {
+            count++;
+        }
+    }
+    if (!count)
         return rebalanced_tree;
 
-    Node *current_root = leaves->leaf;
-    leaves = leaves->next;
-
-    while (leaves) {
-        if (!leaves->leaf) {
-            leaves = leaves->next;
-            continue;
+    // Pair the leaves up level by level, concatenating them one after
+    // another would leave a tree as deep as the number of leaves
+    Node **nodes = malloc(count * sizeof(Node *));
+    if (!nodes) {
+        perror("Failed to allocate leaves for rebalancing");
+        return rebalanced_tree;
+    }
+    size_t i = 0;
+    for (List *current = leaves; current; current = current->next) {
+        if (current->leaf) {
+            nodes[i++] = current->leaf;
         }
-        current_root = concat(current_root, leaves->leaf);
-        leaves = leaves->next;
     }
 
-    rebalanced_tree->root = current_root;
+    rebalanced_tree->root = build_balanced(nodes, 0, count - 1);
+    free(nodes);
     return rebalanced_tree;
 }
 
-void split(Node *node, uint32_t idx, Node **left, Node **right) {
+void split(Node *node, size_t idx, Node **left, Node **right) {
     if (!node) {
         *left = *right = nullptr;
         return;
@@ -358,27 +1208,39 @@ void split(Node *node, uint32_t idx, Node **left, Node **right) {
         if (idx >= node->rank) {
             *left = node;
             *right = nullptr;
+        } else if (node->lazy) {
+            // both halves keep pointing into the file
+            LazyRange *lazy = node->lazy;
+            *left = idx ? create_lazy_leaf(lazy->file, lazy->offset, idx)
+                        : nullptr;
+            *right = create_lazy_leaf(lazy->file, lazy->offset + idx,
+                                      node->rank - idx);
+            free_node(node);
         } else {
-            char *left_str = strndup(node->data, idx);
-            char *right_str = strdup(node->data + idx);
-            *left = strlen(left_str) > 0 ? create_leaf(left_str) : nullptr;
-            *right = strlen(right_str) > 0 ? create_leaf(right_str) : nullptr;
-            free(left_str);
-            free(right_str);
+            // copied by length, the text may hold NUL
+            *left = idx ? create_leaf_from(node->data, idx) : nullptr;
+            *right = create_leaf_from(node->data + idx, node->rank - idx);
+            free_node(node);
         }
         return;
     }
 
-    if (idx < node->rank) {
+    // the halves are rebuilt above its children, which are let go of
+    // first so a shared child is not split in place
+    size_t rank = node->rank;
+    Node *node_left = node->left;
+    Node *node_right = node->right;
+    free_node(node);
+    if (idx < rank) {
         Node *left_left, *left_right;
-        split(node->left, idx, &left_left, &left_right);
-        Node *new_right = concat(left_right, node->right);
+        split(node_left, idx, &left_left, &left_right);
+        Node *new_right = concat(left_right, node_right);
         *left = left_left;
         *right = new_right;
     } else {
         Node *right_left, *right_right;
-        split(node->right, idx - node->rank, &right_left, &right_right);
-        Node *new_left = concat(node->left, right_left);
+        split(node_right, idx - rank, &right_left, &right_right);
+        Node *new_left = concat(node_left, right_left);
         *left = new_left;
         *right = right_right;
     }
@@ -387,45 +1249,98 @@ void split(Node *node, uint32_t idx, Node **left, Node **right) {
 Node *copy_tree(Node *root) {
     if (!root)
         return nullptr;
-    Node *new_node = malloc(sizeof(Node));
-    if (!new_node) {
-        perror("Failed to allocate mememory for tree copy");
-        return nullptr;
-    }
 
     // is leaf
+    Node *new_node;
     if (!root->left && !root->right) {
-        new_node->data = root->data ? strdup(root->data) : nullptr;
-        new_node->left = nullptr;
-        new_node->right = nullptr;
+        new_node = root->lazy ? create_lazy_leaf(root->lazy->file,
+                                                 root->lazy->offset, root->rank)
+                   : root->data ? create_leaf_from(root->data, root->rank)
+                                : create_internal(nullptr, nullptr);
     } else { // is internal
-        new_node->data = nullptr;
-        new_node->left = copy_tree(root->left);
-        new_node->right = copy_tree(root->right);
+        new_node = create_internal(copy_tree(root->left),
+                                   copy_tree(root->right));
     }
-
+    if (!new_node) {
+        perror("Failed to allocate mememory for tree copy");
+        return nullptr;
+    }
+    new_node->rank = root->rank;
     return new_node;
 }
 
+void free_node(Node *node) {
+    if (!node) {
+        return;
+    }
+    if (node->refs) {
+        node->refs--;
+        share_node(node->left);
+        share_node(node->right);
+        return;
+    }
+    if (node->lazy) {
+        uncount(&live_lazy, 1);
+    } else if (node->data) {
+        uncount(&live_leaves, 1);
+        uncount(&live_leaf_bytes, node->rank);
+        uncount(&live_leaf_capacity, node->rank + 1);
+    } else {
+        uncount(&live_internal, 1);
+    }
+    free(node->data);
+    free(node->lazy);
+    free(node);
+}
+
 void free_tree(Node *root) {
-    if (root) {
+    if (!root) {
+        return;
+    }
+    if (root->refs) {
+        root->refs--;
         return;
     }
-    Node *tmp = root;
     free_tree(root->left);
     free_tree(root->right);
-    free(tmp);
+    free_node(root);
+}
+
+// Another owner for every leaf below node
+static void share_leaves(Node *node) {
+    if (!node) {
+        return;
+    }
+    if (!node->left && !node->right) {
+        node->refs++;
+        return;
+    }
+    share_leaves(node->left);
+    share_leaves(node->right);
 }
 
 void free_internal_nodes(Node *root) {
-    if (root) {
+    if (!root || (!root->left && !root->right)) {
         return;
     }
-    Node *tmp = root;
-    free_tree(root->left);
-    free_tree(root->right);
-    if (tmp->left && tmp->right)
-        free(tmp);
+    if (root->refs) {
+        // its owners keep it, the leaves kept by the caller gain one
+        root->refs--;
+        share_leaves(root);
+        return;
+    }
+    free_internal_nodes(root->left);
+    free_internal_nodes(root->right);
+    free_node(root);
+}
+
+void free_rope(RopeTree *tree) {
+    if (!tree) {
+        return;
+    }
+    free_tree(tree->root);
+    release_paged_file(tree->file);
+    free(tree);
 }
 
 void free_list(List *list) {
@@ -440,7 +1355,7 @@ void print_RT(char *prefix, const Node *node, bool is_left) {
     if (node) {
         printf("%s", prefix);
         printf("%s", (is_left ? "├──" : "└──"));
-        printf("%d %s %p\n", node->rank, node->data, node);
+        printf("%zu %s %p\n", node->rank, node->data, node);
 
         size_t len = strlen(prefix) + 5;
         char *new_prefix = malloc(len);
@@ -453,18 +1368,6 @@ void print_RT(char *prefix, const Node *node, bool is_left) {
     }
 }
 
-void save_to_file(Node *root, FILE *fp) {
-    if (!root || !fp) {
-        return;
-    }
-    if (!root->left && !root->right) {
-        fputs(root->data, fp);
-    } else {
-        save_to_file(root->left, fp);
-        save_to_file(root->right, fp);
-    }
-}
-
 // Function to generate Fibonacci numbers up to a limit
 int fibonacci(int n) {
     if (n <= 1)
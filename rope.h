@@ -1,6 +1,7 @@
 #ifndef ROPE_H
 #define ROPE_H
 
+#include "paged_file.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -12,25 +13,66 @@
 
 #define CHUNK_BASE 2
 
+// Edited leaves grow up to this before their text is split into CHUNK_BASE
+// leaves again
+#define EDIT_LEAF_BYTES 64
+
+// Levels an edited subtree may have over a balanced tree of its length
+// before it is rebuilt
+#define EDIT_HEIGHT_SLACK 4
+
 // Forward Declarations
 typedef struct Node Node;
 typedef struct RopeTree RopeTree;
 typedef struct List List;
 
+// Range of a paged file standing in for the text of a lazy leaf
+typedef struct {
+    PagedFile *file;
+    size_t offset; // page * FILE_PAGE_SPAN plus offset in the decoded page
+} LazyRange;
+
 // RopeTree Structure
 struct RopeTree {
     Node *root;
-    uint32_t length;
+    size_t length;
     uint32_t height;
     uint32_t nodes_count;
+    PagedFile *file; // backing of lazy leaves, one reference held
 };
 
+// Live nodes and leaf text of all ropes, a node freed twice or never shows
+// up here
+typedef struct {
+    size_t internal_nodes;
+    size_t leaves;
+    size_t lazy_leaves;
+    size_t leaf_bytes;    // text held by leaves
+    size_t leaf_capacity; // bytes allocated for that text
+} RopeStats;
+
+// One edit of a batch, length bytes at offset are replaced by text
+typedef struct {
+    size_t offset; // in the text before the batch
+    size_t length;
+    const char *text;
+    size_t text_length;
+    // spliced in as a copy instead of text when set, text_length is its
+    // length then. Lazy leaves in it have to read from the edited tree's file
+    const RopeTree *slice;
+} RopeEdit;
+
 // Node Structure
 struct Node {
-    uint32_t rank;
-    char *data; // Only used in leaf nodes
+    size_t rank;
+    char *data;      // Only used in leaf nodes, nullptr in lazy leaves
+    LazyRange *lazy; // Only used in lazy leaves, text still on disk
     Node *left;
     Node *right;
+    uint32_t height; // levels down to the deepest leaf, 1 in leaves
+    // owners besides the first, slices share subtrees with the tree they
+    // were cut from. A shared node is copied before it is changed
+    uint32_t refs;
 };
 
 // List of Leaf Nodes
@@ -42,14 +84,24 @@ struct List {
 // Node Creation
 [[nodiscard]]
 Node *create_leaf(const char *data);
+// Leaf holding a copy of the length bytes at text, which may contain NUL
+[[nodiscard]]
+Node *create_leaf_from(const char *text, size_t length);
 [[nodiscard]]
 Node *create_internal(Node *left, Node *right);
+[[nodiscard]]
+Node *create_lazy_leaf(PagedFile *file, size_t offset, size_t length);
 
 // Tree Construction & Modification
 [[nodiscard]]
 RopeTree *build_rope(char **chunks, size_t start, size_t end);
 [[nodiscard]]
+RopeTree *build_rope_from_file(FILE *fp);
+[[nodiscard]]
 Node *_build_rope(char **chunks, size_t start, size_t end);
+// Balanced subtree over text split into CHUNK_BASE sized leaves
+[[nodiscard]]
+Node *build_node_from_text(const char *text, size_t length);
 [[nodiscard]]
 RopeTree *create_tree();
 [[nodiscard]]
@@ -57,11 +109,42 @@ RopeTree *append(RopeTree *tree, char *data);
 [[nodiscard]]
 RopeTree *prepend(RopeTree *tree, char *data);
 [[nodiscard]]
-RopeTree *insert(RopeTree *tree, uint32_t idx, char *data);
+RopeTree *insert(RopeTree *tree, size_t idx, char *data);
 [[nodiscard]]
-RopeTree *rope_delete(RopeTree *tree, uint32_t start, uint32_t length);
+RopeTree *rope_delete(RopeTree *tree, size_t start, size_t length);
 [[nodiscard]]
 Node *concat(Node *tree_1, Node *tree_2);
+// Replaces length bytes at start with subtree, leaves the tree unbalanced
+void replace_range(RopeTree *tree, size_t start, size_t length, Node *subtree,
+                   size_t subtree_length);
+// Applies edits, sorted by offset and not overlapping, in one pass over the
+// tree. Only the paths down to the edited leaves are visited, the rest of
+// the tree is kept as it is
+[[nodiscard]]
+RopeTree *apply_edits(RopeTree *tree, const RopeEdit *edits, size_t count);
+// Copy of length bytes at start as a tree of its own. Subtrees inside the
+// range are shared with tree, only the leaves at its ends are cut, so it
+// takes O(log n). nullptr if it cannot be allocated
+[[nodiscard]]
+RopeTree *copy_slice(RopeTree *tree, size_t start, size_t length);
+// Tree holding the same nodes as tree in O(1). Changes to either copy the
+// paths they take, so the other keeps its text
+[[nodiscard]]
+RopeTree *share_tree(RopeTree *tree);
+// Edits replacing every match of search with replacement, leftmost first
+// and not overlapping, found in one pass over the leaves. Matches may span
+// leaves. Feed them to apply_edits and apply_edits_to_index to replace
+// them all at once. edits is freed by the caller, false on failure
+bool find_replace_edits(RopeTree *tree, const char *search,
+                        size_t search_length, const char *replacement,
+                        size_t replacement_length, RopeEdit **edits,
+                        size_t *count);
+// Adds subtree, length bytes long, to the end of the document
+void append_subtree(RopeTree *tree, Node *subtree, size_t length,
+                    uint32_t nodes_count);
+// Recounts the tree and rebuilds it if it got too deep
+[[nodiscard]]
+RopeTree *balance_rope(RopeTree *tree);
 
 // Tree Traversal & Inspection
 [[nodiscard]]
@@ -69,11 +152,17 @@ Node *get_last_node(RopeTree *tree);
 [[nodiscard]]
 Node *get_first_node(RopeTree *tree);
 [[nodiscard]]
-Node *get_index_node(RopeTree *tree, uint32_t *idx);
+Node *get_index_node(RopeTree *tree, size_t *idx);
 [[nodiscard]]
 List *get_leaves(RopeTree *tree);
-uint32_t calculate_length(Node *root);
-uint32_t calculate_rank(Node *node);
+// Copies length bytes from start into dst and returns the bytes copied,
+// fewer if the tree ends first or a page of a lazy leaf cannot be read
+size_t copy_range(Node *root, size_t start, size_t length, char *dst);
+// Text of a leaf, rank bytes long. Lazy leaves are paged in, so the text is
+// only valid until the next leaf is read
+const char *leaf_text(Node *leaf);
+size_t calculate_length(Node *root);
+size_t calculate_rank(Node *node);
 int count_nodes(Node *root);
 int calc_tree_height(Node *root);
 bool is_tree_balanced(RopeTree *tree);
@@ -81,22 +170,31 @@ bool is_tree_balanced(RopeTree *tree);
 // Tree Algorithms
 [[nodiscard]]
 RopeTree *rebalance(List *leaves);
-void split(Node *tree, uint32_t idx, Node **left, Node **right);
+// Balanced tree over the subtrees nodes[start..end] in order
+[[nodiscard]]
+Node *build_balanced(Node **nodes, size_t start, size_t end);
+// Splits tree at idx, nodes of tree not reused in the halves are freed
+void split(Node *tree, size_t idx, Node **left, Node **right);
 [[nodiscard]]
 Node *copy_tree(Node *root);
 
 // Memory Management
+RopeStats rope_stats();
+// Frees one node and its text but not its children. A shared node only
+// loses an owner, its children gain the caller as one
+void free_node(Node *node);
+// Shared subtrees only lose an owner
 void free_tree(Node *root);
+// Frees the nodes above the leaves, the leaves are kept
 void free_internal_nodes(Node *root);
 void free_list(List *list);
+// Frees the tree and drops its reference to the paged file
+void free_rope(RopeTree *tree);
 
 // Math Utilities
 int fibonacci(int n);
 int smallest_fib_GE(int n);
 
-// File operations
-void save_to_file(Node *root, FILE *fp);
-
 // Debugging & Visualization
 void print_RT(char *prefix, const Node *node, bool is_left);
 
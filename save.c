@@ -0,0 +1,220 @@
+// mkstemp, fsync, fchmod and writev are POSIX
+#define _XOPEN_SOURCE 700
+
+#include "save.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+typedef struct {
+    int fd;
+    struct iovec iov[SAVE_IOV_BATCH];
+    int count;
+    char *staging;
+    size_t staged;
+    size_t written;
+    FileHash *hash; // of the bytes written, nullptr if not wanted
+    TextEncoder *encoder; // nullptr if the text is written as it is
+} SaveBatch;
+
+static bool flush_batch(SaveBatch *batch) {
+    struct iovec *iov = batch->iov;
+    int count = batch->count;
+    for (int i = 0; batch->hash && i < count; ++i) {
+        update_file_hash(batch->hash, iov[i].iov_base, iov[i].iov_len);
+    }
+    while (count) {
+        ssize_t written = writev(batch->fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Failed to write file");
+            return false;
+        }
+        // Short write, carry on from the first unwritten byte
+        while (count && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    batch->count = 0;
+    batch->staged = 0;
+    return true;
+}
+
+// Adds length bytes just written to the staging buffer at dst
+static void add_staged(SaveBatch *batch, char *dst, size_t length) {
+    batch->staged += length;
+    batch->written += length;
+    // Neighbouring small leaves end up in one iovec
+    if (batch->count) {
+        struct iovec *last = &batch->iov[batch->count - 1];
+        if ((char *)last->iov_base + last->iov_len == dst) {
+            last->iov_len += length;
+            return;
+        }
+    }
+    batch->iov[batch->count++] = (struct iovec){dst, length};
+}
+
+static bool add_text(SaveBatch *batch, const char *text, size_t length) {
+    bool copy = length <= SAVE_COPY_BYTES;
+    if (batch->count == SAVE_IOV_BATCH ||
+        (copy && batch->staged + length > SAVE_STAGING_BYTES)) {
+        if (!flush_batch(batch)) {
+            return false;
+        }
+    }
+    if (copy) {
+        char *dst = batch->staging + batch->staged;
+        memcpy(dst, text, length);
+        add_staged(batch, dst, length);
+        return true;
+    }
+    batch->iov[batch->count++] = (struct iovec){(void *)text, length};
+    batch->written += length;
+    return true;
+}
+
+// Encodes text to the file format into the staging buffer
+static bool add_encoded(SaveBatch *batch, const char *text, size_t length) {
+    for (size_t done = 0; done < length; done += SAVE_ENCODE_BYTES) {
+        size_t chunk = MIN(SAVE_ENCODE_BYTES, length - done);
+        if (batch->count == SAVE_IOV_BATCH ||
+            batch->staged + encoded_capacity(chunk) > SAVE_STAGING_BYTES) {
+            if (!flush_batch(batch)) {
+                return false;
+            }
+        }
+        char *dst = batch->staging + batch->staged;
+        add_staged(batch, dst,
+                   encode_text(batch->encoder, text + done, chunk, dst));
+    }
+    return true;
+}
+
+static bool add_leaves(SaveBatch *batch, Node *node) {
+    if (!node) {
+        return true;
+    }
+    if (node->left || node->right) {
+        return add_leaves(batch, node->left) && add_leaves(batch, node->right);
+    }
+    if (node->rank == 0) {
+        return true;
+    }
+    const char *text = leaf_text(node);
+    if (!text) {
+        fprintf(stderr, "Failed to read text to save\n");
+        return false;
+    }
+    if (batch->encoder) {
+        return add_encoded(batch, text, node->rank);
+    }
+    if (!add_text(batch, text, node->rank)) {
+        return false;
+    }
+    // The next page in may drop the page this text points into
+    return !node->lazy || flush_batch(batch);
+}
+
+// Makes the rename itself survive a crash
+static void sync_directory(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash - path + 1) : strdup(".");
+    if (!dir) {
+        return;
+    }
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+// Writes the whole tree to fd and syncs it to disk
+static bool write_rope(RopeTree *tree, int fd, TextFormat format,
+                       size_t *file_size, FileHash *file_hash) {
+    SaveBatch *batch = malloc(sizeof(SaveBatch));
+    char *staging = malloc(SAVE_STAGING_BYTES);
+    bool written = batch && staging;
+    if (!written) {
+        perror("Failed to allocate save buffers");
+    } else {
+        TextEncoder encoder = {.format = format};
+        bool plain = format.encoding == TEXT_UTF8 && !format.crlf;
+        *batch = (SaveBatch){
+            .fd = fd,
+            .staging = staging,
+            .hash = file_hash,
+            .encoder = plain ? nullptr : &encoder,
+        };
+        if (file_hash) {
+            *file_hash = start_file_hash();
+        }
+        char bom[4];
+        written = add_text(batch, bom, encode_bom(format, bom)) &&
+                  add_leaves(batch, tree->root) && flush_batch(batch);
+        *file_size = batch->written;
+    }
+    free(batch);
+    free(staging);
+    if (written && fsync(fd)) {
+        perror("Failed to sync file");
+        written = false;
+    }
+    return written;
+}
+
+bool save_rope(RopeTree *tree, const char *path, TextFormat format,
+               size_t *file_size, FileHash *file_hash) {
+    size_t path_length = strlen(path);
+    char *temp_path = malloc(path_length + sizeof(".XXXXXX"));
+    if (!temp_path) {
+        perror("Failed to allocate temporary path");
+        return false;
+    }
+    memcpy(temp_path, path, path_length);
+    memcpy(temp_path + path_length, ".XXXXXX", sizeof(".XXXXXX"));
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        perror("Failed to create temporary file");
+        free(temp_path);
+        return false;
+    }
+
+    // mkstemp creates the file private, keep the mode of the one replaced
+    struct stat st;
+    if (fchmod(fd, stat(path, &st) ? 0644 : st.st_mode & 07777)) {
+        perror("Failed to set file mode");
+    }
+    bool saved = write_rope(tree, fd, format, file_size, file_hash);
+    if (close(fd) && saved) {
+        perror("Failed to close file");
+        saved = false;
+    }
+    // The old file is only replaced once the new one is complete on disk
+    if (saved && rename(temp_path, path)) {
+        perror("Failed to replace file");
+        saved = false;
+    }
+    if (saved) {
+        sync_directory(path);
+    } else {
+        unlink(temp_path);
+    }
+    free(temp_path);
+    return saved;
+}
@@ -0,0 +1,29 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+#include "encoding.h"
+#include "file_hash.h"
+#include "rope.h"
+#include <stdbool.h>
+
+// Leaf chunks handed to one writev call, the Linux IOV_MAX
+#define SAVE_IOV_BATCH 1024
+
+// Leaves up to this size are copied together into the staging buffer
+// instead of taking an iovec each
+#define SAVE_COPY_BYTES 256
+#define SAVE_STAGING_BYTES (256 << 10)
+
+// Text encoded to the file format at a time
+#define SAVE_ENCODE_BYTES 4096
+
+// Writes the tree in format to a temporary file next to path, syncs it and
+// renames it over path, so a failed save leaves the old file as it was.
+// Lazy leaves keep reading the old file through its open handle afterwards,
+// so the rope stays usable as it is. Returns false on failure, otherwise
+// file_size is set to the bytes written and file_hash, unless nullptr, to
+// their hash
+bool save_rope(RopeTree *tree, const char *path, TextFormat format,
+               size_t *file_size, FileHash *file_hash);
+
+#endif
@@ -0,0 +1,386 @@
+// mkstemp, fsync, mmap, pread, realpath and nanosecond modification times
+// are POSIX
+#define _XOPEN_SOURCE 700
+
+#include "session.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The page table is stored as it is in memory
+static_assert(sizeof(PageLines) == 2 * sizeof(uint32_t));
+
+#define SESSION_MAGIC "EDSESS03"
+
+// Start of a session file, followed by the path padded to 8 bytes, the
+// leaves and then the line counts of every page of the file
+typedef struct {
+    char magic[8];
+    // the file as it was when the session was written
+    uint64_t file_size;
+    int64_t mtime_ns;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t content_hash;
+    FileHash file_hash; // of all of it, for the watch
+    TextFormat format;
+    uint64_t length; // of the document
+    uint64_t path_length;
+    uint64_t leaf_count;
+    uint64_t page_count;
+    uint64_t cursor_line;
+    uint64_t cursor_column;
+    uint64_t scroll_line;
+} SessionHeader;
+
+// Lazy leaf in document order
+typedef struct {
+    uint64_t offset; // in the paged file
+    uint64_t length;
+} SessionLeaf;
+
+static uint64_t fnv1a(uint64_t hash, const unsigned char *bytes,
+                      size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int64_t mtime_ns(const struct stat *st) {
+    return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+// Hash of the sampled blocks of the file, 0 if it cannot be read
+static uint64_t content_hash(const char *path, size_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    uint64_t hash = 14695981039346656037ULL;
+    unsigned char sample[SESSION_SAMPLE_BYTES];
+    size_t span = size > sizeof(sample) ? size - sizeof(sample) : 0;
+    for (size_t i = 0; i < SESSION_HASH_SAMPLES; ++i) {
+        off_t offset = span / (SESSION_HASH_SAMPLES - 1) * i;
+        if (i == SESSION_HASH_SAMPLES - 1) {
+            offset = span;
+        }
+        ssize_t read = pread(fd, sample, sizeof(sample), offset);
+        if (read < 0) {
+            close(fd);
+            return 0;
+        }
+        hash = fnv1a(hash, sample, read);
+    }
+    close(fd);
+    return hash;
+}
+
+// Session file of the file at the absolute path real_path, nullptr if
+// there is no cache directory. dir is created when create is set
+static char *session_path(const char *real_path, bool create) {
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char base[4096];
+    if (cache && *cache) {
+        snprintf(base, sizeof(base), "%s", cache);
+    } else if (home && *home) {
+        snprintf(base, sizeof(base), "%s/.cache", home);
+    } else {
+        return nullptr;
+    }
+    size_t length = strlen(base) + sizeof(SESSION_DIR) + 32;
+    char *path = malloc(length);
+    if (!path) {
+        perror("Failed to allocate session path");
+        return nullptr;
+    }
+    if (create) {
+        mkdir(base, 0700);
+        snprintf(path, length, "%s/%s", base, SESSION_DIR);
+        mkdir(path, 0700);
+    }
+    uint64_t key = fnv1a(14695981039346656037ULL,
+                         (const unsigned char *)real_path, strlen(real_path));
+    snprintf(path, length, "%s/%s/%016llx.session", base, SESSION_DIR,
+             (unsigned long long)key);
+    return path;
+}
+
+// Lazy leaves of file under node in order, false on any other leaf or
+// past capacity leaves
+static bool collect_leaves(Node *node, PagedFile *file, SessionLeaf *leaves,
+                           size_t capacity, size_t *count) {
+    if (!node) {
+        return true;
+    }
+    if (node->left || node->right) {
+        return collect_leaves(node->left, file, leaves, capacity, count) &&
+               collect_leaves(node->right, file, leaves, capacity, count);
+    }
+    if (!node->lazy || node->lazy->file != file || *count == capacity) {
+        return false;
+    }
+    leaves[(*count)++] = (SessionLeaf){node->lazy->offset, node->rank};
+    return true;
+}
+
+static bool write_session(int fd, const SessionHeader *header,
+                          const char *real_path, const SessionLeaf *leaves,
+                          const PagedFile *file) {
+    FILE *fp = fdopen(fd, "wb");
+    if (!fp) {
+        perror("Failed to open session");
+        close(fd);
+        return false;
+    }
+    uint64_t padding = 0;
+    size_t padding_length =
+        (header->path_length + 7) / 8 * 8 - header->path_length;
+    size_t pages = header->page_count;
+    bool written =
+        fwrite(header, sizeof(*header), 1, fp) == 1 &&
+        fwrite(real_path, 1, header->path_length, fp) ==
+            header->path_length &&
+        fwrite(&padding, 1, padding_length, fp) == padding_length &&
+        fwrite(leaves, sizeof(SessionLeaf), header->leaf_count, fp) ==
+            header->leaf_count &&
+        fwrite(file->page_lines, sizeof(PageLines), pages, fp) == pages &&
+        fflush(fp) == 0 && fsync(fd) == 0;
+    if (!written) {
+        perror("Failed to write session");
+    }
+    return fclose(fp) == 0 && written;
+}
+
+bool save_session(const char *path, const FileHash *file_hash,
+                  int64_t mtime_ns_then, RopeTree *tree, TextFormat format,
+                  SessionView view) {
+    size_t size = file_hash->length;
+    struct stat st;
+    struct stat paged;
+    if (!tree->file || stat(path, &st) || (size_t)st.st_size != size ||
+        mtime_ns(&st) != mtime_ns_then) {
+        return false;
+    }
+    // a save renames a new file over path, the leaves still point into the
+    // one they were paged from
+    if (fstat(fileno(tree->file->fp), &paged) || paged.st_dev != st.st_dev ||
+        paged.st_ino != st.st_ino) {
+        return false;
+    }
+    // every leaf takes two nodes but the one at the root
+    size_t capacity = tree->nodes_count / 2 + 1;
+    SessionLeaf *leaves = malloc(capacity * sizeof(SessionLeaf));
+    if (!leaves) {
+        perror("Failed to allocate session leaves");
+        return false;
+    }
+    size_t leaf_count = 0;
+    char *real_path = realpath(path, nullptr);
+    char *cache_path = real_path ? session_path(real_path, true) : nullptr;
+    if (!cache_path ||
+        !collect_leaves(tree->root, tree->file, leaves, capacity,
+                        &leaf_count)) {
+        free(leaves);
+        free(real_path);
+        free(cache_path);
+        return false;
+    }
+
+    SessionHeader header = {
+        .file_size = size,
+        .mtime_ns = mtime_ns_then,
+        .device = st.st_dev,
+        .inode = st.st_ino,
+        .content_hash = content_hash(path, size),
+        .file_hash = *file_hash,
+        .format = format,
+        .length = tree->length,
+        .path_length = strlen(real_path),
+        .leaf_count = leaf_count,
+        .page_count = tree->file->page_count,
+        .cursor_line = view.cursor_line,
+        .cursor_column = view.cursor_column,
+        .scroll_line = view.scroll_line,
+    };
+    memcpy(header.magic, SESSION_MAGIC, sizeof(header.magic));
+
+    // written next to the cache and renamed over it once complete
+    size_t cache_length = strlen(cache_path);
+    char *temp_path = malloc(cache_length + sizeof(".XXXXXX"));
+    bool saved = false;
+    if (temp_path) {
+        memcpy(temp_path, cache_path, cache_length);
+        memcpy(temp_path + cache_length, ".XXXXXX", sizeof(".XXXXXX"));
+        int fd = mkstemp(temp_path);
+        if (fd < 0) {
+            perror("Failed to create session");
+        } else {
+            saved = write_session(fd, &header, real_path, leaves, tree->file) &&
+                    !rename(temp_path, cache_path);
+            if (!saved) {
+                unlink(temp_path);
+            }
+        }
+    }
+    free(temp_path);
+    free(leaves);
+    free(real_path);
+    free(cache_path);
+    return saved;
+}
+
+// Checks the mapped session against the file at real_path, true if it is
+// complete and the file is the one it was written for
+static bool is_session_current(const char *map, size_t map_size,
+                               const char *real_path) {
+    const SessionHeader *header = (const SessionHeader *)map;
+    if (map_size < sizeof(*header) ||
+        memcmp(header->magic, SESSION_MAGIC, sizeof(header->magic)) ||
+        header->path_length != strlen(real_path) ||
+        header->path_length > map_size - sizeof(*header) ||
+        memcmp(map + sizeof(*header), real_path, header->path_length)) {
+        return false;
+    }
+    size_t path_bytes = (header->path_length + 7) / 8 * 8;
+    if (path_bytes > map_size - sizeof(*header)) {
+        return false;
+    }
+    // both counts are bounded first, so the sizes cannot overflow
+    size_t body = map_size - sizeof(*header) - path_bytes;
+    if (header->leaf_count > body / sizeof(SessionLeaf) ||
+        header->page_count > body / sizeof(PageLines) ||
+        body != header->leaf_count * sizeof(SessionLeaf) +
+                    header->page_count * sizeof(PageLines)) {
+        return false;
+    }
+    const PageLines *pages =
+        (const PageLines *)(map + map_size) - header->page_count;
+    for (size_t i = 0; i < header->page_count; ++i) {
+        if (pages[i].newlines > pages[i].length ||
+            pages[i].length > FILE_PAGE_SPAN) {
+            return false;
+        }
+    }
+    struct stat st;
+    return !stat(real_path, &st) && (size_t)st.st_size == header->file_size &&
+           mtime_ns(&st) == header->mtime_ns && st.st_dev == header->device &&
+           st.st_ino == header->inode &&
+           header->file_hash.length == header->file_size &&
+           content_hash(real_path, header->file_size) ==
+               header->content_hash;
+}
+
+// Lazy leaves of the session over file, nullptr if one does not fit in it
+static RopeTree *build_session_tree(const SessionHeader *header,
+                                    const SessionLeaf *leaves,
+                                    PagedFile *file) {
+    size_t count = header->leaf_count;
+    Node **nodes = malloc((count ? count : 1) * sizeof(Node *));
+    if (!nodes) {
+        perror("Failed to allocate session leaves");
+        return nullptr;
+    }
+    size_t length = 0;
+    size_t built = 0;
+    for (; built < count; ++built) {
+        SessionLeaf leaf = leaves[built];
+        if (leaf.offset / FILE_PAGE_SPAN >= file->page_count ||
+            !leaf.length || leaf.offset % FILE_PAGE_SPAN + leaf.length >
+                                FILE_PAGE_SPAN) {
+            break;
+        }
+        nodes[built] = create_lazy_leaf(file, leaf.offset, leaf.length);
+        length += leaf.length;
+    }
+    if (built < count || length != header->length) {
+        for (size_t i = 0; i < built; ++i) {
+            free_node(nodes[i]);
+        }
+        free(nodes);
+        return nullptr;
+    }
+
+    RopeTree *tree = create_tree();
+    if (count) {
+        tree->root = build_balanced(nodes, 0, count - 1);
+        tree->height = calc_tree_height(tree->root);
+        tree->nodes_count = 2 * count - 1;
+    }
+    tree->length = length;
+    tree->file = file;
+    free(nodes);
+    return tree;
+}
+
+RopeTree *load_session(const char *path, LineIndex *index, TextFormat *format,
+                       FileHash *file_hash, SessionView *view) {
+    char *real_path = realpath(path, nullptr);
+    char *cache_path = real_path ? session_path(real_path, false) : nullptr;
+    int fd = cache_path ? open(cache_path, O_RDONLY) : -1;
+    free(cache_path);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || st.st_size == 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(real_path);
+        return nullptr;
+    }
+    size_t map_size = st.st_size;
+    char *map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map session");
+        free(real_path);
+        return nullptr;
+    }
+
+    RopeTree *tree = nullptr;
+    const SessionHeader *header = (const SessionHeader *)map;
+    if (is_session_current(map, map_size, real_path)) {
+        const char *body =
+            map + sizeof(*header) + (header->path_length + 7) / 8 * 8;
+        const SessionLeaf *leaves = (const SessionLeaf *)body;
+        const PageLines *pages =
+            (const PageLines *)(body +
+                                header->leaf_count * sizeof(SessionLeaf));
+
+        PagedFile *file = open_paged_file(real_path);
+        if (file && file->size == header->file_size &&
+            file->page_count == header->page_count) {
+            file->format = header->format;
+            memcpy(file->page_lines, pages,
+                   file->page_count * sizeof(PageLines));
+            tree = build_session_tree(header, leaves, file);
+        }
+        if (tree) {
+            *index = (LineIndex){0};
+            index_leaves(index, tree->root);
+            if (!index->chunk_count) {
+                clear_line_index(index);
+            }
+            *format = header->format;
+            *file_hash = header->file_hash;
+            // the view is kept inside the document
+            size_t line_count = index->line_num;
+            size_t line = MIN(header->cursor_line, line_count - 1);
+            size_t column =
+                MIN(header->cursor_column,
+                    get_line_length(index, line) - (line + 1 < line_count));
+            *view = (SessionView){line, column,
+                                  MIN(header->scroll_line, line_count - 1)};
+        } else if (file) {
+            release_paged_file(file);
+        }
+    }
+    munmap(map, map_size);
+    free(real_path);
+    return tree;
+}
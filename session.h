@@ -0,0 +1,44 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "cursor.h"
+#include "encoding.h"
+#include "file_hash.h"
+#include "rope.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Directory under $XDG_CACHE_HOME, or ~/.cache, the sessions are kept in
+#define SESSION_DIR "opengl-text-editor"
+
+// The content hash reads this many blocks spread over the file, first and
+// last included, so checking a cache does not read the whole file
+#define SESSION_HASH_SAMPLES 16
+#define SESSION_SAMPLE_BYTES 4096
+
+// Where the document was looked at when it was closed
+typedef struct {
+    size_t cursor_line;
+    size_t cursor_column;
+    size_t scroll_line;
+} SessionView;
+
+// Stores the lazy leaves of tree, the line counts of its pages and the view
+// for the file at path, which has to hash to file_hash and be modified at
+// mtime_ns still. Only trees made of lazy leaves paged from that very file,
+// not one it was saved over, are stored, false otherwise or if the cache
+// cannot be written
+bool save_session(const char *path, const FileHash *file_hash,
+                  int64_t mtime_ns, RopeTree *tree, TextFormat format,
+                  SessionView view);
+
+// Tree of the file at path rebuilt from its session cache without reading
+// the file, index, format, file_hash and view are filled in. The index is
+// counted from the stored pages, only pages the leaves cut into are read.
+// nullptr if there is no cache or the file changed since it was written
+[[nodiscard]]
+RopeTree *load_session(const char *path, LineIndex *index, TextFormat *format,
+                       FileHash *file_hash, SessionView *view);
+
+#endif
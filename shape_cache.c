@@ -0,0 +1,158 @@
+#include "shape_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// FNV-1a over the line content, mixed with the font size
+static uint64_t hash_line(const char *text, size_t length, uint32_t font_size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= font_size;
+    hash *= 1099511628211ULL;
+    return hash;
+}
+
+static void lru_unlink(ShapeCache *cache, ShapedLine *entry) {
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = nullptr;
+    entry->lru_next = nullptr;
+}
+
+static void lru_push_front(ShapeCache *cache, ShapedLine *entry) {
+    entry->lru_prev = nullptr;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = entry;
+    }
+    cache->lru_head = entry;
+    if (!cache->lru_tail) {
+        cache->lru_tail = entry;
+    }
+}
+
+static void remove_entry(ShapeCache *cache, ShapedLine *entry) {
+    ShapedLine **slot = &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+    while (*slot && *slot != entry) {
+        slot = &(*slot)->bucket_next;
+    }
+    if (*slot) {
+        *slot = entry->bucket_next;
+    }
+    lru_unlink(cache, entry);
+    hb_buffer_destroy(entry->buf);
+    free(entry->text);
+    free(entry);
+    cache->size--;
+}
+
+ShapeCache *create_shape_cache(size_t capacity) {
+    ShapeCache *cache = malloc(sizeof(ShapeCache));
+    if (!cache) {
+        perror("Failed to allocate shape cache");
+        return nullptr;
+    }
+    // power of two so the hash can be masked
+    cache->bucket_count = 16;
+    while (cache->bucket_count < capacity * 2) {
+        cache->bucket_count *= 2;
+    }
+    cache->buckets = calloc(cache->bucket_count, sizeof(ShapedLine *));
+    cache->lru_head = nullptr;
+    cache->lru_tail = nullptr;
+    cache->size = 0;
+    cache->capacity = capacity;
+    return cache;
+}
+
+ShapedLine *shape_line(ShapeCache *cache, RnFont *font, const char *text,
+                       size_t length, size_t line) {
+    uint64_t hash = hash_line(text, length, font->size);
+    size_t bucket = hash & (cache->bucket_count - 1);
+
+    for (ShapedLine *e = cache->buckets[bucket]; e; e = e->bucket_next) {
+        if (e->hash == hash && e->font_size == font->size &&
+            e->length == length && memcmp(e->text, text, length) == 0) {
+            e->line = line;
+            lru_unlink(cache, e);
+            lru_push_front(cache, e);
+            return e;
+        }
+    }
+
+    if (cache->size >= cache->capacity && cache->lru_tail) {
+        remove_entry(cache, cache->lru_tail);
+    }
+
+    ShapedLine *entry = malloc(sizeof(ShapedLine));
+    entry->hash = hash;
+    entry->text = malloc(length + 1);
+    memcpy(entry->text, text, length);
+    entry->text[length] = '\0';
+    entry->length = length;
+    entry->font_size = font->size;
+    entry->line = line;
+
+    entry->buf = hb_buffer_create();
+    hb_buffer_add_utf8(entry->buf, text, length, 0, length);
+    hb_buffer_guess_segment_properties(entry->buf);
+    hb_shape(font->hb_font, entry->buf, nullptr, 0);
+    entry->glyph_info =
+        hb_buffer_get_glyph_infos(entry->buf, &entry->glyph_count);
+    entry->glyph_pos =
+        hb_buffer_get_glyph_positions(entry->buf, &entry->glyph_count);
+
+    entry->bucket_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    lru_push_front(cache, entry);
+    cache->size++;
+    return entry;
+}
+
+void invalidate_shaped_lines(ShapeCache *cache, size_t first, size_t last) {
+    ShapedLine *e = cache->lru_head;
+    while (e) {
+        ShapedLine *next = e->lru_next;
+        if (e->line != SHAPE_NO_LINE && e->line >= first && e->line <= last) {
+            remove_entry(cache, e);
+        }
+        e = next;
+    }
+}
+
+void clear_shape_cache(ShapeCache *cache) {
+    while (cache->lru_head) {
+        remove_entry(cache, cache->lru_head);
+    }
+}
+
+size_t shape_cache_bytes(const ShapeCache *cache) {
+    size_t bytes =
+        sizeof(ShapeCache) + cache->bucket_count * sizeof(ShapedLine *);
+    for (ShapedLine *entry = cache->lru_head; entry; entry = entry->lru_next) {
+        bytes += sizeof(ShapedLine) + entry->length +
+                 entry->glyph_count *
+                     (sizeof(hb_glyph_info_t) + sizeof(hb_glyph_position_t));
+    }
+    return bytes;
+}
+
+void free_shape_cache(ShapeCache *cache) {
+    if (!cache) {
+        return;
+    }
+    clear_shape_cache(cache);
+    free(cache->buckets);
+    free(cache);
+}
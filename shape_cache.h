@@ -0,0 +1,56 @@
+#ifndef SHAPE_CACHE_H
+#define SHAPE_CACHE_H
+
+#include <harfbuzz/hb.h>
+#include <runara/runara.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Line tag for text that does not belong to the document (gutter etc.)
+#define SHAPE_NO_LINE SIZE_MAX
+
+typedef struct ShapedLine ShapedLine;
+
+// Harfbuzz result of one line, owned by the cache
+struct ShapedLine {
+    uint64_t hash;
+    char *text; // copy of the shaped text, compared on hash hit
+    size_t length;
+    uint32_t font_size;
+    size_t line; // line the entry was last used for
+    hb_buffer_t *buf;
+    hb_glyph_info_t *glyph_info;
+    hb_glyph_position_t *glyph_pos;
+    uint32_t glyph_count;
+    ShapedLine *bucket_next;
+    ShapedLine *lru_prev;
+    ShapedLine *lru_next;
+};
+
+typedef struct {
+    ShapedLine **buckets;
+    size_t bucket_count;
+    ShapedLine *lru_head; // most recently used
+    ShapedLine *lru_tail; // evicted first
+    size_t size;
+    size_t capacity;
+} ShapeCache;
+
+[[nodiscard]]
+ShapeCache *create_shape_cache(size_t capacity);
+
+// Returns the cached shaping of text, shaping it on a miss
+ShapedLine *shape_line(ShapeCache *cache, RnFont *font, const char *text,
+                       size_t length, size_t line);
+
+// Drops entries last used for lines in [first, last] after an edit
+void invalidate_shaped_lines(ShapeCache *cache, size_t first, size_t last);
+
+void clear_shape_cache(ShapeCache *cache);
+
+// Bytes of the entries, their text and the glyphs harfbuzz holds for them
+size_t shape_cache_bytes(const ShapeCache *cache);
+
+void free_shape_cache(ShapeCache *cache);
+
+#endif
@@ -0,0 +1,456 @@
+// fileno, fstat and nanosecond modification times are POSIX
+#define _XOPEN_SOURCE 700
+
+#include "watch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bytes at start that were old_length long in the document and are
+// new_length long in the file
+typedef struct {
+    size_t start;
+    size_t old_length;
+    size_t new_length;
+} ChangedRange;
+
+static int64_t mtime_ns(const struct stat *st) {
+    return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static void remember_file(FileWatch *watch, const struct stat *st) {
+    watch->device = st->st_dev;
+    watch->inode = st->st_ino;
+    watch->mtime_ns = mtime_ns(st);
+}
+
+// Hash of the sampled blocks of the first size bytes, false if they cannot
+// be read
+static bool sample_file(FILE *fp, size_t size, FileHash *samples) {
+    char block[WATCH_SAMPLE_BYTES];
+    size_t span = size > sizeof(block) ? size - sizeof(block) : 0;
+    *samples = start_file_hash();
+    for (size_t i = 0; i < WATCH_SAMPLES; ++i) {
+        size_t offset = i == WATCH_SAMPLES - 1
+                            ? span
+                            : span / (WATCH_SAMPLES - 1) * i;
+        size_t length = MIN(sizeof(block), size - offset);
+        if (fseek(fp, offset, SEEK_SET) ||
+            fread(block, 1, length, fp) != length) {
+            return false;
+        }
+        update_file_hash(samples, block, length);
+    }
+    return true;
+}
+
+static void resample_file(FileWatch *watch, FILE *fp) {
+    watch->sampled = sample_file(fp, watch->size, &watch->samples);
+}
+
+FileWatch *create_file_watch(const char *path, size_t size,
+                             const FileHash *hash, size_t length,
+                             TextFormat format) {
+    FileWatch *watch = calloc(1, sizeof(FileWatch));
+    if (!watch) {
+        perror("Failed to allocate file watch");
+        return nullptr;
+    }
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) {
+        perror("Failed to start watching file");
+        free(watch);
+        return nullptr;
+    }
+    // The directory is watched so a file replaced by a rename is followed
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash - path + 1) : strdup(".");
+    watch->path = strdup(path);
+    watch->name = strdup(slash ? slash + 1 : path);
+    if (!dir || !watch->path || !watch->name ||
+        inotify_add_watch(watch->fd, dir,
+                          IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO |
+                              IN_CREATE) < 0) {
+        perror("Failed to start watching file");
+        free(dir);
+        free_file_watch(watch);
+        return nullptr;
+    }
+    free(dir);
+
+    watch->size = size;
+    watch->length = length;
+    watch->format = format;
+    if (hash) {
+        watch->hash = *hash;
+        watch->hashed = true;
+    }
+    FILE *fp = fopen(path, "r");
+    struct stat st;
+    if (fp && !fstat(fileno(fp), &st)) {
+        remember_file(watch, &st);
+        resample_file(watch, fp);
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    return watch;
+}
+
+void free_file_watch(FileWatch *watch) {
+    if (!watch) {
+        return;
+    }
+    close(watch->fd);
+    free(watch->path);
+    free(watch->name);
+    free(watch);
+}
+
+bool file_changed(FileWatch *watch) {
+    alignas(struct inotify_event) char buffer[4096];
+    bool changed = false;
+    ssize_t length;
+    while ((length = read(watch->fd, buffer, sizeof(buffer))) > 0) {
+        const struct inotify_event *event;
+        for (char *at = buffer; at < buffer + length;
+             at += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)at;
+            if (event->len && !strcmp(event->name, watch->name)) {
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+static bool read_at(FILE *fp, size_t offset, size_t length, char *dst) {
+    if (fseek(fp, offset, SEEK_SET) || fread(dst, 1, length, fp) != length) {
+        perror("Failed to read changed file");
+        return false;
+    }
+    return true;
+}
+
+// Reads the file from offset up to length bytes of whole units into
+// file_block, adds them to the hash and decodes them into text, returns the
+// bytes read. last is set if they end the file
+static size_t read_decoded(FileWatch *watch, FILE *fp, size_t offset,
+                           size_t length, bool last, char *file_block,
+                           char *text, size_t *text_length) {
+    size_t unit = unit_bytes(watch->format);
+    size_t start = bom_length(watch->format);
+    length -= length % unit;
+    // the unit before completes pairs split at offset
+    size_t before = offset > start ? unit : 0;
+    if (!read_at(fp, offset - before, before + length, file_block)) {
+        return 0;
+    }
+    update_file_hash(&watch->hash, file_block + before, length);
+    uint32_t prev = last_unit(watch->format, file_block, before);
+    *text_length = decode_text(watch->format, prev, file_block + before,
+                               length, last, text);
+    return length;
+}
+
+// Hash of the first size bytes of the file, false if they cannot be read
+static bool hash_file(FILE *fp, size_t size, char *file_block,
+                      FileHash *hash) {
+    *hash = start_file_hash();
+    for (size_t offset = 0; offset < size; offset += WATCH_BLOCK_BYTES) {
+        size_t length = MIN(WATCH_BLOCK_BYTES, size - offset);
+        if (!read_at(fp, offset, length, file_block)) {
+            return false;
+        }
+        update_file_hash(hash, file_block, length);
+    }
+    return true;
+}
+
+// The bytes before the old end of the same file are the ones the document
+// was read from. Only the sampled blocks are read again, the hash of the
+// rest is carried on from what was read before
+static bool kept_old_bytes(FileWatch *watch, FILE *fp) {
+    FileHash samples;
+    if (!watch->hashed || !watch->sampled ||
+        !sample_file(fp, watch->size, &samples) ||
+        !same_file_hash(&samples, &watch->samples)) {
+        return false;
+    }
+    // a lone \r at the old end becomes part of a \r\n if a \n was appended
+    size_t unit = unit_bytes(watch->format);
+    char last[2];
+    return !watch->format.crlf ||
+           watch->size < bom_length(watch->format) + unit ||
+           (read_at(fp, watch->size - unit, unit, last) &&
+            last_unit(watch->format, last, unit) != '\r');
+}
+
+static FileChange append_file_tail(FileWatch *watch, RopeTree *tree,
+                                   LineIndex *index, FILE *fp, size_t size,
+                                   char *text, char *file_block) {
+    FileChange change = FILE_UNCHANGED;
+    while (watch->size + unit_bytes(watch->format) <= size) {
+        size_t length = 0;
+        size_t wanted = MIN(WATCH_BLOCK_BYTES, size - watch->size);
+        size_t read =
+            read_decoded(watch, fp, watch->size, wanted,
+                         watch->size + wanted == size, file_block, text,
+                         &length);
+        if (!read) {
+            break;
+        }
+        watch->size += read;
+        Node *subtree = build_node_from_text(text, length);
+        if (subtree) {
+            insert_text_to_index(index, tree->length, text, length);
+            append_subtree(tree, subtree, length, count_nodes(subtree));
+        }
+        change = FILE_APPENDED;
+    }
+    return change;
+}
+
+// Bytes at the start of both that are the same, false if the file or a
+// page of the document cannot be read
+static bool common_prefix(RopeTree *tree, FILE *fp, size_t limit,
+                          char *doc_block, char *file_block, size_t *prefix) {
+    for (size_t offset = 0; offset < limit; offset += WATCH_BLOCK_BYTES) {
+        size_t length = MIN(WATCH_BLOCK_BYTES, limit - offset);
+        if (copy_range(tree->root, offset, length, doc_block) < length ||
+            !read_at(fp, offset, length, file_block)) {
+            return false;
+        }
+        if (memcmp(doc_block, file_block, length)) {
+            size_t i = 0;
+            while (doc_block[i] == file_block[i]) {
+                i++;
+            }
+            *prefix = offset + i;
+            return true;
+        }
+    }
+    *prefix = limit;
+    return true;
+}
+
+// Same as common_prefix from the ends of the document and the file
+static bool common_suffix(RopeTree *tree, FILE *fp, size_t size, size_t limit,
+                          char *doc_block, char *file_block, size_t *suffix) {
+    for (size_t done = 0; done < limit; done += WATCH_BLOCK_BYTES) {
+        size_t length = MIN(WATCH_BLOCK_BYTES, limit - done);
+        if (copy_range(tree->root, tree->length - done - length, length,
+                       doc_block) < length ||
+            !read_at(fp, size - done - length, length, file_block)) {
+            return false;
+        }
+        if (memcmp(doc_block, file_block, length)) {
+            size_t i = length;
+            while (doc_block[i - 1] == file_block[i - 1]) {
+                i--;
+            }
+            *suffix = done + length - i;
+            return true;
+        }
+    }
+    *suffix = limit;
+    return true;
+}
+
+// Ranges of a file as long as the document that differ from it. Runs of
+// changed blocks become one range, past WATCH_MAX_RANGES the last range
+// grows instead
+static bool diff_blocks(RopeTree *tree, FILE *fp, size_t start, size_t end,
+                        char *doc_block, char *file_block,
+                        ChangedRange *ranges, size_t *count) {
+    *count = 0;
+    for (size_t offset = start; offset < end; offset += WATCH_BLOCK_BYTES) {
+        size_t length = MIN(WATCH_BLOCK_BYTES, end - offset);
+        if (copy_range(tree->root, offset, length, doc_block) < length ||
+            !read_at(fp, offset, length, file_block)) {
+            return false;
+        }
+        if (!memcmp(doc_block, file_block, length)) {
+            continue;
+        }
+        size_t first = 0;
+        while (doc_block[first] == file_block[first]) {
+            first++;
+        }
+        size_t last = length;
+        while (doc_block[last - 1] == file_block[last - 1]) {
+            last--;
+        }
+
+        ChangedRange *prev = *count ? &ranges[*count - 1] : nullptr;
+        if (prev && (prev->start + prev->old_length == offset + first ||
+                     *count == WATCH_MAX_RANGES)) {
+            prev->old_length = offset + last - prev->start;
+        } else {
+            prev = &ranges[(*count)++];
+            *prev = (ChangedRange){.start = offset + first,
+                                   .old_length = last - first};
+        }
+        prev->new_length = prev->old_length;
+    }
+    return true;
+}
+
+// Replaces range in the document with the text the file has there. The
+// line index is only patched for ranges within a block, reindex is set for
+// larger ones
+static bool apply_range(RopeTree *tree, LineIndex *index, FILE *fp,
+                        ChangedRange range, char *block, bool *reindex) {
+    size_t count = (range.new_length + WATCH_BLOCK_BYTES - 1) /
+                   WATCH_BLOCK_BYTES;
+    Node **blocks = malloc(MAX(count, 1) * sizeof(Node *));
+    if (!blocks) {
+        perror("Failed to allocate changed blocks");
+        return false;
+    }
+    if (count > 1) {
+        *reindex = true;
+    } else if (!*reindex) {
+        delete_text_from_index(index, range.start, range.old_length);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        size_t offset = i * WATCH_BLOCK_BYTES;
+        size_t length = MIN(WATCH_BLOCK_BYTES, range.new_length - offset);
+        if (!read_at(fp, range.start + offset, length, block)) {
+            for (size_t j = 0; j < i; ++j) {
+                free_tree(blocks[j]);
+            }
+            free(blocks);
+            return false;
+        }
+        blocks[i] = build_node_from_text(block, length);
+        if (!*reindex) {
+            insert_text_to_index(index, range.start, block, length);
+        }
+    }
+    Node *subtree = count ? build_balanced(blocks, 0, count - 1) : nullptr;
+    free(blocks);
+    replace_range(tree, range.start, range.old_length, subtree,
+                  range.new_length);
+    return true;
+}
+
+static void move_offset(size_t *offset, ChangedRange range) {
+    if (*offset >= range.start + range.old_length) {
+        *offset = *offset - range.old_length + range.new_length;
+    } else if (*offset > range.start + range.new_length) {
+        *offset = range.start + range.new_length;
+    }
+}
+
+static FileChange patch_file_changes(RopeTree **tree, LineIndex *index,
+                                     FILE *fp, size_t size, size_t *offset,
+                                     char *doc_block, char *file_block) {
+    RopeTree *doc = *tree;
+    size_t shorter = MIN(doc->length, size);
+    size_t prefix, suffix;
+    if (!common_prefix(doc, fp, shorter, doc_block, file_block, &prefix) ||
+        !common_suffix(doc, fp, size, shorter - prefix, doc_block, file_block,
+                       &suffix)) {
+        return FILE_RELOAD;
+    }
+
+    ChangedRange ranges[WATCH_MAX_RANGES];
+    size_t count = 0;
+    if (doc->length == size) {
+        // Nothing moved, so only the blocks that differ are replaced
+        if (!diff_blocks(doc, fp, prefix, size - suffix, doc_block,
+                         file_block, ranges, &count)) {
+            return FILE_RELOAD;
+        }
+    } else {
+        ranges[count++] = (ChangedRange){
+            .start = prefix,
+            .old_length = doc->length - suffix - prefix,
+            .new_length = size - suffix - prefix,
+        };
+    }
+    if (!count) {
+        return FILE_UNCHANGED;
+    }
+
+    bool reindex = false;
+    for (size_t i = 0; i < count; ++i) {
+        if (!apply_range(doc, index, fp, ranges[i], file_block, &reindex)) {
+            return FILE_RELOAD;
+        }
+        move_offset(offset, ranges[i]);
+    }
+    *tree = balance_rope(doc);
+    if (reindex) {
+        List *leaves = get_leaves(*tree);
+        travelse_list_and_index_lines(leaves, index);
+        free_list(leaves);
+    }
+    return FILE_PATCHED;
+}
+
+FileChange merge_file_changes(FileWatch *watch, RopeTree **tree,
+                              LineIndex *index, size_t *offset) {
+    if (watch->modified || (*tree)->length != watch->length) {
+        if (!watch->reported) {
+            fprintf(stderr, "%s changed on disk, keeping the edited text\n",
+                    watch->path);
+            watch->reported = true;
+        }
+        return FILE_UNCHANGED;
+    }
+    // A file being replaced may be missing for a moment, the new one brings
+    // its own event
+    FILE *fp = fopen(watch->path, "r");
+    if (!fp) {
+        return FILE_UNCHANGED;
+    }
+    struct stat st;
+    char *doc_block = malloc(decoded_capacity(WATCH_BLOCK_BYTES));
+    char *file_block = malloc(WATCH_BLOCK_BYTES + 2);
+    if (fstat(fileno(fp), &st) || !doc_block || !file_block) {
+        perror("Failed to read changed file");
+        free(doc_block);
+        free(file_block);
+        fclose(fp);
+        return FILE_UNCHANGED;
+    }
+
+    size_t size = st.st_size;
+    bool same_file = st.st_dev == watch->device && st.st_ino == watch->inode;
+    // offsets in the file and the document only line up for plain text,
+    // which keeps any \r it gets as it is
+    bool plain = watch->format.encoding == TEXT_UTF8 && !watch->format.bom &&
+                 !watch->format.crlf && watch->size == watch->length;
+    FileChange change = FILE_UNCHANGED;
+    if (same_file && size == watch->size && mtime_ns(&st) == watch->mtime_ns) {
+        // a late event for a write that was merged already
+    } else if (same_file && size > watch->size && kept_old_bytes(watch, fp)) {
+        change = append_file_tail(watch, *tree, index, fp, size, doc_block,
+                                  file_block);
+        resample_file(watch, fp);
+    } else if (((*tree)->file && same_file) || !plain) {
+        // lazy leaves would read the new text where the old one was, and
+        // decoded text cannot be diffed against the file
+        change = FILE_RELOAD;
+    } else {
+        change = patch_file_changes(tree, index, fp, size, offset, doc_block,
+                                    file_block);
+        watch->size = (*tree)->length;
+        // the document is the file again
+        watch->hashed = change != FILE_RELOAD &&
+                        hash_file(fp, watch->size, file_block, &watch->hash);
+        resample_file(watch, fp);
+    }
+
+    watch->length = (*tree)->length;
+    remember_file(watch, &st);
+    free(doc_block);
+    free(file_block);
+    fclose(fp);
+    return change;
+}
@@ -0,0 +1,78 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "cursor.h"
+#include "encoding.h"
+#include "file_hash.h"
+#include "rope.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Unit the file is read and compared in when it changes
+#define WATCH_BLOCK_BYTES (1 << 20)
+
+// Most ranges a rewrite that kept the length is patched in, the last one
+// grows to cover any changes after it
+#define WATCH_MAX_RANGES 64
+
+// An append is checked against this many blocks spread over the old file,
+// the first and the one ending it included, so it costs as much as the new
+// bytes and not a read of the whole file
+#define WATCH_SAMPLES 16
+#define WATCH_SAMPLE_BYTES 4096
+
+typedef enum {
+    FILE_UNCHANGED,
+    FILE_APPENDED, // text was added to the end of the document
+    FILE_PATCHED,  // ranges of the document were replaced
+    FILE_RELOAD,   // cannot be merged, the file has to be loaded again
+} FileChange;
+
+// The file the document was loaded from or saved to, watched for writes
+// by other processes
+typedef struct {
+    int fd; // inotify instance
+    char *path;
+    char *name; // file name within the watched directory
+    TextFormat format;
+    // the file as the document last matched it, and the document length
+    // then. Unless both are the same plain UTF-8 only appends are merged
+    size_t size;
+    size_t length;
+    // of the first size bytes, kept up to date by appends
+    FileHash hash;
+    bool hashed;
+    // of the sampled blocks of the first size bytes, the same file grown
+    // only counts as appended to if they still hash the same
+    FileHash samples;
+    bool sampled;
+    uint64_t device;
+    uint64_t inode;
+    int64_t mtime_ns;
+    // the document was edited since, changes are no longer merged
+    bool modified;
+    bool reported;
+} FileWatch;
+
+// Watches path, the first size bytes of which in format decode to the
+// length bytes of the document. hash is the hash of those bytes, nullptr if
+// it is not known yet
+[[nodiscard]]
+FileWatch *create_file_watch(const char *path, size_t size,
+                             const FileHash *hash, size_t length,
+                             TextFormat format);
+
+void free_file_watch(FileWatch *watch);
+
+// True if the file was written since the last call, does not block
+bool file_changed(FileWatch *watch);
+
+// Brings the document in line with the file. Appends only read and decode
+// the new bytes, other writes to plain files are diffed block by block
+// against the document and only the differing ranges are replaced. offset
+// is moved along with the text around it
+FileChange merge_file_changes(FileWatch *watch, RopeTree **tree,
+                              LineIndex *index, size_t *offset);
+
+#endif
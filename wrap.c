@@ -0,0 +1,299 @@
+#include "wrap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+WrapIndex *create_wrap_index() {
+    WrapIndex *wrap = calloc(1, sizeof(WrapIndex));
+    if (!wrap) {
+        perror("Failed to allocate wrap index");
+    }
+    return wrap;
+}
+
+void free_wrap_index(WrapIndex *wrap) {
+    if (!wrap) {
+        return;
+    }
+    for (size_t i = 0; i < wrap->line_num; ++i) {
+        free(wrapped_line(wrap, i)->breaks);
+    }
+    free(wrap->lines);
+    free(wrap->tree);
+    free(wrap);
+}
+
+static size_t line_slot(WrapIndex *wrap, size_t line) {
+    return line < wrap->gap_start ? line : line + wrap->gap_length;
+}
+
+static void fenwick_add(WrapIndex *wrap, size_t slot, int64_t delta) {
+    for (size_t i = slot + 1; i <= wrap->capacity; i += i & -i) {
+        wrap->tree[i] += delta;
+    }
+}
+
+static void rebuild_fenwick(WrapIndex *wrap) {
+    size_t gap_end = wrap->gap_start + wrap->gap_length;
+    for (size_t i = 1; i <= wrap->capacity; ++i) {
+        bool in_gap = i - 1 >= wrap->gap_start && i - 1 < gap_end;
+        wrap->tree[i] = in_gap ? 0 : wrap->lines[i - 1].row_count;
+    }
+    for (size_t i = 1; i <= wrap->capacity; ++i) {
+        size_t parent = i + (i & -i);
+        if (parent <= wrap->capacity) {
+            wrap->tree[parent] += wrap->tree[i];
+        }
+    }
+}
+
+// Grows the gap to count slots at least, the lines after it move to the
+// end of the larger buffer
+static void reserve_gap(WrapIndex *wrap, size_t count) {
+    if (count <= wrap->gap_length) {
+        return;
+    }
+    size_t new_cap = wrap->capacity ? wrap->capacity : 64;
+    while (new_cap < wrap->line_num + count) {
+        new_cap *= 2;
+    }
+    size_t after = wrap->line_num - wrap->gap_start;
+    wrap->lines = realloc(wrap->lines, new_cap * sizeof(WrappedLine));
+    wrap->tree = realloc(wrap->tree, (new_cap + 1) * sizeof(size_t));
+    memmove(&wrap->lines[new_cap - after],
+            &wrap->lines[wrap->gap_start + wrap->gap_length],
+            after * sizeof(WrappedLine));
+    wrap->gap_length = new_cap - wrap->line_num;
+    wrap->capacity = new_cap;
+    rebuild_fenwick(wrap);
+}
+
+// Moves a line from one slot to another, the target slot is in the gap
+static void move_slot(WrapIndex *wrap, size_t from, size_t to) {
+    int64_t rows = wrap->lines[from].row_count;
+    fenwick_add(wrap, from, -rows);
+    fenwick_add(wrap, to, rows);
+    wrap->lines[to] = wrap->lines[from];
+}
+
+// Moves the gap to start before line
+static void move_gap(WrapIndex *wrap, size_t line) {
+    size_t distance = line > wrap->gap_start ? line - wrap->gap_start
+                                             : wrap->gap_start - line;
+    // far moves are cheaper as one memmove and a rebuild than as a fenwick
+    // update per line
+    if (distance > wrap->capacity / 64) {
+        size_t gap_end = wrap->gap_start + wrap->gap_length;
+        if (line < wrap->gap_start) {
+            memmove(&wrap->lines[line + wrap->gap_length], &wrap->lines[line],
+                    distance * sizeof(WrappedLine));
+        } else {
+            memmove(&wrap->lines[wrap->gap_start], &wrap->lines[gap_end],
+                    distance * sizeof(WrappedLine));
+        }
+        wrap->gap_start = line;
+        rebuild_fenwick(wrap);
+        return;
+    }
+    while (wrap->gap_start > line) {
+        wrap->gap_start--;
+        move_slot(wrap, wrap->gap_start,
+                  wrap->gap_start + wrap->gap_length);
+    }
+    while (wrap->gap_start < line) {
+        move_slot(wrap, wrap->gap_start + wrap->gap_length,
+                  wrap->gap_start);
+        wrap->gap_start++;
+    }
+}
+
+// Unwrapped lines count as a single row until they are wrapped
+static WrappedLine unwrapped_line() {
+    return (WrappedLine){.breaks = nullptr, .row_count = 1};
+}
+
+void configure_wrap(WrapIndex *wrap, uint32_t columns, uint32_t font_size) {
+    columns = columns ? columns : 1;
+    if (columns != wrap->columns || font_size != wrap->font_size) {
+        wrap->idle_line = 0;
+    }
+    wrap->columns = columns;
+    wrap->font_size = font_size;
+}
+
+void reset_wrap_lines(WrapIndex *wrap, size_t line_num) {
+    for (size_t i = 0; i < wrap->line_num; ++i) {
+        free(wrapped_line(wrap, i)->breaks);
+    }
+    wrap->line_num = 0;
+    wrap->gap_start = 0;
+    wrap->gap_length = wrap->capacity;
+    reserve_gap(wrap, line_num);
+    for (size_t i = 0; i < line_num; ++i) {
+        wrap->lines[i] = unwrapped_line();
+    }
+    wrap->line_num = line_num;
+    wrap->gap_start = line_num;
+    wrap->gap_length = wrap->capacity - line_num;
+    wrap->idle_line = 0;
+    rebuild_fenwick(wrap);
+}
+
+void insert_wrap_lines(WrapIndex *wrap, size_t at, size_t count) {
+    if (at > wrap->line_num) {
+        return; // not built yet, the next wrapped frame resets it
+    }
+    reserve_gap(wrap, count);
+    move_gap(wrap, at);
+    for (size_t i = 0; i < count; ++i) {
+        wrap->lines[wrap->gap_start] = unwrapped_line();
+        fenwick_add(wrap, wrap->gap_start, 1);
+        wrap->gap_start++;
+        wrap->gap_length--;
+    }
+    wrap->line_num += count;
+}
+
+void delete_wrap_lines(WrapIndex *wrap, size_t at, size_t count) {
+    if (at + count > wrap->line_num) {
+        return;
+    }
+    // the deleted lines end up right before the gap
+    move_gap(wrap, at + count);
+    for (size_t i = 0; i < count; ++i) {
+        wrap->gap_start--;
+        wrap->gap_length++;
+        WrappedLine *deleted = &wrap->lines[wrap->gap_start];
+        fenwick_add(wrap, wrap->gap_start, -(int64_t)deleted->row_count);
+        free(deleted->breaks);
+    }
+    wrap->line_num -= count;
+}
+
+void invalidate_wrap_line(WrapIndex *wrap, size_t line) {
+    if (line < wrap->line_num) {
+        wrapped_line(wrap, line)->columns = 0;
+    }
+}
+
+WrappedLine *wrapped_line(WrapIndex *wrap, size_t line) {
+    return &wrap->lines[line_slot(wrap, line)];
+}
+
+bool is_line_wrapped(WrapIndex *wrap, size_t line) {
+    WrappedLine *wrapped = wrapped_line(wrap, line);
+    return wrapped->columns == wrap->columns &&
+           wrapped->font_size == wrap->font_size;
+}
+
+void start_wrap_line(WrapIndex *wrap, size_t line, uint32_t tab_w,
+                     LineWrapper *wrapper) {
+    WrappedLine *wrapped = wrapped_line(wrap, line);
+    *wrapper = (LineWrapper){
+        .line = line, .old_rows = wrapped->row_count, .tab_w = tab_w};
+    free(wrapped->breaks);
+    wrapped->breaks = nullptr;
+    wrapped->row_count = 1;
+}
+
+void feed_wrap_line(WrapIndex *wrap, LineWrapper *wrapper, const char *text,
+                    size_t length) {
+    WrappedLine *wrapped = wrapped_line(wrap, wrapper->line);
+    for (size_t k = 0; k < length; ++k) {
+        unsigned char c = text[k];
+        if ((c & 0xC0) == 0x80) {
+            continue; // utf8 continuation byte
+        }
+        size_t i = wrapper->offset + k;
+        size_t width = c == '\t' ? wrapper->tab_w : 1;
+        if (wrapper->cells + width > wrap->columns && i > wrapper->row_start) {
+            // break after the last space, or inside the word if there is none
+            bool at_word = wrapper->word_start > wrapper->row_start;
+            size_t brk = at_word ? wrapper->word_start : i;
+            if (wrapped->row_count - 1 == wrapper->capacity) {
+                wrapper->capacity =
+                    wrapper->capacity ? wrapper->capacity * 2 : 4;
+                wrapped->breaks = realloc(wrapped->breaks,
+                                          wrapper->capacity * sizeof(uint32_t));
+            }
+            wrapped->breaks[wrapped->row_count - 1] = brk;
+            wrapped->row_count++;
+            wrapper->row_start = brk;
+            // the word moved to the new row takes its cells along
+            wrapper->cells = at_word ? wrapper->word_cells : 0;
+        }
+        wrapper->cells += width;
+        wrapper->word_cells += width;
+        if (c == ' ') {
+            wrapper->word_start = i + 1;
+            wrapper->word_cells = 0;
+        }
+    }
+    wrapper->offset += length;
+}
+
+void finish_wrap_line(WrapIndex *wrap, LineWrapper *wrapper) {
+    WrappedLine *wrapped = wrapped_line(wrap, wrapper->line);
+    wrapped->columns = wrap->columns;
+    wrapped->font_size = wrap->font_size;
+    if (wrapped->row_count != wrapper->old_rows) {
+        fenwick_add(wrap, line_slot(wrap, wrapper->line),
+                    (int64_t)wrapped->row_count - wrapper->old_rows);
+    }
+}
+
+void wrap_line(WrapIndex *wrap, size_t line, const char *text, size_t length,
+               uint32_t tab_w) {
+    LineWrapper wrapper;
+    start_wrap_line(wrap, line, tab_w, &wrapper);
+    feed_wrap_line(wrap, &wrapper, text, length);
+    finish_wrap_line(wrap, &wrapper);
+}
+
+size_t row_of_line(WrapIndex *wrap, size_t line) {
+    size_t rows = 0;
+    size_t end = line_slot(wrap, line < wrap->line_num ? line : wrap->line_num);
+    for (size_t i = end; i > 0; i -= i & -i) {
+        rows += wrap->tree[i];
+    }
+    return rows;
+}
+
+size_t line_of_row(WrapIndex *wrap, size_t row, size_t *row_in_line) {
+    size_t slot = 0;
+    size_t step = 1;
+    while (step * 2 <= wrap->capacity) {
+        step *= 2;
+    }
+    // descend to the last slot whose first row is <= row, gap slots have no
+    // rows so it is never one of them
+    for (; wrap->capacity && step; step /= 2) {
+        if (slot + step <= wrap->capacity && wrap->tree[slot + step] <= row) {
+            slot += step;
+            row -= wrap->tree[slot];
+        }
+    }
+    size_t line = slot < wrap->gap_start ? slot : slot - wrap->gap_length;
+    if (line >= wrap->line_num && wrap->line_num) {
+        // past the end, clamp to the last row
+        line = wrap->line_num - 1;
+        row = wrapped_line(wrap, line)->row_count - 1;
+    }
+    *row_in_line = row;
+    return line;
+}
+
+size_t total_rows(WrapIndex *wrap) {
+    return row_of_line(wrap, wrap->line_num);
+}
+
+size_t row_of_column(WrapIndex *wrap, size_t line, size_t column,
+                     size_t *row_start) {
+    WrappedLine *wrapped = wrapped_line(wrap, line);
+    size_t row = 0;
+    while (row + 1 < wrapped->row_count && wrapped->breaks[row] <= column) {
+        row++;
+    }
+    *row_start = row ? wrapped->breaks[row - 1] : 0;
+    return row;
+}
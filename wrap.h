@@ -0,0 +1,95 @@
+#ifndef WRAP_H
+#define WRAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lines wrapped per frame outside the visible range
+#define WRAP_IDLE_LINES 256
+
+// Visual rows of one logical line
+typedef struct {
+    uint32_t *breaks; // byte offsets where rows after the first start
+    uint32_t row_count;
+    // wrap settings the breaks were computed for
+    uint32_t columns;
+    uint32_t font_size;
+} WrappedLine;
+
+// Maps logical lines to visual rows, row counts are kept in a fenwick
+// tree so both directions are O(log n). Lines sit in a gap buffer with the
+// gap where lines were last inserted or deleted, so an edit only moves the
+// lines between it and the previous one
+typedef struct {
+    bool enabled;
+    uint32_t columns;
+    uint32_t font_size;
+    WrappedLine *lines; // capacity slots, the gap included
+    size_t *tree; // fenwick tree over the row_count of slots, 1 based
+    size_t line_num;
+    size_t gap_start;
+    size_t gap_length; // slots of the gap, they count no rows
+    size_t capacity;
+    size_t idle_line; // next line looked at by idle wrapping
+} WrapIndex;
+
+[[nodiscard]]
+WrapIndex *create_wrap_index();
+
+void free_wrap_index(WrapIndex *wrap);
+
+// Lines are re-wrapped lazily once the width or font size changes
+void configure_wrap(WrapIndex *wrap, uint32_t columns, uint32_t font_size);
+
+// Forgets every line, used after loads and undo
+void reset_wrap_lines(WrapIndex *wrap, size_t line_num);
+
+void insert_wrap_lines(WrapIndex *wrap, size_t at, size_t count);
+
+void delete_wrap_lines(WrapIndex *wrap, size_t at, size_t count);
+
+void invalidate_wrap_line(WrapIndex *wrap, size_t line);
+
+WrappedLine *wrapped_line(WrapIndex *wrap, size_t line);
+
+bool is_line_wrapped(WrapIndex *wrap, size_t line);
+
+// Computes the row breaks of line, text without the trailing new line
+void wrap_line(WrapIndex *wrap, size_t line, const char *text, size_t length,
+               uint32_t tab_w);
+
+// Row breaks of a line found from its text passed in pieces, in order, so
+// a long line is wrapped without a copy of all of it
+typedef struct {
+    size_t line;
+    size_t offset; // in the line of the next piece
+    size_t capacity; // of the breaks
+    size_t row_start;
+    size_t word_start; // first byte after the last space of the row
+    size_t cells;
+    size_t word_cells; // cells from word_start on
+    uint32_t old_rows;
+    uint32_t tab_w;
+} LineWrapper;
+
+void start_wrap_line(WrapIndex *wrap, size_t line, uint32_t tab_w,
+                     LineWrapper *wrapper);
+
+void feed_wrap_line(WrapIndex *wrap, LineWrapper *wrapper, const char *text,
+                    size_t length);
+
+void finish_wrap_line(WrapIndex *wrap, LineWrapper *wrapper);
+
+size_t row_of_line(WrapIndex *wrap, size_t line);
+
+// Line containing row, row_in_line receives the row inside that line
+size_t line_of_row(WrapIndex *wrap, size_t row, size_t *row_in_line);
+
+size_t total_rows(WrapIndex *wrap);
+
+// Row inside line holding byte column, row_start receives its first byte
+size_t row_of_column(WrapIndex *wrap, size_t line, size_t column,
+                     size_t *row_start);
+
+#endif